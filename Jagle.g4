@@ -7,7 +7,9 @@ prog: stmtList + EOF ;
 statement
     : END
     | variableDeclStmt
+    | arrayDeclStmt
     | variableAssignmentStmt
+    | elementAssignmentStmt
     | forStmt
     | ifStmt
     | printStmt
@@ -19,6 +21,7 @@ statement
     | returnStmt
     | funcStmt
     | funcCallStmt
+    | importStmt
     ;
 
 expression
@@ -32,6 +35,8 @@ expression
     | expression relop expression # relationalExpression
     | expression (AND | OR) expression # logicalExpression
     | variableAssignment # variableAssignmentExpression
+    | elementAssignment # elementAssignmentExpression
+    | identifier LBRACKET expression RBRACKET # indexExpression
     | identifier # identifierExpression
     | literal # literalExpression
     ;
@@ -52,18 +57,29 @@ funcDefStmt
     : funcDef
     ;
 
+// A memo func caches its results by its arguments
 funcDef
-    : FUNC identifier LPAREN argList? RPAREN (COLON variableType)? stmtList ENDFUNC
+    : MEMO? FUNC identifier LPAREN argList? RPAREN (COLON variableType)? stmtList ENDFUNC
     ;
 
 argList
-    : identifier COLON variableType (COMMA identifier COLON variableType)*
+    : argument (COMMA argument)*
+    ;
+
+// An array argument has empty brackets, the caller's array is passed by reference
+argument
+    : identifier COLON variableType (LBRACKET RBRACKET)?
     ;
 
 funcCallStmt
     : funcCall
     ;
 
+// Makes the functions of module.jagle, next to the importing file, callable
+importStmt
+    : IMPORT identifier
+    ;
+
 funcCall
     : identifier LPAREN paramList? RPAREN
     ;
@@ -105,7 +121,13 @@ ifStmt
     ;
 
 forStmt
-    : FOR (variableDecl | variableAssignment) TO expression (STEP expression)? stmtList NEXT
+    : PARALLEL? FOR (variableDecl | variableAssignment) TO expression (STEP expression)? reduceClause* stmtList NEXT
+    ;
+
+// Parallel for only: every thread adds (or multiplies) into a copy of its own, the
+// copies are combined into the variable after the loop
+reduceClause
+    : REDUCE (PLUS | TIMES) identifier
     ;
 
 inputStmt
@@ -120,6 +142,15 @@ variableDecl
     : identifier COLON variableType ASSIGN expression
     ;
 
+// Array of the given size, elements start as 0 or ""
+arrayDeclStmt
+    : arrayDecl
+    ;
+
+arrayDecl
+    : identifier COLON variableType LBRACKET expression RBRACKET
+    ;
+
 variableAssignmentStmt
     : variableAssignment
     ;
@@ -128,6 +159,14 @@ variableAssignment
     : <assoc=right> identifier ASSIGN expression
     ;
 
+elementAssignmentStmt
+    : elementAssignment
+    ;
+
+elementAssignment
+    : <assoc=right> identifier LBRACKET expression RBRACKET ASSIGN expression
+    ;
+
 identifier
     : ID
     ;
@@ -166,6 +205,8 @@ LET : 'let' ;
 PRINT : 'print' ;
 IF : 'if' ;
 FOR : 'for' ;
+PARALLEL : 'parallel' ;
+REDUCE : 'reduce' ;
 TO : 'to' ;
 STEP : 'step' ;
 NEXT : 'next' ;
@@ -182,9 +223,11 @@ DATA : 'data' ;
 READ : 'read' ;
 RESTORE : 'restore' ;
 INPUT : 'input';
+MEMO : 'memo' ;
 FUNC : 'func' ;
 ENDFUNC: 'endfunc' ;
 RETURN : 'return' ;
+IMPORT : 'import' ;
 
 // Built-in functions
 VAL : 'val' ;
@@ -0,0 +1,366 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <functional>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
+#include <fmt/core.h>
+#include <fmt/ranges.h>
+
+#include "antlr4-runtime.h"
+#include "JagleLexer.h"
+#include "JagleParser.h"
+
+#include "driver.h"
+#include "jagle.hpp"
+#include "semantic.h"
+#include "visitor.h"
+
+#include <catch2/benchmark/catch_benchmark.hpp>
+#include <catch2/catch_test_macros.hpp>
+
+namespace {
+
+// Size and shape of a generated program
+struct ProgramShape {
+	// Statements, not counting the lines that open and close blocks
+	size_t lines = 1000;
+	// Blocks every statement is nested in, for and if in turn
+	size_t nesting = 2;
+	// Operators of every assigned expression, each in parentheses around the last
+	size_t expression_depth = 4;
+	// Items of the DATA statements, ints, floats and strings in turn
+	size_t data_items = 0;
+};
+
+std::string intExpression(size_t seed, size_t depth) {
+	static const char* operators[] = { " + ", " - ", " * " };
+	std::string expression = "x";
+	for (size_t i = 0; i < depth; i++) {
+		expression = fmt::format("({}{}{})", expression, operators[(seed + i) % 3], (seed + i) % 9 + 1);
+	}
+	return expression;
+}
+
+// A valid program of the shape: a function, DATA, then the statements in blocks of eight
+std::string generateProgram(const ProgramShape& shape) {
+	std::string program = "func mix(a: int, b: float): float\nreturn a * b + 0.5\nendfunc\n";
+	program += "x: int = 1\ny: float = 0.5\ns: str = \"\"\n";
+	for (size_t i = 0; i < shape.nesting; i += 2) {
+		program += fmt::format("i{}: int = 0\n", i);
+	}
+
+	for (size_t i = 0; i < shape.data_items; i += 16) {
+		std::vector<std::string> items;
+		for (size_t k = i; k < std::min(i + 16, shape.data_items); k++) {
+			items.push_back(k % 3 == 0 ? std::to_string(k) : k % 3 == 1 ? fmt::format("{}.5", k) : fmt::format("\"d{}\"", k));
+		}
+		program += "data " + fmt::format("{}", fmt::join(items, ", ")) + "\n";
+	}
+
+	for (size_t written = 0; written < shape.lines;) {
+		for (size_t d = 0; d < shape.nesting; d++) {
+			program += d % 2 == 0 ? fmt::format("for i{} = 1 to 3\n", d) : fmt::format("if x > {} then\n", d);
+		}
+		for (size_t k = 0; k < 8 && written < shape.lines; k++, written++) {
+			switch (written % 5) {
+			case 1:
+				program += "y = mix(x, y) * 0.5\n";
+				break;
+			case 2:
+				program += "s = s + \"k\"\n";
+				break;
+			case 3:
+				program += "print x; \" \"; y\n";
+				break;
+			default:
+				program += "x = " + intExpression(written, shape.expression_depth) + "\n";
+			}
+		}
+		for (size_t d = shape.nesting; d-- > 0;) {
+			program += d % 2 == 0 ? "next\n" : "endif\n";
+		}
+	}
+	return program;
+}
+
+// Lexer, parser and analysis of one source, kept apart so each can be timed on its own
+struct Pipeline {
+	explicit Pipeline(const std::string& source) : input(source), lexer(&input), tokens(&lexer), parser(&tokens) {
+	}
+
+	size_t lex() {
+		tokens.fill();
+		return tokens.size();
+	}
+
+	JP::ProgContext* parse() {
+		lex();
+		return parseProgram(parser);
+	}
+
+	antlr4::ANTLRInputStream input;
+	jagle::JagleLexer lexer;
+	antlr4::CommonTokenStream tokens;
+	jagle::JagleParser parser;
+};
+
+size_t generate(const std::string& source) {
+	Pipeline pipeline(source);
+	auto* tree = pipeline.parse();
+	SemanticAnalyzer semantic;
+	semantic.analyze(tree);
+	GeneratingVisitor visitor(&semantic, PassOptions());
+	visitor.visit(tree);
+	return visitor.getOutput().size();
+}
+
+#ifndef _WIN32
+// stdin reads text from a pipe a thread writes it into, while the object lives. The reader has
+// to read all of it, the writer is joined at the end.
+class PipedStdin {
+public:
+	explicit PipedStdin(const std::string& text) : saved_(dup(STDIN_FILENO)) {
+		int fds[2];
+		REQUIRE(pipe(fds) == 0);
+		dup2(fds[0], STDIN_FILENO);
+		close(fds[0]);
+		std::clearerr(stdin);
+		std::cin.clear();
+		writer_ = std::thread([&text, fd = fds[1]]() {
+			for (size_t written = 0; written < text.size();) {
+				ssize_t n = write(fd, text.data() + written, text.size() - written);
+				if (n <= 0) {
+					break;
+				}
+				written += n;
+			}
+			close(fd);
+		});
+	}
+
+	~PipedStdin() {
+		writer_.join();
+		dup2(saved_, STDIN_FILENO);
+		close(saved_);
+		std::clearerr(stdin);
+		std::cin.clear();
+	}
+
+private:
+	int saved_;
+	std::thread writer_;
+};
+#endif
+
+// Fastest of a few runs in seconds, the one the rest of the machine disturbed least
+double fastest(const std::function<void()>& f, int runs = 5) {
+	double best = 1e300;
+	for (int i = 0; i < runs; i++) {
+		auto started = std::chrono::steady_clock::now();
+		f();
+		best = std::min(best, std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count());
+	}
+	return best;
+}
+
+// Four times the input should take about four times as long. Allows twice that for noise
+// and n log n, quadratic growth takes 16 times.
+void requireLinear(const std::function<std::string(size_t)>& program_of, size_t n,
+	const std::function<void(const std::string&)>& f) {
+	std::string small = program_of(n);
+	std::string large = program_of(4 * n);
+	double small_seconds = fastest([&]() { f(small); });
+	double large_seconds = fastest([&]() { f(large); });
+	INFO(fmt::format("{} bytes: {:.3f} ms, {} bytes: {:.3f} ms", small.size(), small_seconds * 1000, large.size(),
+		large_seconds * 1000));
+	REQUIRE(large_seconds < 8 * small_seconds);
+}
+
+}
+
+TEST_CASE("generated programs are valid", "[scaling]") {
+	ProgramShape shape;
+	shape.lines = 40;
+	shape.nesting = 3;
+	shape.data_items = 20;
+	Pipeline pipeline(generateProgram(shape));
+	SemanticAnalyzer semantic;
+	REQUIRE(semantic.analyze(pipeline.parse()));
+}
+
+TEST_CASE("time grows linearly with program length", "[scaling]") {
+	auto program_of = [](size_t lines) {
+		ProgramShape shape;
+		shape.lines = lines;
+		return generateProgram(shape);
+	};
+
+	SECTION("lexer") {
+		requireLinear(program_of, 1000, [](const std::string& source) { Pipeline(source).lex(); });
+	}
+	SECTION("parser") {
+		requireLinear(program_of, 1000, [](const std::string& source) { Pipeline(source).parse(); });
+	}
+	SECTION("code generation") {
+		requireLinear(program_of, 1000, [](const std::string& source) { generate(source); });
+	}
+}
+
+TEST_CASE("time grows linearly with nesting and expression depth and DATA size", "[scaling]") {
+	SECTION("nesting") {
+		requireLinear([](size_t nesting) {
+			ProgramShape shape;
+			shape.lines = 8;
+			shape.nesting = nesting;
+			return generateProgram(shape);
+		}, 50, [](const std::string& source) { generate(source); });
+	}
+	SECTION("expression depth") {
+		requireLinear([](size_t depth) {
+			ProgramShape shape;
+			shape.lines = 20;
+			shape.expression_depth = depth;
+			return generateProgram(shape);
+		}, 50, [](const std::string& source) { generate(source); });
+	}
+	SECTION("DATA") {
+		requireLinear([](size_t items) {
+			ProgramShape shape;
+			shape.lines = 8;
+			shape.data_items = items;
+			return generateProgram(shape);
+		}, 2000, [](const std::string& source) { generate(source); });
+	}
+}
+
+// Run with: jagle_bench "[benchmark]"
+TEST_CASE("front end throughput", "[.][benchmark]") {
+	ProgramShape shape;
+	shape.lines = 5000;
+	shape.data_items = 1000;
+	std::string source = generateProgram(shape);
+	Pipeline parsed(source);
+	auto* tree = parsed.parse();
+	SemanticAnalyzer semantic;
+	semantic.analyze(tree);
+
+	BENCHMARK(fmt::format("JagleLexer, {} KB", source.size() / 1024)) {
+		return Pipeline(source).lex();
+	};
+	BENCHMARK(fmt::format("JagleParser::prog, {} KB", source.size() / 1024)) {
+		return Pipeline(source).parse() != nullptr;
+	};
+	BENCHMARK(fmt::format("GeneratingVisitor, {} KB", source.size() / 1024)) {
+		GeneratingVisitor visitor(&semantic, PassOptions());
+		visitor.visit(tree);
+		return visitor.getOutput().size();
+	};
+}
+
+TEST_CASE("runtime primitive throughput", "[.][benchmark]") {
+	constexpr int n = 100000;
+
+	std::vector<std::string> numbers;
+	for (int i = 0; i < n; i++) {
+		numbers.push_back(i % 2 ? std::to_string(i * 37) : fmt::format("{}.25", i));
+	}
+	BENCHMARK("val") {
+		float sum = 0;
+		for (const auto& number : numbers) {
+			auto value = val(number);
+			sum += value.index() == 0 ? std::get<int>(value) : std::get<float>(value);
+		}
+		return sum;
+	};
+
+	std::vector<unsigned char> tags(n);
+	std::vector<int> ints(n);
+	for (int i = 0; i < n; i++) {
+		tags[i] = static_cast<unsigned char>(DataTag::Int);
+		ints[i] = i;
+	}
+	DataTable table;
+	table.tags = tags.data();
+	table.size = tags.size();
+	table.ints = ints.data();
+	data_use(table);
+	BENCHMARK("data_read of ints") {
+		data_restore();
+		int64_t sum = 0;
+		for (int i = 0; i < n; i++) {
+			int x;
+			data_read(x);
+			sum += x;
+		}
+		return sum;
+	};
+
+	auto path = std::filesystem::temp_directory_path() / "jagle_bench_print.txt";
+	BENCHMARK("PRINT of ints, floats and strings") {
+		std::FILE* file = std::fopen(path.string().c_str(), "w");
+		{
+			PrintBuffer out(file);
+			for (int i = 0; i < n; i++) {
+				out << i << " " << i * 0.25f << " " << numbers[i] << '\n';
+			}
+		}
+		std::fclose(file);
+	};
+	std::filesystem::remove(path);
+}
+
+#ifndef _WIN32
+// 10M numbers take seconds a run, fewer samples do: jagle_bench "INPUT throughput" --benchmark-samples 5
+TEST_CASE("INPUT throughput", "[.][benchmark]") {
+	constexpr int n = 10000000;
+
+	std::string numbers;
+	int64_t expected = 0;
+	for (int i = 0; i < n; i++) {
+		int number = static_cast<int>(i * 7919LL % 2000001) - 1000000;
+		numbers += std::to_string(number);
+		numbers += '\n';
+		expected += number;
+	}
+	// INPUT of an int, the way a compiled program reads its stdin
+	auto input = [&]() {
+		PipedStdin piped(numbers);
+		int64_t sum = 0;
+		for (int i = 0; i < n; i++) {
+			int x;
+			prompt_input("? ", x, false);
+			sum += x;
+		}
+		return sum;
+	};
+	REQUIRE(input() == expected);
+
+	BENCHMARK(fmt::format("prompt_input of {}M ints from a pipe", n / 1000000)) {
+		return input();
+	};
+	// What INPUT did before InputReader and parse_number, less the flush of the prompt
+	BENCHMARK(fmt::format("std::getline and std::stringstream of {}M ints from a pipe", n / 1000000)) {
+		PipedStdin piped(numbers);
+		int64_t sum = 0;
+		std::string line;
+		for (int i = 0; i < n; i++) {
+			std::getline(std::cin, line);
+			std::stringstream ss(line);
+			int x;
+			ss >> x;
+			sum += x;
+		}
+		return sum;
+	};
+}
+#endif
@@ -0,0 +1,927 @@
+#include "bytecode.h"
+
+#include <algorithm>
+#include <array>
+#include <charconv>
+#include <cstring>
+#include <stdexcept>
+
+#include <fmt/core.h>
+
+using ir::ExprKind;
+using ir::Op;
+using ir::StmtKind;
+
+namespace bc {
+
+namespace {
+
+// Register holding a value
+struct Operand {
+	Kind kind = Kind::Int;
+	int32_t reg = 0;
+	// A temporary of its own, not a variable that may still change
+	bool temp = false;
+	// Written by the last instruction, which can write it somewhere else instead
+	bool last = false;
+};
+
+// Kind of a declared type. Types the emitter writes as auto have none, such variables take
+// the kind of their value.
+bool declaredKind(Type type, Kind& kind) {
+	switch (type) {
+	case Type::Int:
+		kind = Kind::Int;
+		return true;
+	case Type::Float:
+		kind = Kind::Float;
+		return true;
+	case Type::Str:
+		kind = Kind::Str;
+		return true;
+	case Type::IntArray:
+		kind = Kind::IntArray;
+		return true;
+	case Type::FloatArray:
+		kind = Kind::FloatArray;
+		return true;
+	case Type::StrArray:
+		kind = Kind::StrArray;
+		return true;
+	default:
+		return false;
+	}
+}
+
+Kind declaredKind(Type type) {
+	Kind kind = Kind::Int;
+	declaredKind(type, kind);
+	return kind;
+}
+
+Kind elementKind(Kind array) {
+	return array == Kind::IntArray ? Kind::Int : array == Kind::FloatArray ? Kind::Float : Kind::Str;
+}
+
+// Usual arithmetic conversions of C++
+Kind promote(Kind a, Kind b) {
+	if (a == Kind::Double || b == Kind::Double) {
+		return Kind::Double;
+	}
+	if (a == Kind::Float || b == Kind::Float) {
+		return Kind::Float;
+	}
+	return Kind::Int;
+}
+
+// Opcode for kind, from the Int variant that the Float and Double ones follow
+Opcode typed(Opcode int_op, Kind kind) {
+	int offset = kind == Kind::Float ? 1 : kind == Kind::Double ? 2 : 0;
+	return static_cast<Opcode>(static_cast<int>(int_op) + offset);
+}
+
+// The same for opcodes with Int, Float and Str variants
+Opcode scalar(Opcode int_op, Kind kind) {
+	int offset = kind == Kind::Float ? 1 : kind == Kind::Str ? 2 : 0;
+	return static_cast<Opcode>(static_cast<int>(int_op) + offset);
+}
+
+Opcode arithmetic(Op op, Kind kind) {
+	int base;
+	switch (op) {
+	case Op::Add:
+		base = static_cast<int>(Opcode::AddInt);
+		break;
+	case Op::Sub:
+		base = static_cast<int>(Opcode::SubInt);
+		break;
+	case Op::Mul:
+		base = static_cast<int>(Opcode::MulInt);
+		break;
+	case Op::Div:
+		base = static_cast<int>(Opcode::DivInt);
+		break;
+	case Op::Mod:
+		base = static_cast<int>(Opcode::ModInt);
+		break;
+	default:
+		base = static_cast<int>(Opcode::PowInt);
+		break;
+	}
+	// Six operators per kind
+	int offset = kind == Kind::Float ? 6 : kind == Kind::Double ? 12 : 0;
+	return static_cast<Opcode>(base + offset);
+}
+
+Opcode comparison(Op op, Kind kind) {
+	int base;
+	switch (op) {
+	case Op::Eq:
+		base = static_cast<int>(Opcode::EqInt);
+		break;
+	case Op::Ne:
+		base = static_cast<int>(Opcode::NeInt);
+		break;
+	case Op::Lt:
+		base = static_cast<int>(Opcode::LtInt);
+		break;
+	case Op::Le:
+		base = static_cast<int>(Opcode::LeInt);
+		break;
+	case Op::Gt:
+		base = static_cast<int>(Opcode::GtInt);
+		break;
+	default:
+		base = static_cast<int>(Opcode::GeInt);
+		break;
+	}
+	int offset = kind == Kind::Float ? 6 : kind == Kind::Double ? 12 : kind == Kind::Str ? 18 : 0;
+	return static_cast<Opcode>(base + offset);
+}
+
+bool isComparison(Op op) {
+	return op == Op::Eq || op == Op::Ne || op == Op::Lt || op == Op::Le || op == Op::Gt || op == Op::Ge;
+}
+
+bool isStringLiteral(const ir::Expr& expr) {
+	return expr.kind == ExprKind::Literal && !expr.text.empty() && expr.text[0] == '"';
+}
+
+// Value of a number literal, with the sign of a unary - or + around it
+bool numericLiteral(const ir::Expr& expr, double& value) {
+	double sign = 1;
+	const ir::Expr* literal = &expr;
+	if (expr.kind == ExprKind::Unary && expr.op != Op::Not) {
+		sign = expr.op == Op::Neg ? -1 : 1;
+		literal = expr.operands[0].get();
+	}
+	if (literal->kind != ExprKind::Literal || literal->text.empty() || literal->text[0] == '"') {
+		return false;
+	}
+	value = sign * std::stod(literal->text.str());
+	return true;
+}
+
+// String literals reach the runtime as const char*, they end at the first NUL
+std::string literalBytes(std::string_view literal) {
+	std::string bytes = unescape(literal);
+	bytes.resize(std::strlen(bytes.c_str()));
+	return bytes;
+}
+
+class Compiler {
+public:
+	Compiler(const ir::Program& source, Program& program) : source(source), program(program) {}
+
+	void compileProgram() {
+		program.data = splitData(source.data);
+		program.functions.resize(source.functions.size() + 1);
+		program.functions[0].name = "main";
+		for (size_t i = 0; i < source.functions.size(); i++) {
+			const ir::Function& function = source.functions[i];
+			Function& compiled = program.functions[i + 1];
+			compiled.name = function.name;
+			for (const auto& arg : function.args) {
+				compiled.args.push_back(declaredKind(arg.type));
+			}
+			compiled.returns = function.result != Type::Void;
+			compiled.result = declaredKind(function.result);
+			compiled.memo = function.memo;
+			function_index[function.name] = int32_t(i + 1);
+		}
+
+		for (size_t i = 0; i < source.functions.size(); i++) {
+			compileFunction(source.functions[i], program.functions[i + 1]);
+		}
+
+		begin(program.functions[0]);
+		block(source.main);
+		emit(Opcode::PrintNewline);
+		emit(Opcode::Halt);
+	}
+
+private:
+	using Scope = std::unordered_map<std::string, Operand>;
+	using Mark = std::array<uint32_t, KindCount>;
+
+	const ir::Program& source;
+	Program& program;
+	std::unordered_map<std::string, int32_t> function_index;
+	std::unordered_map<std::string, int32_t> str_constants;
+	std::unordered_map<uint64_t, int32_t> double_constants;
+
+	// Function being compiled, its next free register of each kind and its scopes,
+	// innermost last
+	Function* function = nullptr;
+	Mark top{};
+	std::vector<Scope> scopes;
+
+	void begin(Function& target) {
+		function = &target;
+		top.fill(0);
+		scopes.assign(1, Scope());
+	}
+
+	void compileFunction(const ir::Function& source_function, Function& target) {
+		begin(target);
+		for (size_t i = 0; i < source_function.args.size(); i++) {
+			Kind kind = target.args[i];
+			scopes.back()[source_function.args[i].name] = { kind, alloc(kind) };
+		}
+		block(source_function.body);
+		emit(Opcode::Return);
+	}
+
+	// Registers
+
+	int32_t alloc(Kind kind) {
+		size_t k = static_cast<size_t>(kind);
+		int32_t reg = int32_t(top[k]++);
+		function->registers[k] = std::max(function->registers[k], top[k]);
+		return reg;
+	}
+
+	Operand temp(Kind kind) {
+		return { kind, alloc(kind), true, true };
+	}
+
+	static std::string key(std::string_view name, bool internal) {
+		// Internal names are C++ names, they can't clash with Jagle ones
+		return internal ? "#" + std::string(name) : std::string(name);
+	}
+
+	void declare(std::string_view name, bool internal, Operand var) {
+		var.temp = false;
+		var.last = false;
+		scopes.back()[key(name, internal)] = var;
+	}
+
+	Operand lookup(std::string_view name, bool internal) const {
+		std::string k = key(name, internal);
+		for (auto scope = scopes.rbegin(); scope != scopes.rend(); ++scope) {
+			auto found = scope->find(k);
+			if (found != scope->end()) {
+				return found->second;
+			}
+		}
+		throw std::runtime_error(fmt::format("bytecode: '{}' is not declared", name));
+	}
+
+	// Constants
+
+	int32_t strConstant(const std::string& value) {
+		auto [it, added] = str_constants.try_emplace(value, int32_t(program.strs.size()));
+		if (added) {
+			program.strs.push_back(value);
+		}
+		return it->second;
+	}
+
+	int32_t doubleConstant(double value) {
+		uint64_t bits;
+		std::memcpy(&bits, &value, sizeof(bits));
+		auto [it, added] = double_constants.try_emplace(bits, int32_t(program.doubles.size()));
+		if (added) {
+			program.doubles.push_back(value);
+		}
+		return it->second;
+	}
+
+	static int32_t floatBits(float value) {
+		int32_t bits;
+		std::memcpy(&bits, &value, sizeof(bits));
+		return bits;
+	}
+
+	// Instructions
+
+	size_t emit(Opcode op, int32_t a = 0, int32_t b = 0, int32_t c = 0) {
+		function->code.push_back({ op, a, b, c });
+		return function->code.size() - 1;
+	}
+
+	int32_t here() const {
+		return int32_t(function->code.size());
+	}
+
+	// Points the jump at index to the next instruction
+	void land(size_t index) {
+		Instr& jump = function->code[index];
+		switch (jump.op) {
+		case Opcode::Jump:
+			jump.a = here();
+			break;
+		case Opcode::JumpIfZero:
+		case Opcode::JumpIfNotZero:
+			jump.b = here();
+			break;
+		default:
+			jump.c = here();
+			break;
+		}
+	}
+
+	void load(Kind kind, int32_t reg, double value) {
+		switch (kind) {
+		case Kind::Int:
+			emit(Opcode::LoadInt, reg, int32_t(value));
+			break;
+		case Kind::Float:
+			emit(Opcode::LoadFloat, reg, floatBits(float(value)));
+			break;
+		case Kind::Double:
+			emit(Opcode::LoadDouble, reg, doubleConstant(value));
+			break;
+		default:
+			emit(Opcode::LoadStr, reg, strConstant(""));
+			break;
+		}
+	}
+
+	// Writes value into dst of kind, converted
+	void move(Operand value, Kind kind, int32_t dst) {
+		if (value.kind == kind) {
+			if (value.reg == dst) {
+				return;
+			}
+			// The instruction that computed a temporary can write dst directly
+			if (value.temp && value.last && !function->code.empty() && function->code.back().a == value.reg) {
+				function->code.back().a = dst;
+				return;
+			}
+		}
+
+		Opcode op;
+		switch (kind) {
+		case Kind::Int:
+			op = value.kind == Kind::Float ? Opcode::FloatToInt : value.kind == Kind::Double ? Opcode::DoubleToInt : Opcode::MoveInt;
+			break;
+		case Kind::Float:
+			op = value.kind == Kind::Int ? Opcode::IntToFloat : value.kind == Kind::Double ? Opcode::DoubleToFloat : Opcode::MoveFloat;
+			break;
+		case Kind::Double:
+			op = value.kind == Kind::Int ? Opcode::IntToDouble : value.kind == Kind::Float ? Opcode::FloatToDouble : Opcode::MoveDouble;
+			break;
+		default:
+			op = Opcode::MoveStr;
+			break;
+		}
+		emit(op, dst, value.reg);
+	}
+
+	// value in a register of kind, a new temporary when it has to be converted
+	Operand convert(Operand value, Kind kind) {
+		if (value.kind == kind) {
+			return value;
+		}
+		Operand converted = temp(kind);
+		move(value, kind, converted.reg);
+		return converted;
+	}
+
+	Operand exprAs(const ir::Expr& expr, Kind kind) {
+		return convert(this->expr(expr), kind);
+	}
+
+	void exprInto(const ir::Expr& expr, Kind kind, int32_t dst) {
+		move(this->expr(expr), kind, dst);
+	}
+
+	// A copy the rest of the statement can't change
+	Operand snapshot(const ir::Expr& expr) {
+		Operand value = this->expr(expr);
+		if (value.temp) {
+			return value;
+		}
+		Operand copy = temp(value.kind);
+		move(value, value.kind, copy.reg);
+		copy.last = false;
+		return copy;
+	}
+
+	// int register that is zero when value is false
+	int32_t truth(Operand value) {
+		if (value.kind == Kind::Int) {
+			return value.reg;
+		}
+		Operand test = temp(Kind::Int);
+		emit(typed(Opcode::TestInt, value.kind), test.reg, value.reg);
+		return test.reg;
+	}
+
+	// 1 or 0 into the int dst
+	void test(Operand value, int32_t dst) {
+		emit(typed(Opcode::TestInt, value.kind), dst, value.reg);
+	}
+
+	// Expressions
+
+	Operand expr(const ir::Expr& expr) {
+		switch (expr.kind) {
+		case ExprKind::Literal:
+			return literal(expr);
+
+		case ExprKind::Variable:
+			return lookup(expr.name, expr.internal);
+
+		case ExprKind::Unary: {
+			Operand value = this->expr(*expr.operands[0]);
+			if (expr.op == Op::Plus) {
+				return value;
+			}
+			Operand result = temp(expr.op == Op::Not ? Kind::Int : value.kind);
+			emit(typed(expr.op == Op::Not ? Opcode::NotInt : Opcode::NegInt, value.kind), result.reg, value.reg);
+			return result;
+		}
+
+		case ExprKind::Binary:
+			return binary(expr);
+
+		case ExprKind::Call:
+			return call(expr);
+
+		case ExprKind::Val: {
+			Operand s = exprAs(*expr.operands[0], Kind::Str);
+			Operand result = temp(expr.type == Type::Int ? Kind::Int : Kind::Float);
+			emit(expr.type == Type::Int ? Opcode::ValInt : Opcode::ValFloat, result.reg, s.reg);
+			return result;
+		}
+
+		case ExprKind::Assign: {
+			Operand var = lookup(expr.name, expr.internal);
+			exprInto(*expr.operands[0], var.kind, var.reg);
+			return var;
+		}
+
+		case ExprKind::Index: {
+			Operand array = lookup(expr.name, expr.internal);
+			Operand index = exprAs(*expr.operands[0], Kind::Int);
+			Kind kind = elementKind(array.kind);
+			Operand result = temp(kind);
+			emit(scalar(Opcode::GetInt, kind), result.reg, array.reg, index.reg);
+			return result;
+		}
+
+		case ExprKind::AssignElement: {
+			Operand array = lookup(expr.name, expr.internal);
+			Operand index = exprAs(*expr.operands[0], Kind::Int);
+			Kind kind = elementKind(array.kind);
+			Operand value = exprAs(*expr.operands[1], kind);
+			emit(scalar(Opcode::SetInt, kind), array.reg, index.reg, value.reg);
+			value.last = false;
+			return value;
+		}
+		}
+		return temp(Kind::Int);
+	}
+
+	Operand literal(const ir::Expr& expr) {
+		std::string_view text = expr.text;
+		if (isStringLiteral(expr)) {
+			Operand result = temp(Kind::Str);
+			emit(Opcode::LoadStr, result.reg, strConstant(literalBytes(text)));
+			return result;
+		}
+		// Literals with a point or an exponent are doubles in C++
+		if (text.find_first_of(".eE") != std::string_view::npos) {
+			Operand result = temp(Kind::Double);
+			emit(Opcode::LoadDouble, result.reg, doubleConstant(std::stod(std::string(text))));
+			return result;
+		}
+		int64_t value = 0;
+		std::from_chars(text.data(), text.data() + text.size(), value);
+		Operand result = temp(Kind::Int);
+		emit(Opcode::LoadInt, result.reg, int32_t(value));
+		return result;
+	}
+
+	Operand binary(const ir::Expr& expr) {
+		if (expr.op == Op::And || expr.op == Op::Or) {
+			// Short circuit: the right side only runs when the left does not decide
+			Operand result = { Kind::Int, alloc(Kind::Int), true, false };
+			test(this->expr(*expr.operands[0]), result.reg);
+			size_t jump = emit(expr.op == Op::And ? Opcode::JumpIfZero : Opcode::JumpIfNotZero, result.reg);
+			test(this->expr(*expr.operands[1]), result.reg);
+			land(jump);
+			return result;
+		}
+
+		Operand lhs = this->expr(*expr.operands[0]);
+		Operand rhs = this->expr(*expr.operands[1]);
+
+		if (lhs.kind == Kind::Str) {
+			Operand result = temp(isComparison(expr.op) ? Kind::Int : Kind::Str);
+			emit(isComparison(expr.op) ? comparison(expr.op, Kind::Str) : Opcode::Concat, result.reg, lhs.reg, rhs.reg);
+			return result;
+		}
+
+		Kind kind = promote(lhs.kind, rhs.kind);
+		// ipow for ints, std::pow and std::fmod otherwise, which compute in float only when
+		// both arguments are floats
+		if (expr.op == Op::Pow || (expr.op == Op::Mod && expr.type == Type::Float)) {
+			if (expr.op == Op::Pow && expr.type == Type::Int) {
+				kind = Kind::Int;
+			}
+			else {
+				kind = lhs.kind == Kind::Float && rhs.kind == Kind::Float ? Kind::Float : Kind::Double;
+			}
+		}
+		lhs = convert(lhs, kind);
+		rhs = convert(rhs, kind);
+
+		if (isComparison(expr.op)) {
+			Operand result = temp(Kind::Int);
+			emit(comparison(expr.op, kind), result.reg, lhs.reg, rhs.reg);
+			return result;
+		}
+		Operand result = temp(kind);
+		emit(arithmetic(expr.op, kind), result.reg, lhs.reg, rhs.reg);
+		return result;
+	}
+
+	Operand call(const ir::Expr& expr) {
+		int32_t index = function_index.at(expr.name.str());
+		const Function& callee = program.functions[index];
+
+		std::vector<int32_t> args;
+		for (size_t i = 0; i < expr.operands.size(); i++) {
+			args.push_back(exprAs(*expr.operands[i], callee.args[i]).reg);
+		}
+		int32_t first_arg = int32_t(function->call_args.size());
+		function->call_args.insert(function->call_args.end(), args.begin(), args.end());
+
+		Operand result = callee.returns ? temp(callee.result) : Operand{ Kind::Int, -1 };
+		emit(Opcode::Call, result.reg, index, first_arg);
+		return result;
+	}
+
+	// Statements
+
+	void block(const ir::Block& statements) {
+		scopes.emplace_back();
+		for (const auto& stmt : statements) {
+			// Temporaries live for one statement
+			Mark mark = top;
+			statement(*stmt);
+			if (stmt->kind == StmtKind::Declare || stmt->kind == StmtKind::DeclareArray) {
+				Operand var = lookup(stmt->var, stmt->internal);
+				mark[static_cast<size_t>(var.kind)] = uint32_t(var.reg + 1);
+			}
+			top = mark;
+		}
+		scopes.pop_back();
+	}
+
+	void statement(const ir::Stmt& stmt) {
+		switch (stmt.kind) {
+		case StmtKind::Declare: {
+			Kind kind;
+			Operand var;
+			if (declaredKind(stmt.var_type, kind)) {
+				var = { kind, alloc(kind) };
+				if (stmt.value) {
+					exprInto(*stmt.value, kind, var.reg);
+				}
+				else {
+					load(kind, var.reg, 0);
+				}
+			}
+			else {
+				// auto takes the kind of the value
+				var = snapshot(*stmt.value);
+			}
+			declare(stmt.var, stmt.internal, var);
+			break;
+		}
+
+		case StmtKind::DeclareArray: {
+			Kind kind = declaredKind(stmt.var_type);
+			Operand var = { kind, alloc(kind) };
+			Operand size = exprAs(*stmt.value, Kind::Int);
+			emit(scalar(Opcode::NewIntArray, elementKind(kind)), var.reg, size.reg);
+			declare(stmt.var, stmt.internal, var);
+			break;
+		}
+
+		case StmtKind::Eval: {
+			std::vector<const ir::Expr*> parts = ir::selfAppendParts(*stmt.value);
+			if (parts.empty()) {
+				expr(*stmt.value);
+				break;
+			}
+			Operand var = lookup(stmt.value->name, stmt.value->internal);
+			std::vector<int32_t> values;
+			for (const ir::Expr* part : parts) {
+				values.push_back(exprAs(*part, Kind::Str).reg);
+			}
+			for (int32_t value : values) {
+				emit(Opcode::Append, var.reg, value);
+			}
+			break;
+		}
+
+		case StmtKind::Print:
+			for (const auto& item : stmt.items) {
+				print(*item);
+			}
+			if (stmt.newline) {
+				emit(Opcode::PrintNewline);
+			}
+			break;
+
+		case StmtKind::For:
+			if (stmt.parallel) {
+				parallelFor(stmt);
+			}
+			else {
+				forLoop(stmt);
+			}
+			break;
+
+		case StmtKind::If: {
+			int32_t condition = truth(expr(*stmt.value));
+			size_t to_else = emit(Opcode::JumpIfZero, condition);
+			block(stmt.body);
+			if (stmt.has_else) {
+				size_t to_end = emit(Opcode::Jump);
+				land(to_else);
+				block(stmt.else_body);
+				land(to_end);
+			}
+			else {
+				land(to_else);
+			}
+			break;
+		}
+
+		case StmtKind::Read: {
+			Operand var = lookup(stmt.var, stmt.internal);
+			emit(scalar(Opcode::ReadInt, var.kind), var.reg);
+			break;
+		}
+
+		case StmtKind::Restore:
+			emit(Opcode::Restore);
+			break;
+
+		case StmtKind::Input: {
+			Operand var = lookup(stmt.var, stmt.internal);
+			int32_t default_value = stmt.value ? exprAs(*stmt.value, var.kind).reg : -1;
+			emit(scalar(Opcode::InputInt, var.kind), var.reg, strConstant(literalBytes(stmt.prompt)),
+				default_value);
+			break;
+		}
+
+		case StmtKind::Return:
+			if (function == &program.functions[0]) {
+				emit(Opcode::Halt);
+			}
+			else if (stmt.value) {
+				Operand value = exprAs(*stmt.value, function->result);
+				emit(scalar(Opcode::ReturnInt, function->result), value.reg);
+			}
+			else {
+				emit(Opcode::Return);
+			}
+			break;
+		}
+	}
+
+	void print(const ir::Expr& item) {
+		if (isStringLiteral(item)) {
+			emit(Opcode::PrintConst, strConstant(literalBytes(item.text)));
+			return;
+		}
+		// val() printed as it is: the int or the float the text holds
+		if (item.kind == ExprKind::Val && item.type != Type::Int && item.type != Type::Float) {
+			emit(Opcode::PrintVal, exprAs(*item.operands[0], Kind::Str).reg);
+			return;
+		}
+		Operand value = expr(item);
+		emit(value.kind == Kind::Str ? Opcode::PrintStr : typed(Opcode::PrintInt, value.kind), value.reg);
+	}
+
+	// for var = from to to step step, as the emitted C++: the limit and a computed step are
+	// evaluated once, before from. A step that is a number gives the direction at compile
+	// time, otherwise its sign is tested at run time.
+	void forLoop(const ir::Stmt& stmt) {
+		// Start value, limit and step are evaluated in this order, like the C++ loop
+		Kind var_kind = stmt.declares ? declaredKind(stmt.var_type) : lookup(stmt.var, stmt.internal).kind;
+		int32_t start = alloc(var_kind);
+		exprInto(*stmt.from, var_kind, start);
+		Operand to = snapshot(*stmt.to);
+		double step_value = 1;
+		bool constant_step = !stmt.step || numericLiteral(*stmt.step, step_value);
+		Operand step;
+		if (!stmt.step) {
+			step = temp(Kind::Int);
+			load(Kind::Int, step.reg, 1);
+		}
+		else {
+			step = snapshot(*stmt.step);
+		}
+		int32_t up = -1;
+		if (!constant_step) {
+			Operand zero = temp(step.kind);
+			load(step.kind, zero.reg, 0);
+			up = alloc(Kind::Int);
+			emit(comparison(Op::Ge, step.kind), up, step.reg, zero.reg);
+		}
+
+		scopes.emplace_back();
+		Operand var;
+		if (stmt.declares) {
+			var = { var_kind, alloc(var_kind) };
+			declare(stmt.var, stmt.internal, var);
+		}
+		else {
+			var = lookup(stmt.var, stmt.internal);
+		}
+		move(Operand{ var_kind, start }, var.kind, var.reg);
+
+		// Comparison and increment work in the promoted kinds, the limit is converted once
+		Kind compare_kind = promote(var.kind, to.kind);
+		to = convert(to, compare_kind);
+		int32_t var_compared = var.kind == compare_kind ? var.reg : alloc(compare_kind);
+		int32_t test = alloc(Kind::Int);
+		Kind step_kind = promote(var.kind, step.kind);
+		step = convert(step, step_kind);
+		int32_t sum = var.kind == step_kind ? var.reg : alloc(step_kind);
+
+		int32_t head = here();
+		std::vector<size_t> exits;
+		auto exitUnless = [&](Op op) {
+			if (compare_kind == Kind::Int) {
+				exits.push_back(emit(op == Op::Le ? Opcode::JumpIfNotLe : Opcode::JumpIfNotGe, var.reg, to.reg));
+				return;
+			}
+			if (compare_kind != var.kind) {
+				move(Operand{ var.kind, var.reg }, compare_kind, var_compared);
+			}
+			emit(comparison(op, compare_kind), test, var_compared, to.reg);
+			exits.push_back(emit(Opcode::JumpIfZero, test));
+		};
+		if (constant_step) {
+			exitUnless(step_value >= 0 ? Op::Le : Op::Ge);
+		}
+		else {
+			size_t to_down = emit(Opcode::JumpIfZero, up);
+			exitUnless(Op::Le);
+			size_t to_body = emit(Opcode::Jump);
+			land(to_down);
+			exitUnless(Op::Ge);
+			land(to_body);
+		}
+
+		block(stmt.body);
+
+		if (step_kind == Kind::Int && constant_step && stmt.step) {
+			emit(Opcode::AddIntConst, var.reg, var.reg, int32_t(step_value));
+		}
+		else if (!stmt.step && var.kind == Kind::Int) {
+			emit(Opcode::AddIntConst, var.reg, var.reg, 1);
+		}
+		else {
+			// Registers are numbered per kind, the sum is the variable when the kinds match
+			if (step_kind != var.kind) {
+				move(Operand{ var.kind, var.reg }, step_kind, sum);
+			}
+			emit(arithmetic(Op::Add, step_kind), sum, sum, step.reg);
+			if (step_kind != var.kind) {
+				move(Operand{ step_kind, sum }, var.kind, var.reg);
+			}
+		}
+		emit(Opcode::Jump, head);
+		for (size_t exit : exits) {
+			land(exit);
+		}
+		scopes.pop_back();
+	}
+
+	// Chunks of a parallel for one after another, in chunk order. Each chunk starts its
+	// reduction variables at the identity and adds them into the shared ones when it is
+	// done, the threads' copies are combined in the same order.
+	void parallelFor(const ir::Stmt& stmt) {
+		int32_t from = alloc(Kind::Int);
+		int32_t step = alloc(Kind::Int);
+		int32_t to = alloc(Kind::Double);
+		exprInto(*stmt.from, Kind::Int, from);
+		exprInto(*stmt.to, Kind::Double, to);
+		if (stmt.step) {
+			exprInto(*stmt.step, Kind::Int, step);
+		}
+		else {
+			load(Kind::Int, step, 1);
+		}
+		int32_t range = alloc(Kind::Range);
+		emit(Opcode::NewRange, range, from, to);
+
+		double step_value = 1;
+		bool constant_step = !stmt.step || numericLiteral(*stmt.step, step_value);
+		int32_t up = alloc(Kind::Int);
+		int32_t zero = alloc(Kind::Int);
+		load(Kind::Int, zero, 0);
+		emit(Opcode::GeInt, up, step, zero);
+
+		int32_t chunks = alloc(Kind::Int);
+		int32_t chunk = alloc(Kind::Int);
+		int32_t last = alloc(Kind::Int);
+		int32_t more = alloc(Kind::Int);
+		emit(Opcode::RangeChunks, chunks, range);
+		load(Kind::Int, chunk, 0);
+
+		std::vector<Operand> shared;
+		std::vector<Operand> locals;
+		scopes.emplace_back();
+		for (const auto& reduction : stmt.reductions) {
+			shared.push_back(lookup(reduction.var, false));
+			locals.push_back({ shared.back().kind, alloc(shared.back().kind) });
+			declare(reduction.var, false, locals.back());
+		}
+		Operand var = { Kind::Int, alloc(Kind::Int) };
+		declare(stmt.var, stmt.internal, var);
+
+		int32_t chunk_head = here();
+		emit(Opcode::LtInt, more, chunk, chunks);
+		size_t done = emit(Opcode::JumpIfZero, more);
+		emit(Opcode::RangeFirst, var.reg, range, chunk);
+		emit(Opcode::RangeLast, last, range, chunk);
+		for (size_t i = 0; i < locals.size(); i++) {
+			load(locals[i].kind, locals[i].reg, stmt.reductions[i].op == Op::Mul ? 1 : 0);
+		}
+
+		int32_t head = here();
+		std::vector<size_t> exits;
+		if (constant_step) {
+			exits.push_back(emit(step_value >= 0 ? Opcode::JumpIfNotLe : Opcode::JumpIfNotGe, var.reg, last));
+		}
+		else {
+			size_t to_down = emit(Opcode::JumpIfZero, up);
+			exits.push_back(emit(Opcode::JumpIfNotLe, var.reg, last));
+			size_t to_body = emit(Opcode::Jump);
+			land(to_down);
+			exits.push_back(emit(Opcode::JumpIfNotGe, var.reg, last));
+			land(to_body);
+		}
+		block(stmt.body);
+		emit(Opcode::AddInt, var.reg, var.reg, step);
+		emit(Opcode::Jump, head);
+		for (size_t exit : exits) {
+			land(exit);
+		}
+
+		for (size_t i = 0; i < locals.size(); i++) {
+			Opcode op = shared[i].kind == Kind::Str ? Opcode::Concat : arithmetic(stmt.reductions[i].op, shared[i].kind);
+			emit(op, shared[i].reg, shared[i].reg, locals[i].reg);
+		}
+		emit(Opcode::AddIntConst, chunk, chunk, 1);
+		emit(Opcode::Jump, chunk_head);
+		land(done);
+		scopes.pop_back();
+	}
+};
+
+const char* opcodeNames[] = {
+	"load.i", "load.f", "load.d", "load.s", "move.i", "move.f", "move.d", "move.s",
+	"i2f", "i2d", "f2i", "f2d", "d2i", "d2f",
+	"add.i", "sub.i", "mul.i", "div.i", "mod.i", "pow.i",
+	"add.f", "sub.f", "mul.f", "div.f", "mod.f", "pow.f",
+	"add.d", "sub.d", "mul.d", "div.d", "mod.d", "pow.d",
+	"addk.i", "neg.i", "neg.f", "neg.d", "test.i", "test.f", "test.d", "not.i", "not.f", "not.d",
+	"eq.i", "ne.i", "lt.i", "le.i", "gt.i", "ge.i",
+	"eq.f", "ne.f", "lt.f", "le.f", "gt.f", "ge.f",
+	"eq.d", "ne.d", "lt.d", "le.d", "gt.d", "ge.d",
+	"eq.s", "ne.s", "lt.s", "le.s", "gt.s", "ge.s",
+	"concat", "append",
+	"jump", "jz", "jnz", "jnle", "jnge",
+	"new.i", "new.f", "new.s", "get.i", "get.f", "get.s", "set.i", "set.f", "set.s",
+	"print.i", "print.f", "print.d", "print.s", "print.k", "print.nl", "print.val",
+	"read.i", "read.f", "read.s", "restore", "input.i", "input.f", "input.s", "val.i", "val.f",
+	"call", "ret", "ret.i", "ret.f", "ret.s",
+	"range", "range.chunks", "range.first", "range.last",
+	"halt",
+};
+
+static_assert(sizeof(opcodeNames) / sizeof(opcodeNames[0]) == static_cast<size_t>(Opcode::Halt) + 1);
+
+}
+
+Program compile(const ir::Program& program) {
+	Program compiled;
+	Compiler(program, compiled).compileProgram();
+	return compiled;
+}
+
+std::string disassemble(const Program& program) {
+	std::string listing;
+	for (const auto& function : program.functions) {
+		listing += fmt::format("{}:\n", function.name);
+		for (size_t i = 0; i < function.code.size(); i++) {
+			const Instr& instr = function.code[i];
+			listing += fmt::format("{:4} {} {} {} {}\n", i, opcodeNames[static_cast<size_t>(instr.op)], instr.a, instr.b, instr.c);
+		}
+	}
+	return listing;
+}
+
+}
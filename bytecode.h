@@ -0,0 +1,212 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "emitter.h"
+#include "ir.h"
+
+// Bytecode that jagle run executes instead of compiling the generated C++. Registers are
+// typed, each function has a file of registers per kind, and every instruction works on
+// one kind. Kinds are the C++ types the emitted code would compute in, so that the VM
+// rounds and converts exactly like the compiled program: float literals are doubles,
+// float variables floats, and mixed arithmetic is done in the wider type.
+namespace bc {
+
+enum class Kind : uint8_t {
+	Int,
+	Float,
+	Double,
+	Str,
+	IntArray,
+	FloatArray,
+	StrArray,
+	// ParallelRange of a parallel for
+	Range,
+};
+
+constexpr size_t KindCount = 8;
+
+// a is the destination register unless noted, b and c the operands. Jump targets are
+// instruction indexes.
+enum class Opcode : uint8_t {
+	// a = b, the value itself: the int, the bits of the float, or the index of the double
+	// or str constant
+	LoadInt,
+	LoadFloat,
+	LoadDouble,
+	LoadStr,
+	MoveInt,
+	MoveFloat,
+	MoveDouble,
+	MoveStr,
+
+	// a = b converted, as a C++ static_cast
+	IntToFloat,
+	IntToDouble,
+	FloatToInt,
+	FloatToDouble,
+	DoubleToInt,
+	DoubleToFloat,
+
+	// a = b op c
+	AddInt,
+	SubInt,
+	MulInt,
+	DivInt,
+	ModInt,
+	PowInt,
+	AddFloat,
+	SubFloat,
+	MulFloat,
+	DivFloat,
+	ModFloat,
+	PowFloat,
+	AddDouble,
+	SubDouble,
+	MulDouble,
+	DivDouble,
+	ModDouble,
+	PowDouble,
+	// a = b + c, the int c itself
+	AddIntConst,
+	// a = op b
+	NegInt,
+	NegFloat,
+	NegDouble,
+	// int a = b != 0, and b == 0 for Not
+	TestInt,
+	TestFloat,
+	TestDouble,
+	NotInt,
+	NotFloat,
+	NotDouble,
+
+	// int a = b op c
+	EqInt,
+	NeInt,
+	LtInt,
+	LeInt,
+	GtInt,
+	GeInt,
+	EqFloat,
+	NeFloat,
+	LtFloat,
+	LeFloat,
+	GtFloat,
+	GeFloat,
+	EqDouble,
+	NeDouble,
+	LtDouble,
+	LeDouble,
+	GtDouble,
+	GeDouble,
+	EqStr,
+	NeStr,
+	LtStr,
+	LeStr,
+	GtStr,
+	GeStr,
+
+	// a = b + c, and a += b in place
+	Concat,
+	Append,
+
+	// Jump to a, or to b when int a is zero or not zero
+	Jump,
+	JumpIfZero,
+	JumpIfNotZero,
+	// Jump to c unless int a <= int b (>= int b), the test of an int for loop
+	JumpIfNotLe,
+	JumpIfNotGe,
+
+	// Array a of int b elements
+	NewIntArray,
+	NewFloatArray,
+	NewStrArray,
+	// a = b[c], checked
+	GetInt,
+	GetFloat,
+	GetStr,
+	// a[b] = c, checked
+	SetInt,
+	SetFloat,
+	SetStr,
+
+	// PRINT register a, str constant a, a line feed, and val() of str a
+	PrintInt,
+	PrintFloat,
+	PrintDouble,
+	PrintStr,
+	PrintConst,
+	PrintNewline,
+	PrintVal,
+
+	ReadInt,
+	ReadFloat,
+	ReadStr,
+	Restore,
+	// INPUT into a with the prompt str constant b, the default is register c, -1 for none
+	InputInt,
+	InputFloat,
+	InputStr,
+	// val() of str b
+	ValInt,
+	ValFloat,
+
+	// Calls function b with the registers of Function::call_args from c on, the result
+	// goes to a
+	Call,
+	Return,
+	ReturnInt,
+	ReturnFloat,
+	ReturnStr,
+
+	// Range a from int b to double c, the step is in int b + 1
+	NewRange,
+	// int a = chunks of range b, first and last iteration of its chunk c
+	RangeChunks,
+	RangeFirst,
+	RangeLast,
+
+	Halt,
+};
+
+struct Instr {
+	Opcode op;
+	int32_t a = 0;
+	int32_t b = 0;
+	int32_t c = 0;
+};
+
+struct Function {
+	std::string name;
+	std::vector<Instr> code;
+	// Registers of each kind the function needs, the arguments are the first ones
+	uint32_t registers[KindCount] = {};
+	std::vector<Kind> args;
+	bool returns = false;
+	Kind result = Kind::Int;
+	// memo func, the VM caches its results by the arguments
+	bool memo = false;
+	// Caller registers of every call, in the order of the callee's arguments
+	std::vector<int32_t> call_args;
+};
+
+struct Program {
+	// Main program first
+	std::vector<Function> functions;
+	std::vector<double> doubles;
+	std::vector<std::string> strs;
+	DataTables data;
+};
+
+// Compiles an analyzed and optimized program
+Program compile(const ir::Program& program);
+
+// Readable listing of the instructions, for debugging
+std::string disassemble(const Program& program);
+
+}
@@ -0,0 +1,112 @@
+#include "cache.h"
+
+#include <algorithm>
+#include <atomic>
+#include <vector>
+
+#ifdef _WIN32
+#include <process.h>
+#define getpid _getpid
+#else
+#include <unistd.h>
+#endif
+
+#include "hash.h"
+
+namespace fs = std::filesystem;
+
+namespace {
+
+// Temporary files of stores are named after the process and a count of its stores, so
+// that no two stores write the same file, in this process or another
+std::atomic<unsigned long> store_count{ 0 };
+
+}
+
+BuildCache::BuildCache(CacheConfig config) : config_(std::move(config)) {
+	std::error_code ec;
+	fs::create_directories(config_.dir, ec);
+}
+
+fs::path BuildCache::entryPath(const std::string& key) const {
+	return fs::path(config_.dir) / (key + ".bin");
+}
+
+std::string BuildCache::key(std::string_view program, std::string_view cmd, std::string_view runtime) {
+	return ContentHash().field(program).field(cmd).field(runtime).hex();
+}
+
+bool BuildCache::fetch(const std::string& key, const std::string& target_path) {
+	std::error_code ec;
+	fs::path entry = entryPath(key);
+
+	if (fs::copy_file(entry, target_path, fs::copy_options::overwrite_existing, ec)) {
+		// Last write time of an entry is its last use
+		fs::last_write_time(entry, fs::file_time_type::clock::now(), ec);
+		hits_++;
+		return true;
+	}
+
+	misses_++;
+	return false;
+}
+
+void BuildCache::store(const std::string& key, const std::string& binary_path) {
+	std::error_code ec;
+	fs::path entry = entryPath(key);
+
+	// Copy next to the entry and rename, readers never see a partial file
+	fs::path tmp = entry;
+	tmp += fmt::format(".{}.{}.tmp", getpid(), store_count++);
+	if (fs::copy_file(binary_path, tmp, fs::copy_options::overwrite_existing, ec)) {
+		fs::rename(tmp, entry, ec);
+	}
+	fs::remove(tmp, ec);
+}
+
+void BuildCache::evict() {
+	struct Entry {
+		fs::path path;
+		uint64_t size;
+		fs::file_time_type used;
+	};
+
+	std::error_code ec;
+	std::vector<Entry> entries;
+	uint64_t total = 0;
+
+	for (const auto& file : fs::directory_iterator(config_.dir, ec)) {
+		if (file.path().extension() != ".bin") {
+			continue;
+		}
+		Entry entry{ file.path(), file.file_size(ec), file.last_write_time(ec) };
+		total += entry.size;
+		entries.push_back(entry);
+	}
+
+	std::sort(entries.begin(), entries.end(), [](const Entry& a, const Entry& b) { return a.used < b.used; });
+
+	for (const auto& entry : entries) {
+		if (total <= config_.max_size) {
+			break;
+		}
+		if (fs::remove(entry.path, ec)) {
+			total -= entry.size;
+		}
+	}
+}
+
+std::pair<uint64_t, size_t> BuildCache::usage() const {
+	std::error_code ec;
+	uint64_t total = 0;
+	size_t count = 0;
+
+	for (const auto& file : fs::directory_iterator(config_.dir, ec)) {
+		if (file.path().extension() == ".bin") {
+			total += file.file_size(ec);
+			count++;
+		}
+	}
+
+	return { total, count };
+}
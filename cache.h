@@ -0,0 +1,51 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <string_view>
+
+// [cache] section of jagle.toml
+struct CacheConfig {
+	bool enabled = false;
+	std::string dir = ".jagle-cache";
+	uint64_t max_size = 512ull * 1024 * 1024;
+};
+
+// Content-addressed store of compiled executables. An entry is keyed by everything that
+// determines the compiler output, so a hit can replace running the compiler.
+// Safe to use from several threads and processes at once.
+class BuildCache {
+private:
+	CacheConfig config_;
+	std::atomic<size_t> hits_{ 0 };
+	std::atomic<size_t> misses_{ 0 };
+
+	std::filesystem::path entryPath(const std::string& key) const;
+
+public:
+	explicit BuildCache(CacheConfig config);
+
+	// program: generated C++, cmd: compiler command, runtime: contents of the runtime the
+	// program is built against
+	static std::string key(std::string_view program, std::string_view cmd, std::string_view runtime);
+
+	// Copies the cached executable to target_path. Counts a hit or a miss.
+	bool fetch(const std::string& key, const std::string& target_path);
+	void store(const std::string& key, const std::string& binary_path);
+
+	// Removes least recently used entries until the cache fits in max_size
+	void evict();
+
+	size_t hits() const {
+		return hits_;
+	}
+
+	size_t misses() const {
+		return misses_;
+	}
+
+	// Total size of the entries in bytes, and their count
+	std::pair<uint64_t, size_t> usage() const;
+};
@@ -0,0 +1,909 @@
+#include "driver.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <sstream>
+#include <thread>
+
+#include <fmt/args.h>
+#include <fmt/core.h>
+#include <fmt/ranges.h>
+
+#include "bytecode.h"
+#include "hash.h"
+#include "ir_builder.h"
+#include "process.h"
+#include "semantic.h"
+#include "source.h"
+#include "visitor.h"
+#include "vm.h"
+
+namespace {
+
+std::string readFile(const std::string& file_name) {
+	std::ifstream file(file_name, std::ios::binary);
+	std::ostringstream contents;
+	contents << file.rdbuf();
+	return contents.str();
+}
+
+// Expands the compiler command macros in text, source and target as given. extra are the
+// macros of a single command, like {object}.
+std::string expandMacros(const std::string& text, const CompilerConfig& config, const std::string& source,
+	const std::string& target, const std::vector<std::pair<const char*, std::string>>& extra = {}) {
+	std::string include_dir = std::filesystem::path(config.runtime_header).parent_path().string();
+	fmt::dynamic_format_arg_store<fmt::format_context> args;
+	args.push_back(fmt::arg("source", source));
+	args.push_back(fmt::arg("target", target));
+	args.push_back(fmt::arg("runtime_include", include_dir.empty() ? "." : include_dir));
+	args.push_back(fmt::arg("runtime_library", config.runtime_library));
+	for (const auto& [name, value] : extra) {
+		args.push_back(fmt::arg(name, value));
+	}
+	return fmt::vformat(text, args);
+}
+
+std::string expandCommand(const CompilerConfig& config, const std::string& source, const std::string& target) {
+	return expandMacros(config.cmd, config, source, target);
+}
+
+// Calls f(i) for i in [0, count) on thread_count threads, the calling one included
+void runOnThreads(size_t count, unsigned int thread_count, const std::function<void(size_t)>& f) {
+	std::atomic<size_t> next{ 0 };
+	auto worker = [&]() {
+		for (size_t i = next++; i < count; i = next++) {
+			f(i);
+		}
+	};
+
+	thread_count = std::max(1u, std::min<unsigned int>(thread_count, static_cast<unsigned int>(count)));
+	std::vector<std::thread> workers;
+	for (unsigned int i = 1; i < thread_count; i++) {
+		workers.emplace_back(worker);
+	}
+	worker();
+	for (auto& t : workers) {
+		t.join();
+	}
+}
+
+// Compiler arguments that read the source from stdin: a lone {source} argument becomes
+// "-x c++ - -x none", the last part so that files after it (the runtime library) are
+// again recognized by their extension. Empty when the command can't be run that way.
+std::vector<std::string> pipedCommand(const CompilerConfig& config, const std::string& target) {
+	std::vector<std::string> args;
+	bool has_source = false;
+
+	for (const auto& arg : splitCommand(config.cmd)) {
+		if (arg == "{source}") {
+			args.insert(args.end(), { "-x", "c++", "-", "-x", "none" });
+			has_source = true;
+		}
+		else if (arg.find("{source}") != std::string::npos) {
+			return {};
+		}
+		else {
+			args.push_back(expandMacros(arg, config, "", target));
+		}
+	}
+
+	if (!has_source) {
+		return {};
+	}
+	return args;
+}
+
+// Adds a phase to the report with the time from construction until stop() or destruction.
+// With children the CPU time of child processes that exit meanwhile is added, in batch
+// builds this may include compilers started by other threads.
+class PhaseTimer {
+public:
+	PhaseTimer(TimeReport& report, const char* name, bool children = false)
+		: report(report), name(name), children(children), wall(std::chrono::steady_clock::now()),
+		cpu(threadCpuSeconds() + (children ? childCpuSeconds() : 0)) {
+	}
+
+	~PhaseTimer() {
+		stop();
+	}
+
+	void stop() {
+		if (!name) {
+			return;
+		}
+		double wall_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - wall).count();
+		double cpu_seconds = threadCpuSeconds() + (children ? childCpuSeconds() : 0) - cpu;
+		report.phases.push_back({ name, wall_seconds, cpu_seconds, peakResidentBytes() });
+		name = nullptr;
+	}
+
+private:
+	TimeReport& report;
+	const char* name;
+	bool children;
+	std::chrono::steady_clock::time_point wall;
+	double cpu;
+};
+
+size_t countNodes(antlr4::tree::ParseTree* tree) {
+	size_t count = 1;
+	for (auto* child : tree->children) {
+		count += countNodes(child);
+	}
+	return count;
+}
+
+std::string jsonString(const std::string& text) {
+	std::string quoted = "\"";
+	for (char c : text) {
+		if (c == '"' || c == '\\') {
+			quoted += '\\';
+			quoted += c;
+		}
+		else if (static_cast<unsigned char>(c) < 0x20) {
+			quoted += fmt::format("\\u{:04x}", c);
+		}
+		else {
+			quoted += c;
+		}
+	}
+	return quoted + "\"";
+}
+
+}
+
+jagle::JagleParser::ProgContext* parseProgram(jagle::JagleParser& parser, PredictionMode mode) {
+	auto interpreter = parser.getInterpreter<antlr4::atn::ParserATNSimulator>();
+	parser.setErrorHandler(std::make_shared<antlr4::BailErrorStrategy>());
+
+	if (mode == PredictionMode::LL) {
+		interpreter->setPredictionMode(antlr4::atn::PredictionMode::LL);
+		return parser.prog();
+	}
+
+	interpreter->setPredictionMode(antlr4::atn::PredictionMode::SLL);
+	if (mode == PredictionMode::SLL) {
+		return parser.prog();
+	}
+
+	// Stage 1: SLL is enough for nearly every valid program. Errors are not reported,
+	// they may be SLL artifacts the LL stage resolves.
+	parser.removeErrorListeners();
+	try {
+		auto tree = parser.prog();
+		parser.addErrorListener(&antlr4::ConsoleErrorListener::INSTANCE);
+		return tree;
+	}
+	catch (antlr4::ParseCancellationException&) {
+		// Stage 2: rewind the token stream and parse again with full LL
+		parser.addErrorListener(&antlr4::ConsoleErrorListener::INSTANCE);
+		parser.reset();
+		interpreter->setPredictionMode(antlr4::atn::PredictionMode::LL);
+		return parser.prog();
+	}
+}
+
+std::string describeSyntaxError(const antlr4::ParseCancellationException& e) {
+	// BailErrorStrategy nests the original recognition error
+	try {
+		std::rethrow_if_nested(e);
+	}
+	catch (const antlr4::RecognitionException& re) {
+		if (antlr4::Token* token = re.getOffendingToken()) {
+			return fmt::format("syntax error at line {}:{} near '{}'", token->getLine(), token->getCharPositionInLine(), token->getText());
+		}
+	}
+	catch (...) {
+	}
+	return "syntax error";
+}
+
+namespace {
+
+// Modules of the program being loaded
+struct ModuleSet {
+	// Imports are read from here, the directory of the main program
+	std::filesystem::path dir;
+	// Interfaces of the modules loaded so far
+	std::unordered_map<std::string, ModuleInterface> interfaces;
+	// The main program and the modules whose imports are being loaded, to report cycles
+	std::vector<std::string> loading;
+	// Loaded modules, each after the ones it imports, and their functions with the arenas
+	// their nodes live in
+	std::vector<ir::Module> modules;
+	std::vector<std::unique_ptr<ir::Arena>> arenas;
+	std::vector<ir::Function> functions;
+	std::vector<std::string> sources;
+};
+
+bool lowerFile(const std::string& source_fname, const std::string& module, ModuleSet& modules, const DriverOptions& options,
+	ir::Program& program, std::string& error, TimeReport& report);
+
+// Loads the modules the tree imports that are not loaded yet
+bool importModules(JP::ProgContext* tree, ModuleSet& modules, const DriverOptions& options, std::string& error,
+	TimeReport& report) {
+	for (auto stmtList : tree->stmtList()) {
+		for (auto statement : stmtList->statement()) {
+			auto import = statement->importStmt();
+			if (!import) {
+				continue;
+			}
+			std::string name = import->identifier()->getText();
+			if (std::find(modules.loading.begin(), modules.loading.end(), name) != modules.loading.end()) {
+				error = fmt::format("import cycle: {} -> {}", fmt::join(modules.loading, " -> "), name);
+				return false;
+			}
+			if (modules.interfaces.count(name)) {
+				continue;
+			}
+
+			std::string module_fname = (modules.dir / (name + ".jagle")).string();
+			ir::Program module_program;
+			if (!lowerFile(module_fname, name, modules, options, module_program, error, report)) {
+				return false;
+			}
+			modules.modules.push_back({ name, module_fname, module_program.imports });
+			for (auto& function : module_program.functions) {
+				modules.functions.push_back(std::move(function));
+			}
+			for (auto& arena : module_program.arenas) {
+				modules.arenas.push_back(std::move(arena));
+			}
+		}
+	}
+	return true;
+}
+
+// Parses and checks a source file, the main program when module is empty, and lowers it into
+// the IR, timing each step in report. The modules it imports are loaded first. The source,
+// its tokens and the parse tree are freed on return, only the IR is kept.
+bool lowerFile(const std::string& source_fname, const std::string& module, ModuleSet& modules, const DriverOptions& options,
+	ir::Program& program, std::string& error, TimeReport& report) {
+	// Errors in a module name its file
+	auto located = [&](const std::string& message) {
+		return module.empty() ? message : fmt::format("{}: {}", source_fname, message);
+	};
+
+	PhaseTimer read(report, "read");
+	SourceFile source;
+	if (!source.open(source_fname)) {
+		error = module.empty() ? fmt::format("File '{}' does not exist!", source_fname)
+			: fmt::format("module '{}' not found, there is no {}", module, source_fname);
+		return false;
+	}
+	modules.sources.push_back(source_fname);
+	// ASCII is lexed in place, anything else is decoded from UTF-8 into a copy
+	std::unique_ptr<antlr4::CharStream> input;
+	if (source.isAscii()) {
+		input = std::make_unique<AsciiCharStream>(source.text(), source_fname);
+	}
+	else {
+		input = std::make_unique<antlr4::ANTLRInputStream>(source.text());
+	}
+	read.stop();
+
+	if (options.verbose) {
+		std::cout << "Parsing " << source_fname << " ..." << std::endl;
+	}
+
+	PhaseTimer lex(report, "lex");
+	jagle::JagleLexer lexer(input.get());
+	antlr4::CommonTokenStream tokens(&lexer);
+	tokens.fill();
+	report.tokens += tokens.size();
+	lex.stop();
+
+	PhaseTimer parse(report, "parse");
+	jagle::JagleParser parser(&tokens);
+	jagle::JagleParser::ProgContext* tree;
+	try {
+		tree = parseProgram(parser, options.prediction);
+	}
+	catch (const antlr4::ParseCancellationException& e) {
+		error = located(describeSyntaxError(e));
+		return false;
+	}
+	parse.stop();
+	report.parse_tree_nodes += countNodes(tree);
+
+	modules.loading.push_back(module.empty() ? std::filesystem::path(source_fname).stem().string() : module);
+	if (!importModules(tree, modules, options, error, report)) {
+		return false;
+	}
+	modules.loading.pop_back();
+
+	PhaseTimer analyze(report, "analyze");
+	SemanticAnalyzer semantic(module, &modules.interfaces);
+	if (!semantic.analyze(tree)) {
+		std::vector<std::string> messages;
+		for (const auto& semantic_error : semantic.getErrors()) {
+			messages.push_back(semantic_error.describe());
+		}
+		error = located(fmt::format("{}", fmt::join(messages, "\n")));
+		return false;
+	}
+	analyze.stop();
+	if (!module.empty()) {
+		modules.interfaces[module] = semantic.exports();
+	}
+
+	PhaseTimer lower(report, "lower");
+	program = IrBuilder(&semantic).build(tree);
+	return true;
+}
+
+// Lowers a program and the modules it imports into one IR, the functions of the modules
+// first
+bool lowerProgram(const std::string& source_fname, const DriverOptions& options, ir::Program& program,
+	std::vector<std::string>& sources, std::string& error, TimeReport& report) {
+	ModuleSet modules;
+	modules.dir = std::filesystem::path(source_fname).parent_path();
+	bool ok = lowerFile(source_fname, "", modules, options, program, error, report);
+	sources = std::move(modules.sources);
+	if (!ok) {
+		return false;
+	}
+
+	program.modules = std::move(modules.modules);
+	modules.functions.insert(modules.functions.end(), std::make_move_iterator(program.functions.begin()),
+		std::make_move_iterator(program.functions.end()));
+	program.functions = std::move(modules.functions);
+	for (auto& arena : modules.arenas) {
+		program.arenas.push_back(std::move(arena));
+	}
+	return true;
+}
+
+// Lowers a source file into the optimized IR. Returns false and sets error when any step
+// fails.
+bool buildProgram(const std::string& source_fname, const DriverOptions& options, ir::Program& program, std::string& error,
+	TimeReport& report, std::vector<std::string>* sources = nullptr) {
+	std::vector<std::string> files;
+	bool lowered = lowerProgram(source_fname, options, program, files, error, report);
+	if (sources) {
+		*sources = std::move(files);
+	}
+	if (!lowered) {
+		return false;
+	}
+
+	PhaseTimer optimize(report, "optimize");
+	runPasses(program, options.passes);
+	for (const auto& arena : program.arenas) {
+		report.ir_bytes += arena->bytes();
+	}
+	return true;
+}
+
+// Writes the units and their headers into the units directory of the target, compiles the
+// units whose object is missing on thread_count threads and links the objects unless they are
+// the ones linked last time. An object is named after everything that goes into it, its unit,
+// the headers it includes, unit_cmd and the runtime, so it is compiled only when one of them
+// changes. The objects no longer linked are removed.
+bool compileUnits(const TranspileJob& job, const CompilerConfig& config, const DriverOptions& options,
+	const std::vector<TranslationUnit>& units, std::vector<std::string>& linked_objects, unsigned int thread_count,
+	TranspileResult& result) {
+	namespace fs = std::filesystem;
+	result.units = units.size();
+
+	fs::path dir = fs::path(config.units_dir) / fs::path(job.target_name).filename();
+	std::error_code ec;
+	fs::create_directories(dir, ec);
+
+	std::unordered_map<std::string, const std::string*> headers;
+	for (const auto& unit : units) {
+		if (!unit.header.empty()) {
+			headers[unit.name] = &unit.header;
+			std::string header_fname = (dir / (unit.name + ".hpp")).string();
+			if (readFile(header_fname) != unit.header) {
+				std::ofstream(header_fname, std::ios::binary) << unit.header;
+			}
+		}
+	}
+
+	std::string runtime = readFile(config.runtime_header);
+	std::vector<std::string> sources;
+	std::vector<std::string> objects;
+	std::vector<size_t> changed;
+	for (size_t i = 0; i < units.size(); i++) {
+		ContentHash hash;
+		hash.field(units[i].code).field(config.unit_cmd).field(runtime);
+		for (const auto& included : units[i].includes) {
+			auto found = headers.find(included);
+			hash.field(found == headers.end() ? "" : *found->second);
+		}
+		sources.push_back((dir / (units[i].name + ".cpp")).string());
+		objects.push_back((dir / fmt::format("{}.{}.o", units[i].name, hash.hex())).string());
+		if (!options.compile || !fs::exists(objects.back(), ec)) {
+			changed.push_back(i);
+		}
+	}
+
+	if (!options.compile) {
+		for (size_t i = 0; i < units.size(); i++) {
+			std::ofstream(sources[i], std::ios::binary) << units[i].code;
+		}
+		return true;
+	}
+
+	std::vector<int> statuses(changed.size());
+	runOnThreads(changed.size(), thread_count, [&](size_t k) {
+		size_t i = changed[k];
+		std::ofstream(sources[i], std::ios::binary) << units[i].code;
+		std::string cmd = expandMacros(config.unit_cmd, config, sources[i], job.target_name, { { "object", objects[i] } });
+		if (options.verbose) {
+			std::cout << cmd + "\n" << std::flush;
+		}
+		statuses[k] = std::system(cmd.c_str());
+		if (statuses[k] != 0) {
+			std::error_code remove_ec;
+			fs::remove(objects[i], remove_ec);
+		}
+	});
+	result.compiled_units = changed.size();
+	for (size_t k = 0; k < changed.size(); k++) {
+		if (statuses[k] != 0) {
+			result.error = fmt::format("compiler failed with status {} on {}", statuses[k], sources[changed[k]]);
+			return false;
+		}
+	}
+
+	std::string output = fmt::format(config.output, fmt::arg("target", job.target_name));
+	if (!changed.empty() || objects != linked_objects || !fs::exists(output, ec)) {
+		std::string cmd = expandMacros(config.link_cmd, config, "", job.target_name,
+			{ { "objects", fmt::format("{}", fmt::join(objects, " ")) } });
+		if (options.verbose) {
+			std::cout << cmd << std::endl;
+		}
+		int status = std::system(cmd.c_str());
+		if (status != 0) {
+			result.error = fmt::format("linker failed with status {}", status);
+			return false;
+		}
+	}
+	linked_objects = objects;
+
+	// Objects of units that changed since
+	for (const auto& entry : fs::directory_iterator(dir, ec)) {
+		if (entry.path().extension() == ".o" && std::find(objects.begin(), objects.end(), entry.path().string()) == objects.end()) {
+			fs::remove(entry.path(), ec);
+		}
+	}
+	return true;
+}
+
+// Builds a program that imports modules: main and every module are compiled on their own, on
+// options.jobs threads, and linked
+void transpileModules(const TranspileJob& job, const CompilerConfig& config, const DriverOptions& options,
+	const ir::Program& program, TranspileResult& result) {
+	PhaseTimer emit(result.report, "emit");
+	CppEmitter emitter(options.data_blob_items, options.bounds_checks, options.profile, options.memo_entries);
+	emitter.emit(program);
+	std::vector<TranslationUnit> units = emitter.getModuleUnits(program);
+	for (const auto& unit : units) {
+		result.report.cpp_bytes += unit.code.size() + unit.header.size();
+		if (options.echo) {
+			std::cout << unit.header << unit.code;
+		}
+	}
+	emit.stop();
+
+	PhaseTimer compile(result.report, "compile", true);
+	std::string output = fmt::format(config.output, fmt::arg("target", job.target_name));
+	std::string cache_key;
+	if (options.cache && options.compile) {
+		ContentHash code;
+		for (const auto& unit : units) {
+			code.field(unit.name).field(unit.header).field(unit.code);
+		}
+		std::string key_cmd = expandMacros(config.unit_cmd + "\n" + config.link_cmd, config, "{source}", "{target}");
+		cache_key = BuildCache::key(code.hex(), key_cmd, readFile(config.runtime_header) + readFile(config.runtime_library));
+		if (options.cache->fetch(cache_key, output)) {
+			if (options.verbose) {
+				std::cout << "Using cached " << output << std::endl;
+			}
+			result.ok = true;
+			result.cached = true;
+			return;
+		}
+	}
+
+	if (options.verbose) {
+		std::cout << fmt::format("Compiling {} and {} module{} ...", job.target_name, units.size() - 1,
+			units.size() == 2 ? "" : "s") << std::endl;
+	}
+	std::vector<std::string> linked;
+	if (!compileUnits(job, config, options, units, linked, options.jobs, result)) {
+		return;
+	}
+	if (options.cache && options.compile) {
+		options.cache->store(cache_key, output);
+	}
+	result.ok = true;
+}
+
+}
+
+TranspileResult transpileFile(const TranspileJob& job, const CompilerConfig& config, const DriverOptions& options) {
+	TranspileResult result;
+
+	std::string target_fname = job.target_name + ".cpp";
+	std::string cmd = expandCommand(config, target_fname, job.target_name);
+
+	ir::Program ir_program;
+	if (!buildProgram(job.source_fname, options, ir_program, result.error, result.report, &result.sources)) {
+		return result;
+	}
+	if (!ir_program.modules.empty()) {
+		transpileModules(job, config, options, ir_program, result);
+		return result;
+	}
+
+	PhaseTimer emit(result.report, "emit");
+	CppEmitter emitter(options.data_blob_items, options.bounds_checks, options.profile, options.memo_entries);
+	emitter.emit(ir_program);
+	std::string program = emitter.getOutput();
+	result.report.cpp_bytes = program.size();
+	emit.stop();
+
+	// Piped sources only go to disk when kept
+	std::vector<std::string> piped_args;
+#ifdef JAGLE_HAS_SPAWN
+	if (options.compile && config.pipe_source) {
+		piped_args = pipedCommand(config, job.target_name);
+	}
+#endif
+	PhaseTimer write(result.report, "write");
+	if (piped_args.empty() || config.keep_source) {
+		if (options.verbose) {
+			std::cout << "Generating " << target_fname << std::endl;
+		}
+		OutputStream out(options.echo);
+		out.open(target_fname);
+		out << program;
+	}
+	else if (options.echo) {
+		std::cout << program;
+	}
+	write.stop();
+
+	// Compile to exe
+	if (options.compile) {
+		PhaseTimer compile(result.report, "compile", true);
+		std::string output = fmt::format(config.output, fmt::arg("target", job.target_name));
+		std::string cache_key;
+
+		if (options.cache) {
+			// File names are left out of the key, the same program built under another
+			// name is still a hit
+			std::string key_cmd = expandCommand(config, "{source}", "{target}");
+			cache_key = BuildCache::key(program, key_cmd, readFile(config.runtime_header) + readFile(config.runtime_library));
+
+			if (options.cache->fetch(cache_key, output)) {
+				if (options.verbose) {
+					std::cout << "Using cached " << output << std::endl;
+				}
+				result.ok = true;
+				result.cached = true;
+				return result;
+			}
+		}
+
+		int status = -1;
+		if (piped_args.empty()) {
+			if (options.verbose) {
+				std::cout << "Compiling " << target_fname << " ..." << std::endl;
+				std::cout << cmd << std::endl;
+			}
+			status = std::system(cmd.c_str());
+		}
+		else {
+#ifdef JAGLE_HAS_SPAWN
+			if (options.verbose) {
+				std::cout << "Compiling " << job.target_name << " from a pipe ..." << std::endl;
+				std::cout << fmt::format("{}", fmt::join(piped_args, " ")) << std::endl;
+			}
+			status = runProcess(piped_args, program, result.error);
+			if (status < 0) {
+				return result;
+			}
+#endif
+		}
+		if (status != 0) {
+			result.error = fmt::format("compiler failed with status {}", status);
+			return result;
+		}
+
+		if (options.cache) {
+			options.cache->store(cache_key, output);
+		}
+	}
+
+	result.ok = true;
+	return result;
+}
+
+TranspileResult transpilePgo(const TranspileJob& job, const CompilerConfig& config, const DriverOptions& options,
+	const PgoTraining& training) {
+	namespace fs = std::filesystem;
+
+	// The modules the program imports are only known once it is parsed
+	std::vector<std::string> sources;
+	{
+		DriverOptions quiet = options;
+		quiet.verbose = false;
+		ir::Program program;
+		TimeReport report;
+		TranspileResult failed;
+		if (!lowerProgram(job.source_fname, quiet, program, sources, failed.error, report)) {
+			failed.sources = std::move(sources);
+			return failed;
+		}
+	}
+
+	// A profile fits the program it was recorded with, built the same way, and its run. GCC
+	// fails the build when a function in any of the sources or the runtime header no longer
+	// matches its profile.
+	ContentHash key;
+	for (const auto& source : sources) {
+		key.field(source).field(readFile(source));
+	}
+	key.field(readFile(config.runtime_header)).field(readFile(config.runtime_library));
+	key.field(readFile(training.input)).field(training.args);
+	key.field(config.cmd).field(config.unit_cmd).field(config.link_cmd).field(config.pipe_source ? "piped" : "");
+	key.field(config.pgo_generate_flags).field(config.pgo_use_flags);
+	key.field(options.bounds_checks ? "checked" : "unchecked").field(options.profile ? "profile" : "");
+	key.field(std::to_string(options.data_blob_items)).field(std::to_string(options.memo_entries));
+	for (const auto& pass : passPipeline()) {
+		key.field(options.passes.*pass.enabled ? pass.name : "");
+	}
+	fs::path profile_dir = fs::absolute(fs::path(config.pgo_dir) / key.hex());
+	fs::path stamp = profile_dir / "trained";
+
+	auto withFlags = [&](const std::string& flags) {
+		CompilerConfig phase = config;
+		std::string expanded = " " + fmt::format(flags, fmt::arg("profile_dir", profile_dir.string()));
+		// Programs with modules are compiled and linked with the unit commands
+		phase.cmd += expanded;
+		phase.unit_cmd += expanded;
+		phase.link_cmd += expanded;
+		return phase;
+	};
+
+	TranspileResult result;
+	std::error_code ec;
+	if (fs::exists(stamp, ec)) {
+		result.profile_reused = true;
+		if (options.verbose) {
+			std::cout << "Using the profile in " << profile_dir.string() << std::endl;
+		}
+	}
+	else {
+		fs::remove_all(profile_dir, ec);
+		fs::create_directories(profile_dir, ec);
+
+		// Never from the build cache, it has no profile to write
+		DriverOptions instrumented = options;
+		instrumented.cache = nullptr;
+		result = transpileFile(job, withFlags(config.pgo_generate_flags), instrumented);
+		if (!result.ok) {
+			return result;
+		}
+
+#ifdef _WIN32
+		const char* discard = "NUL";
+#else
+		const char* discard = "/dev/null";
+#endif
+		std::string output = fs::absolute(fmt::format(config.output, fmt::arg("target", job.target_name))).string();
+		std::string run = fmt::format("\"{}\"{}{} < \"{}\" > {}", output, training.args.empty() ? "" : " ", training.args,
+			training.input, discard);
+		if (options.verbose) {
+			std::cout << "Training ..." << std::endl;
+			std::cout << run << std::endl;
+		}
+		auto started = std::chrono::steady_clock::now();
+		int status = std::system(run.c_str());
+		result.training_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+		if (status != 0) {
+			result.ok = false;
+			result.error = fmt::format("training run failed with status {}", status);
+			return result;
+		}
+		std::ofstream(stamp, std::ios::binary) << run;
+	}
+
+	TranspileResult optimized = transpileFile(job, withFlags(config.pgo_use_flags), options);
+	optimized.profile_reused = result.profile_reused;
+	optimized.training_seconds = result.training_seconds;
+	return optimized;
+}
+
+TranspileResult transpileIncremental(const TranspileJob& job, const CompilerConfig& config, const DriverOptions& driver_options,
+	IncrementalState& state, unsigned int thread_count) {
+	TranspileResult result;
+	// The code of a function must not depend on the bodies of the functions it calls
+	DriverOptions options = driver_options;
+	options.passes.call_folding = false;
+
+	ir::Program ir_program;
+	if (!buildProgram(job.source_fname, options, ir_program, result.error, result.report, &result.sources)) {
+		return result;
+	}
+
+	// The code of a function depends on its definition, on the signatures of the functions
+	// it calls and on the options
+	ContentHash context;
+	context.field(options.bounds_checks ? "checked" : "unchecked").field(options.profile ? "profile" : "");
+	context.field(std::to_string(options.memo_entries));
+	for (const auto& pass : passPipeline()) {
+		context.field(options.passes.*pass.enabled ? pass.name : "");
+	}
+	for (const auto& function : ir_program.functions) {
+		context.field(function.name).field(CppEmitter::cppType(function.result));
+		for (const auto& arg : function.args) {
+			context.field(CppEmitter::cppType(arg.type));
+		}
+	}
+
+	std::vector<std::string> keys;
+	CppEmitter emitter(options.data_blob_items, options.bounds_checks, options.profile, options.memo_entries);
+	emitter.emit(ir_program, [&](const ir::Function& function) -> const EmittedFunction* {
+		keys.push_back(ContentHash(context).field(function.source).hex());
+		auto found = state.functions.find(keys.back());
+		if (function.source.empty() || found == state.functions.end()) {
+			result.emitted_functions++;
+			return nullptr;
+		}
+		return &found->second;
+	});
+
+	// Only the functions of this build are kept
+	std::unordered_map<std::string, EmittedFunction> functions;
+	for (size_t i = 0; i < keys.size(); i++) {
+		if (!ir_program.functions[i].source.empty()) {
+			functions.emplace(keys[i], emitter.getFunctions()[i]);
+		}
+	}
+	state.functions = std::move(functions);
+
+	std::vector<TranslationUnit> units = emitter.getUnits();
+	for (size_t i = 1; i < units.size(); i++) {
+		units[i].name = "func_" + units[i].name;
+	}
+	result.ok = compileUnits(job, config, options, units, state.objects, thread_count, result);
+	return result;
+}
+
+TranspileResult runFile(const std::string& source_fname, const DriverOptions& options) {
+	TranspileResult result;
+	ir::Program ir_program;
+	if (!buildProgram(source_fname, options, ir_program, result.error, result.report)) {
+		return result;
+	}
+
+	bc::Program program = bc::compile(ir_program);
+	Vm(program).run();
+	result.ok = true;
+	return result;
+}
+
+std::vector<TranspileResult> transpileBatch(const std::vector<TranspileJob>& jobs, const CompilerConfig& config,
+	const DriverOptions& options, unsigned int thread_count) {
+	std::vector<TranspileResult> results(jobs.size());
+
+	// The ATN and the DFA caches of the generated lexer and parser are static and shared
+	// by every instance, so files parsed later reuse the prediction work of earlier ones.
+	// Everything else (streams, parser, visitor) is private to a job.
+	runOnThreads(jobs.size(), thread_count, [&](size_t i) {
+		auto started = std::chrono::steady_clock::now();
+		try {
+			results[i] = transpileFile(jobs[i], config, options);
+		}
+		catch (const std::exception& e) {
+			results[i].error = e.what();
+		}
+		results[i].seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+	});
+
+	return results;
+}
+
+std::string formatTimeReport(const std::vector<TranspileJob>& jobs, const std::vector<TranspileResult>& results, bool json) {
+	std::string text;
+
+	if (json) {
+		std::vector<std::string> files;
+		for (size_t i = 0; i < jobs.size(); i++) {
+			const TimeReport& report = results[i].report;
+			std::vector<std::string> phases;
+			for (const auto& phase : report.phases) {
+				phases.push_back(fmt::format("{{\"name\":\"{}\",\"wall_ms\":{:.3f},\"cpu_ms\":{:.3f},\"peak_rss_bytes\":{}}}",
+					phase.name, phase.wall * 1000, phase.cpu * 1000, phase.peak_rss));
+			}
+			files.push_back(fmt::format("{{\"source\":{},\"target\":{},\"ok\":{},\"cached\":{},{}\"tokens\":{},"
+				"\"parse_tree_nodes\":{},\"ir_bytes\":{},\"cpp_bytes\":{},\"phases\":[{}]}}",
+				jsonString(jobs[i].source_fname), jsonString(jobs[i].target_name), results[i].ok, results[i].cached,
+				results[i].ok ? "" : "\"error\":" + jsonString(results[i].error) + ",", report.tokens, report.parse_tree_nodes,
+				report.ir_bytes, report.cpp_bytes, fmt::join(phases, ",")));
+		}
+		return fmt::format("{{\"peak_rss_bytes\":{},\"files\":[{}]}}\n", peakResidentBytes(), fmt::join(files, ","));
+	}
+
+	for (size_t i = 0; i < jobs.size(); i++) {
+		const TimeReport& report = results[i].report;
+		text += fmt::format("{} -> {}{}\n", jobs[i].source_fname, jobs[i].target_name,
+			results[i].ok ? (results[i].cached ? ", cached" : "") : ", failed");
+		text += fmt::format("  {:<10}{:>12}{:>12}{:>12}\n", "phase", "wall ms", "cpu ms", "peak MB");
+		double wall = 0;
+		double cpu = 0;
+		for (const auto& phase : report.phases) {
+			text += fmt::format("  {:<10}{:>12.3f}{:>12.3f}{:>12.1f}\n", phase.name, phase.wall * 1000, phase.cpu * 1000,
+				phase.peak_rss / (1024.0 * 1024.0));
+			wall += phase.wall;
+			cpu += phase.cpu;
+		}
+		text += fmt::format("  {:<10}{:>12.3f}{:>12.3f}\n", "total", wall * 1000, cpu * 1000);
+		text += fmt::format("  {} tokens, {} parse tree nodes, {} bytes of IR, {} bytes of C++\n", report.tokens,
+			report.parse_tree_nodes, report.ir_bytes, report.cpp_bytes);
+	}
+	return text + fmt::format("Peak RSS: {:.1f} MB\n", peakResidentBytes() / (1024.0 * 1024.0));
+}
+
+bool buildPrecompiledHeader(const CompilerConfig& config, bool verbose, std::string& error) {
+	namespace fs = std::filesystem;
+
+	// GCC and Clang pick up header.gch from the directory of the header by themselves
+	std::string pch = config.runtime_header + ".gch";
+	std::string stamp = pch + ".cmd";
+	std::string cmd = fmt::format(config.pch_cmd, fmt::arg("header", config.runtime_header), fmt::arg("pch", pch));
+
+	std::error_code ec;
+	if (fs::exists(pch, ec) && fs::last_write_time(pch, ec) >= fs::last_write_time(config.runtime_header, ec)
+		&& readFile(stamp) == cmd) {
+		return true;
+	}
+
+	if (verbose) {
+		std::cout << "Precompiling " << config.runtime_header << " ..." << std::endl;
+		std::cout << cmd << std::endl;
+	}
+	int status = std::system(cmd.c_str());
+	if (status != 0) {
+		fs::remove(pch, ec);
+		error = fmt::format("precompiling {} failed with status {}", config.runtime_header, status);
+		return false;
+	}
+
+	std::ofstream(stamp, std::ios::binary) << cmd;
+	return true;
+}
+
+std::vector<TranspileJob> readManifest(const std::string& file_name) {
+	std::vector<TranspileJob> jobs;
+	std::ifstream manifest(file_name);
+	std::string line;
+
+	while (std::getline(manifest, line)) {
+		std::istringstream fields(line);
+		TranspileJob job;
+		if (!(fields >> job.source_fname) || job.source_fname[0] == '#') {
+			continue;
+		}
+		if (!(fields >> job.target_name)) {
+			job.target_name = defaultTargetName(job.source_fname);
+		}
+		jobs.push_back(job);
+	}
+
+	return jobs;
+}
+
+std::string defaultTargetName(const std::string& source_fname) {
+	return std::filesystem::path(source_fname).replace_extension().string();
+}
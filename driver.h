@@ -0,0 +1,191 @@
+#pragma once
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "antlr4-runtime.h"
+#include "JagleLexer.h"
+#include "JagleParser.h"
+
+#include "cache.h"
+#include "emitter.h"
+#include "passes.h"
+
+// How the parser resolves decisions. Auto parses with the fast SLL prediction and
+// falls back to full LL only when SLL fails, SLL and LL force a single mode.
+enum class PredictionMode {
+	Auto,
+	SLL,
+	LL,
+};
+
+// Compiler settings from jagle.toml
+struct CompilerConfig {
+	// Write the generated .cpp to disk also when it is piped to the compiler
+	bool keep_source = false;
+	// Feed the generated code to the compiler through stdin, started without a shell.
+	// Needs a lone {source} argument in cmd and a GCC compatible compiler, falls back to
+	// compiling from the file otherwise.
+	bool pipe_source = false;
+	std::string cmd = "g++";
+	// Executable the command produces, supports the {target} macro
+	std::string output = "{target}";
+	// Runtime header the generated code includes, part of the build cache key.
+	// Its directory is the {runtime_include} macro.
+	std::string runtime_header = "jagle.hpp";
+	// Prebuilt jagle_runtime library, the {runtime_library} macro. Part of the build cache key.
+	std::string runtime_library = "build/libjagle_runtime.a";
+	// Precompiles runtime_header to runtime_header.gch next to it, supports the
+	// {header} and {pch} macros. Empty when precompiled headers are not used.
+	std::string pch_cmd;
+	// Watch mode and programs with modules compile each translation unit on its own with
+	// unit_cmd, {source} to {object}, and link them with link_cmd, {objects} to {target}.
+	// Both support the macros of cmd. The units and their objects are kept in units_dir.
+	std::string unit_cmd = "g++ -std=c++17 -I{runtime_include} -c {source} -o {object}";
+	std::string link_cmd = "g++ {objects} {runtime_library} -o {target} -pthread";
+	std::string units_dir = ".jagle-units";
+	// Profile-guided builds append these flags to cmd, for the instrumented build and for
+	// the build with the profile. {profile_dir} is where the profile is written and read,
+	// a directory of pgo_dir per program and training run.
+	std::string pgo_generate_flags = "-fprofile-generate={profile_dir} -fprofile-update=atomic";
+	std::string pgo_use_flags = "-fprofile-use={profile_dir} -fprofile-correction -Wno-missing-profile";
+	std::string pgo_dir = ".jagle-pgo";
+};
+
+struct DriverOptions {
+	PredictionMode prediction = PredictionMode::Auto;
+	bool compile = true;
+	// Progress messages on stdout. Off in batch mode.
+	bool verbose = true;
+	// Generated code on stdout
+	bool echo = false;
+	// Compiled executables are reused from here when set
+	BuildCache* cache = nullptr;
+	// Optimization passes run on the IR
+	PassOptions passes;
+	// DATA of this many items or more is embedded as a binary blob
+	size_t data_blob_items = CppEmitter::DefaultDataBlobItems;
+	// Array indexes are checked at run time, off for release builds
+	bool bounds_checks = true;
+	// Statements and functions count their executions, the program writes a source-line
+	// profile at exit
+	bool profile = false;
+	// Threads compiling the modules of a program that imports some
+	unsigned int jobs = 1;
+	// Results a memo func keeps at most
+	size_t memo_entries = CppEmitter::DefaultMemoEntries;
+};
+
+// One Jagle source to transpile into target_name.cpp and compile to target_name
+struct TranspileJob {
+	std::string source_fname;
+	std::string target_name;
+};
+
+// Wall and CPU time of one step of a build, in seconds. CPU time is the calling thread's,
+// the compile step adds that of the compiler processes.
+struct PhaseTime {
+	const char* name;
+	double wall = 0;
+	double cpu = 0;
+	// Peak resident set size of the process when the phase ended, 0 where unknown
+	size_t peak_rss = 0;
+};
+
+// Where a build spent its time and how much it handled
+struct TimeReport {
+	// In the order they ran: read, lex, parse, analyze, lower, optimize, emit, write, compile
+	std::vector<PhaseTime> phases;
+	size_t tokens = 0;
+	size_t parse_tree_nodes = 0;
+	// Blocks of the arenas the IR was built in, after the passes
+	size_t ir_bytes = 0;
+	size_t cpp_bytes = 0;
+};
+
+struct TranspileResult {
+	bool ok = false;
+	// Executable came from the build cache, the compiler did not run
+	bool cached = false;
+	std::string error;
+	double seconds = 0;
+	// Incremental builds: functions generated again instead of reused, translation units
+	// and the ones compiled again
+	size_t emitted_functions = 0;
+	size_t units = 0;
+	size_t compiled_units = 0;
+	// Profile-guided builds: the profile of an earlier training run was used, or the time
+	// the training run took
+	bool profile_reused = false;
+	double training_seconds = 0;
+	// Steps that ran, up to the one that failed
+	TimeReport report;
+	// Files the program was read from, the main one and the modules it imports
+	std::vector<std::string> sources;
+};
+
+// Run of the instrumented program that records the profile: input is its stdin, args its
+// command line arguments
+struct PgoTraining {
+	std::string input;
+	std::string args;
+};
+
+// What an incremental build keeps of a program for the next one
+struct IncrementalState {
+	// Generated functions by the hash of their definition, the signatures of all functions
+	// and the options that change the generated code
+	std::unordered_map<std::string, EmittedFunction> functions;
+	// Objects of the last build, in link order
+	std::vector<std::string> objects;
+};
+
+// Parses the whole program. Syntax errors are thrown as antlr4::ParseCancellationException.
+jagle::JagleParser::ProgContext* parseProgram(jagle::JagleParser& parser, PredictionMode mode = PredictionMode::Auto);
+
+// Human readable location and reason of a syntax error thrown by parseProgram
+std::string describeSyntaxError(const antlr4::ParseCancellationException& e);
+
+// Transpiles the program into target_name.cpp and compiles it. A program that imports modules
+// is instead written as a unit per module, with a header of its functions, and the main unit
+// into units_dir, compiled with unit_cmd on options.jobs threads and linked with link_cmd.
+// A unit is compiled again only when its module or the headers of its imports change.
+TranspileResult transpileFile(const TranspileJob& job, const CompilerConfig& config, const DriverOptions& options);
+
+// Builds the program with profile-guided optimization: an instrumented build runs once with
+// the training input, then the program is compiled again with the profile it recorded. The
+// profile is kept by the hash of the source, the options and the training run, and used
+// again without training while none of them changes.
+TranspileResult transpilePgo(const TranspileJob& job, const CompilerConfig& config, const DriverOptions& options,
+	const PgoTraining& training);
+
+// Transpiles the program into a translation unit per function and compiles the units that
+// changed since the last build with the same state, on thread_count threads, then links
+// them. Functions whose definition did not change are not generated again. Objects are named
+// after the hash of their unit in units_dir, the ones no longer linked are removed.
+TranspileResult transpileIncremental(const TranspileJob& job, const CompilerConfig& config, const DriverOptions& options,
+	IncrementalState& state, unsigned int thread_count);
+
+// Runs the program in the bytecode VM instead of compiling it, its output goes to stdout.
+// Nothing is written to disk and no compiler is started.
+TranspileResult runFile(const std::string& source_fname, const DriverOptions& options);
+
+// Transpiles all jobs on thread_count worker threads. Each job gets its own lexer, parser
+// and visitor; results are returned in the order of jobs.
+std::vector<TranspileResult> transpileBatch(const std::vector<TranspileJob>& jobs, const CompilerConfig& config,
+	const DriverOptions& options, unsigned int thread_count);
+
+// Time reports of the results as a table per file, or as one JSON document for CI to collect.
+// Both end with the peak resident set size of this process.
+std::string formatTimeReport(const std::vector<TranspileJob>& jobs, const std::vector<TranspileResult>& results, bool json);
+
+// Builds the precompiled runtime header when it is missing or older than the header, or
+// the command has changed. Returns false and sets error when the command fails.
+bool buildPrecompiledHeader(const CompilerConfig& config, bool verbose, std::string& error);
+
+// Reads "<source> [target]" lines, blank lines and lines starting with # are skipped
+std::vector<TranspileJob> readManifest(const std::string& file_name);
+
+// Target name for a source without an explicit one: the source path without extension
+std::string defaultTargetName(const std::string& source_fname);
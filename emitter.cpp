@@ -0,0 +1,1091 @@
+#include "emitter.h"
+
+#include <algorithm>
+#include <cctype>
+#include <charconv>
+#include <cstdint>
+#include <cstring>
+#include <unordered_map>
+#include <unordered_set>
+
+#include <fmt/core.h>
+
+using ir::ExprKind;
+using ir::Op;
+using ir::StmtKind;
+
+namespace {
+
+// C++ precedence of the emitted expression, higher binds tighter
+int precedence(const ir::Expr& expr) {
+	switch (expr.kind) {
+	case ExprKind::Literal:
+		return expr.text.size() > 1 && expr.text[0] == '-' ? 15 : 16;
+	case ExprKind::Unary:
+		return 15;
+	case ExprKind::Assign:
+	case ExprKind::AssignElement:
+		return 2;
+	case ExprKind::Binary:
+		switch (expr.op) {
+		case Op::Pow:
+			return 16;
+		case Op::Mul:
+		case Op::Div:
+			return 13;
+		case Op::Mod:
+			// std::fmod for floats
+			return expr.type == Type::Float ? 16 : 13;
+		case Op::Add:
+		case Op::Sub:
+			return 12;
+		case Op::Lt:
+		case Op::Le:
+		case Op::Gt:
+		case Op::Ge:
+			return 10;
+		case Op::Eq:
+		case Op::Ne:
+			return 9;
+		case Op::And:
+			return 5;
+		case Op::Or:
+			return 4;
+		default:
+			return 16;
+		}
+	default:
+		return 16;
+	}
+}
+
+// Name of the statement in the profile report
+const char* statementName(const ir::Stmt& stmt) {
+	switch (stmt.kind) {
+	case StmtKind::Declare:
+	case StmtKind::DeclareArray:
+		return "declare";
+	case StmtKind::Eval:
+		return stmt.value->kind == ExprKind::Call ? "call" : stmt.value->kind == ExprKind::Val ? "val" : "assign";
+	case StmtKind::Print:
+		return "print";
+	case StmtKind::For:
+		return stmt.parallel ? "parallel" : "for";
+	case StmtKind::If:
+		return "if";
+	case StmtKind::Read:
+		return "read";
+	case StmtKind::Restore:
+		return "restore";
+	case StmtKind::Input:
+		return "input";
+	case StmtKind::Return:
+		return "return";
+	}
+	return "";
+}
+
+std::string_view spelling(Op op) {
+	switch (op) {
+	case Op::Add:
+		return " + ";
+	case Op::Sub:
+		return " - ";
+	case Op::Mul:
+		return " * ";
+	case Op::Div:
+		return " / ";
+	case Op::Mod:
+		return " % ";
+	case Op::Eq:
+		return " == ";
+	case Op::Ne:
+		return " != ";
+	case Op::Lt:
+		return " < ";
+	case Op::Le:
+		return " <= ";
+	case Op::Gt:
+		return " > ";
+	case Op::Ge:
+		return " >= ";
+	case Op::And:
+		return " && ";
+	case Op::Or:
+		return " || ";
+	default:
+		return " ? ";
+	}
+}
+
+bool isStringLiteral(const ir::Expr& expr) {
+	return expr.kind == ExprKind::Literal && !expr.text.empty() && expr.text[0] == '"';
+}
+
+// Every statement and expression of the function is allowed in a C++17 constexpr function,
+// callees aside: numbers only, initialized variables, no runtime calls but ipow. Called
+// functions are returned in callees.
+bool constexprBody(const ir::Function& function, std::vector<std::string>& callees) {
+	auto number = [](Type type) { return type == Type::Int || type == Type::Float || type == Type::Bool; };
+	bool ok = number(function.result) && std::all_of(function.args.begin(), function.args.end(),
+		[&](const ir::Argument& arg) { return number(arg.type); });
+	for (const auto& stmt : function.body) {
+		ir::forEachStmt(*stmt, [&](const ir::Stmt& s) {
+			switch (s.kind) {
+			case StmtKind::Declare:
+				ok = ok && s.value && number(s.var_type);
+				break;
+			case StmtKind::For:
+				ok = ok && !s.parallel;
+				break;
+			case StmtKind::Eval:
+			case StmtKind::If:
+				break;
+			case StmtKind::Return:
+				ok = ok && s.value;
+				break;
+			default:
+				ok = false;
+			}
+			ir::forEachOwnExpr(s, [&](const ir::Expr& expr) {
+				ir::forEachExpr(expr, [&](const ir::Expr& e) {
+					bool runtime = e.kind == ExprKind::Val || e.kind == ExprKind::Index || e.kind == ExprKind::AssignElement
+						|| (e.kind == ExprKind::Binary && e.type == Type::Float && (e.op == Op::Pow || e.op == Op::Mod));
+					ok = ok && number(e.type) && !runtime;
+					if (e.kind == ExprKind::Call) {
+						callees.push_back(e.name.str());
+					}
+				});
+			});
+		});
+	}
+	return ok;
+}
+
+// Any bytes as C++ string literals, split into lines of line_bytes
+void appendStringLiteral(CodeBuffer& out, std::string_view bytes, size_t line_bytes = SIZE_MAX) {
+	out << '"';
+	for (size_t i = 0; i < bytes.size(); i++) {
+		if (i > 0 && i % line_bytes == 0) {
+			out << "\"\n\"";
+		}
+		auto c = static_cast<unsigned char>(bytes[i]);
+		if (c >= 0x20 && c < 0x7f && c != '"' && c != '\\') {
+			out << char(c);
+		}
+		else {
+			// Always three digits, the next character can't extend the escape
+			out << fmt::format("\\{:03o}", c);
+		}
+	}
+	out << '"';
+}
+
+template <typename T>
+void appendBytes(std::string& blob, T value) {
+	char bytes[sizeof(T)];
+	std::memcpy(bytes, &value, sizeof(T));
+	blob.append(bytes, sizeof(T));
+}
+
+}
+
+std::string unescape(std::string_view literal) {
+	std::string bytes;
+	std::string_view text = literal.substr(1, literal.size() - 2);
+	for (size_t i = 0; i < text.size(); i++) {
+		if (text[i] != '\\' || i + 1 == text.size()) {
+			bytes.push_back(text[i]);
+			continue;
+		}
+		char c = text[++i];
+		if (c >= '0' && c <= '7') {
+			int value = 0;
+			for (int digits = 0; digits < 3 && i < text.size() && text[i] >= '0' && text[i] <= '7'; digits++, i++) {
+				value = value * 8 + (text[i] - '0');
+			}
+			i--;
+			bytes.push_back(char(value));
+			continue;
+		}
+		if (c == 'x') {
+			int value = 0;
+			while (i + 1 < text.size() && std::isxdigit(static_cast<unsigned char>(text[i + 1]))) {
+				char digit = text[++i];
+				value = value * 16 + (std::isdigit(static_cast<unsigned char>(digit)) ? digit - '0' : std::tolower(digit) - 'a' + 10);
+			}
+			bytes.push_back(char(value));
+			continue;
+		}
+		switch (c) {
+		case 'n':
+			bytes.push_back('\n');
+			break;
+		case 't':
+			bytes.push_back('\t');
+			break;
+		case 'r':
+			bytes.push_back('\r');
+			break;
+		case 'a':
+			bytes.push_back('\a');
+			break;
+		case 'b':
+			bytes.push_back('\b');
+			break;
+		case 'f':
+			bytes.push_back('\f');
+			break;
+		case 'v':
+			bytes.push_back('\v');
+			break;
+		default:
+			// \\, \', \" and \?
+			bytes.push_back(c);
+		}
+	}
+	return bytes;
+}
+
+DataTables splitData(const std::vector<ir::DataItem>& data) {
+	DataTables tables;
+	for (const auto& item : data) {
+		std::string_view text = item.text;
+		if (!text.empty() && text[0] == '+') {
+			text.remove_prefix(1);
+		}
+
+		if (item.type == Type::Int) {
+			int64_t value = 0;
+			std::from_chars(text.data(), text.data() + text.size(), value);
+			tables.tags.push_back(0);
+			tables.ints.push_back(int(value));
+		}
+		else if (item.type == Type::Float) {
+			tables.tags.push_back(1);
+			tables.float_texts.emplace_back(text);
+			tables.floats.push_back(float(std::stod(std::string(text))));
+		}
+		else {
+			tables.tags.push_back(2);
+			tables.str_pool += unescape(text);
+			tables.str_offsets.push_back(uint32_t(tables.str_pool.size()));
+		}
+	}
+	return tables;
+}
+
+std::string CppEmitter::cppType(Type type) {
+	switch (type) {
+	case Type::Int:
+		return "int";
+	case Type::Float:
+		return "float";
+	case Type::Str:
+		return "std::string";
+	case Type::Void:
+		return "void";
+	case Type::IntArray:
+		return "Array<int>";
+	case Type::FloatArray:
+		return "Array<float>";
+	case Type::StrArray:
+		return "Array<std::string>";
+	default:
+		return "auto";
+	}
+}
+
+std::string CppEmitter::variable(std::string_view name, bool internal) const {
+	return internal ? std::string(name) : fmt::format("_jagle_{}", name);
+}
+
+std::string CppEmitter::function(std::string_view name) const {
+	auto dot = name.find('.');
+	if (dot == std::string_view::npos) {
+		return "_func" + variable(name, false);
+	}
+	return fmt::format("{}::_func{}", moduleNamespace(name.substr(0, dot)), variable(name.substr(dot + 1), false));
+}
+
+std::string CppEmitter::moduleNamespace(std::string_view module) {
+	return fmt::format("_jagle_module_{}", module);
+}
+
+void CppEmitter::emitData(const std::vector<ir::DataItem>& items) {
+	if (items.empty()) {
+		data << "const DataTable _jagle_data = {};\n";
+		return;
+	}
+
+	DataTables tables = splitData(items);
+
+	// One string literal instead of an initializer per item, compiles much faster
+	if (items.size() >= data_blob_items) {
+		std::string blob;
+		for (size_t count : { tables.tags.size(), tables.ints.size(), tables.floats.size(), tables.str_offsets.size() - 1 }) {
+			appendBytes(blob, uint32_t(count));
+		}
+		blob.append(tables.tags.begin(), tables.tags.end());
+		for (int value : tables.ints) {
+			appendBytes(blob, value);
+		}
+		for (float value : tables.floats) {
+			appendBytes(blob, value);
+		}
+		for (uint32_t offset : tables.str_offsets) {
+			appendBytes(blob, offset);
+		}
+		blob += tables.str_pool;
+
+		data << "const char _jagle_data_blob[] =\n";
+		appendStringLiteral(data, blob, 64);
+		data << ";\n";
+		data << "const DataTable _jagle_data = data_blob(_jagle_data_blob);\n";
+		return;
+	}
+
+	auto join = [](const auto& values) {
+		std::string text;
+		for (const auto& value : values) {
+			text += text.empty() ? "" : ", ";
+			text += fmt::format("{}", value);
+		}
+		return text;
+	};
+
+	data << fmt::format("const unsigned char _jagle_data_tags[] = {{ {} }};\n", join(tables.tags));
+	std::string ints = "nullptr";
+	if (!tables.ints.empty()) {
+		data << fmt::format("const int _jagle_data_ints[] = {{ {} }};\n", join(tables.ints));
+		ints = "_jagle_data_ints";
+	}
+	std::string floats = "nullptr";
+	if (!tables.floats.empty()) {
+		data << fmt::format("const float _jagle_data_floats[] = {{ {} }};\n", join(tables.float_texts));
+		floats = "_jagle_data_floats";
+	}
+	std::string strs = "nullptr, nullptr";
+	if (tables.str_offsets.size() > 1) {
+		data << fmt::format("const uint32_t _jagle_data_str_offsets[] = {{ {} }};\n", join(tables.str_offsets));
+		data << "const char _jagle_data_str_pool[] = ";
+		appendStringLiteral(data, tables.str_pool);
+		data << ";\n";
+		strs = "_jagle_data_str_offsets, _jagle_data_str_pool";
+	}
+	data << fmt::format("const DataTable _jagle_data = {{ _jagle_data_tags, {}, {}, {}, {} }};\n", tables.tags.size(), ints,
+		floats, strs);
+}
+
+void CppEmitter::emit(const ir::Program& program, const FunctionLookup& lookup) {
+	emitData(program.data);
+
+	std::unordered_map<std::string, const char*> specifiers = functionSpecifiers(program);
+	for (const auto& function : program.functions) {
+		const EmittedFunction* reused = lookup ? lookup(function) : nullptr;
+		functions.push_back(reused ? *reused : emitFunction(function));
+		auto specifier = specifiers.find(function.name);
+
+		if (!func_decls.empty()) {
+			func_decls << "\n";
+		}
+		if (!func_bodies.empty()) {
+			func_bodies << "\n";
+		}
+		if (specifier != specifiers.end()) {
+			func_decls << specifier->second;
+			func_bodies << specifier->second;
+		}
+		func_decls << functions.back().decl;
+		func_bodies << functions.back().body;
+	}
+
+	out = &statements;
+	sites.clear();
+	sites_array = "_jagle_profile_sites_main";
+	if (profile) {
+		statements << "profile_start(argv[0]);\n";
+		statements << "ProfileCall _jagle_profile_call(_jagle_profile_main);\n";
+	}
+	emitBlock(program.main);
+	if (profile) {
+		main_profile = profileTables("main", "main");
+	}
+}
+
+std::unordered_map<std::string, const char*> CppEmitter::functionSpecifiers(const ir::Program& program) const {
+	std::unordered_map<std::string, const char*> specifiers;
+	// Profiled bodies start with the tables of their counters and update them
+	if (profile) {
+		return specifiers;
+	}
+
+	std::unordered_set<std::string> pure = ir::pureFunctions(program);
+	std::unordered_map<std::string, std::vector<std::string>> constant;
+	for (const auto& function : program.functions) {
+		// Modules are compiled on their own, the units calling an inline function would
+		// miss its definition. A memo func has its cache.
+		if (!pure.count(function.name) || !function.module.empty() || function.memo) {
+			continue;
+		}
+		specifiers[function.name] = "inline ";
+		std::vector<std::string> callees;
+		if (constexprBody(function, callees)) {
+			constant.emplace(function.name, std::move(callees));
+		}
+	}
+	// A constexpr function only calls constexpr functions
+	for (bool changed = true; changed;) {
+		changed = false;
+		for (auto it = constant.begin(); it != constant.end();) {
+			bool calls_other = std::any_of(it->second.begin(), it->second.end(),
+				[&](const std::string& callee) { return constant.count(callee) == 0; });
+			if (calls_other) {
+				it = constant.erase(it);
+				changed = true;
+			}
+			else {
+				++it;
+			}
+		}
+	}
+	for (const auto& entry : constant) {
+		specifiers[entry.first] = "constexpr ";
+	}
+	return specifiers;
+}
+
+std::string CppEmitter::profileTables(const std::string& name, const std::string& suffix) {
+	std::string tables = fmt::format("static ProfileSite _jagle_profile_sites_{}[{}] = {{", suffix, std::max<size_t>(sites.size(), 1));
+	for (size_t i = 0; i < sites.size(); i++) {
+		tables += fmt::format("{}\n\t{{ {}, {}, \"{}\" }}", i ? "," : "", sites[i].line, sites[i].column, sites[i].statement);
+	}
+	tables += fmt::format("\n}};\nstatic ProfileFunction _jagle_profile_{}(\"{}\", _jagle_profile_sites_{}, {});\n", suffix, name,
+		suffix, sites.size());
+	return tables;
+}
+
+std::string CppEmitter::getOutput() const {
+	CodeBuffer program;
+
+	program << "#include \"jagle.hpp\"\n";
+	program << "\n";
+
+	// Global data
+	program << "// Global data\n";
+	program << data.str();
+	program << "\n";
+
+	program << "// Function declarations\n";
+	program << func_decls.str() << "\n";
+	program << "\n";
+
+	program << "// Function declarations\n";
+	program << func_bodies.str() << "\n";
+	program << "\n";
+
+	program << main_profile;
+	program << "// Main program\n";
+	program << "int main(int argc, char* argv[]) {\n";
+
+
+	program << statements.str() << "\n";
+	program << "_jagle_out << '\\n'; // Temporary hack\n";  // Make sure that last line will cause (extra) linefeed
+	program << "\n" << "return 0;\n";
+	program << "}\n";
+
+	return program.release();
+}
+
+std::vector<TranslationUnit> CppEmitter::getUnits() const {
+	std::vector<TranslationUnit> units;
+
+	CodeBuffer main;
+	main << "#include \"jagle.hpp\"\n\n";
+	main << "// Global data\n" << data.str() << "\n";
+	// Without the inline and constexpr of the single program
+	std::string declarations;
+	for (const auto& function : functions) {
+		declarations += (declarations.empty() ? "" : "\n") + function.decl;
+	}
+	main << "// Function declarations\n" << declarations << "\n\n";
+	main << main_profile;
+	main << "// Main program\n";
+	main << "int main(int argc, char* argv[]) {\n";
+	main << statements.str() << "\n";
+	main << "_jagle_out << '\\n';\n";
+	main << "\n" << "return 0;\n";
+	main << "}\n";
+	units.push_back({ "main", main.release() });
+
+	for (const auto& function : functions) {
+		CodeBuffer unit;
+		unit << "#include \"jagle.hpp\"\n\n";
+		unit << "// Function declarations\n" << declarations << "\n\n";
+		unit << function.body;
+		units.push_back({ function.name, unit.release() });
+	}
+
+	return units;
+}
+
+std::vector<TranslationUnit> CppEmitter::getModuleUnits(const ir::Program& program) const {
+	auto header = [](const std::string& module) { return "module_" + module + ".hpp"; };
+	std::vector<TranslationUnit> units;
+
+	CodeBuffer main;
+	std::vector<std::string> main_includes;
+	main << "#include \"jagle.hpp\"\n";
+	for (const auto& module : program.imports) {
+		main << "#include \"" << header(module) << "\"\n";
+		main_includes.push_back("module_" + module);
+	}
+	main << "\n// Global data\n" << data.str() << "\n";
+	main << "// Function declarations\n";
+	for (const auto& function : functions) {
+		if (function.module.empty()) {
+			main << function.decl << "\n";
+		}
+	}
+	main << "\n// Function definitions\n";
+	for (const auto& function : functions) {
+		if (function.module.empty()) {
+			main << function.body << "\n";
+		}
+	}
+	main << main_profile;
+	main << "// Main program\n";
+	main << "int main(int argc, char* argv[]) {\n";
+	main << statements.str() << "\n";
+	main << "_jagle_out << '\\n';\n";
+	main << "\n" << "return 0;\n";
+	main << "}\n";
+	units.push_back({ "main", main.release(), "", main_includes });
+
+	for (const auto& module : program.modules) {
+		TranslationUnit unit;
+		unit.name = "module_" + module.name;
+
+		CodeBuffer declarations;
+		declarations << "#pragma once\n\n#include \"jagle.hpp\"\n\n";
+		CodeBuffer code;
+		code << "#include \"jagle.hpp\"\n#include \"" << header(module.name) << "\"\n";
+		for (const auto& imported : module.imports) {
+			code << "#include \"" << header(imported) << "\"\n";
+			unit.includes.push_back("module_" + imported);
+		}
+		code << "\n";
+		for (const auto& function : functions) {
+			if (function.module == module.name) {
+				declarations << function.decl << "\n";
+				code << function.body << "\n";
+			}
+		}
+		unit.header = declarations.release();
+		unit.code = code.release();
+		units.push_back(std::move(unit));
+	}
+
+	return units;
+}
+
+EmittedFunction CppEmitter::emitFunction(const ir::Function& function) {
+	CodeBuffer body;
+	CodeBuffer* enclosing = out;
+	out = &body;
+	// Internal names are numbered per function, they don't change with the other functions
+	int enclosing_counter = step_counter;
+	step_counter = 0;
+	sites.clear();
+	// The profile of a module function is named after both
+	std::string local_name = function.name.substr(function.module.empty() ? 0 : function.module.size() + 1);
+	std::string suffix = function.module.empty() ? "func_" + function.name : fmt::format("mod_{}_func_{}", function.module, local_name);
+	sites_array = "_jagle_profile_sites_" + suffix;
+
+	body << cppType(function.result) << " ";
+	size_t name_begin = body.size();
+	body << this->function(function.name);
+	size_t name_end = body.size();
+	body << "(";
+	for (size_t i = 0; i < function.args.size(); i++) {
+		if (i > 0) {
+			body << ", ";
+		}
+		// Arrays are passed by reference, the function works on the caller's elements
+		body << cppType(function.args[i].type) << (isArray(function.args[i].type) ? "& " : " ")
+			<< variable(function.args[i].name, false);
+	}
+	size_t arguments_end = body.size();
+	body << ") {\n";
+	if (profile) {
+		body << "ProfileCall _jagle_profile_call(_jagle_profile_" << suffix << ");\n";
+	}
+	if (function.memo) {
+		// The body runs in a lambda, its returns give the result to cache
+		std::string types = cppType(function.result);
+		std::string args;
+		for (const auto& arg : function.args) {
+			types += ", " + cppType(arg.type);
+			args += ", " + variable(arg.name, false);
+		}
+		body << fmt::format("static thread_local MemoCache<{}> _jagle_memo({});\n", types, memo_entries);
+		body << "return _jagle_memo.get([&]() -> " << cppType(function.result) << " {\n";
+		emitBlock(function.body);
+		body << "}" << args << ");\n";
+	}
+	else {
+		emitBlock(function.body);
+	}
+	body << "}\n";
+
+	out = enclosing;
+	step_counter = enclosing_counter;
+
+	EmittedFunction emitted;
+	emitted.name = function.name;
+	emitted.module = function.module;
+	std::string_view head(body.str());
+	if (function.module.empty()) {
+		emitted.decl = std::string(head.substr(0, arguments_end)) + ");";
+	}
+	else {
+		// Declared in the namespace of the module, defined with the qualified name
+		emitted.decl = fmt::format("namespace {} {{ {}_func{}{}); }}", moduleNamespace(function.module), head.substr(0, name_begin),
+			variable(local_name, false), head.substr(name_end, arguments_end - name_end));
+	}
+	emitted.body = profile ? profileTables(function.name, suffix) + body.release() : body.release();
+	return emitted;
+}
+
+void CppEmitter::emitBlock(const ir::Block& block) {
+	for (const auto& stmt : block) {
+		emitStmt(*stmt);
+	}
+}
+
+void CppEmitter::emitStmt(const ir::Stmt& stmt) {
+	if (profile) {
+		*out << "profile_at(" << sites_array << "[" << std::to_string(sites.size()) << "]);\n";
+		sites.push_back({ stmt.line, stmt.column, statementName(stmt) });
+	}
+
+	switch (stmt.kind) {
+	case StmtKind::Declare:
+		*out << cppType(stmt.var_type) << " " << variable(stmt.var, stmt.internal);
+		if (stmt.value) {
+			*out << " = ";
+			emitExpr(*stmt.value);
+		}
+		*out << (stmt.internal ? "; // internal\n" : ";\n");
+		break;
+
+	case StmtKind::DeclareArray:
+		*out << cppType(stmt.var_type) << " " << variable(stmt.var, stmt.internal) << "(";
+		emitExpr(*stmt.value);
+		*out << ");\n";
+		break;
+
+	case StmtKind::Eval:
+		if (!emitAppend(*stmt.value)) {
+			emitExpr(*stmt.value);
+		}
+		*out << ";\n";
+		break;
+
+	case StmtKind::Print:
+		// Buffered by the runtime, flushed before input and at exit
+		*out << "_jagle_out";
+		for (const auto& item : stmt.items) {
+			*out << " << ";
+			// Items must bind tighter than <<
+			emitExpr(*item, 12);
+		}
+		*out << (stmt.newline ? " << '\\n'; \n" : ";\n");
+		break;
+
+	case StmtKind::For:
+		emitFor(stmt);
+		break;
+
+	case StmtKind::If:
+		*out << "if (";
+		emitExpr(*stmt.value);
+		*out << ") {\n";
+		emitBlock(stmt.body);
+		*out << "}\n";
+		if (stmt.has_else) {
+			*out << "else {\n";
+			emitBlock(stmt.else_body);
+			*out << "}\n";
+		}
+		break;
+
+	case StmtKind::Read:
+		*out << "data_read(" << variable(stmt.var, stmt.internal) << ");\n";
+		break;
+
+	case StmtKind::Restore:
+		*out << "data_restore();\n";
+		break;
+
+	case StmtKind::Input:
+		*out << "prompt_input(" << stmt.prompt << ", " << variable(stmt.var, stmt.internal) << ", ";
+		if (stmt.value) {
+			*out << "true, ";
+			emitExpr(*stmt.value);
+			*out << ");\n";
+		}
+		else {
+			*out << "false);\n";
+		}
+		break;
+
+	case StmtKind::Return:
+		if (stmt.value) {
+			*out << "return ";
+			emitExpr(*stmt.value);
+			*out << ";\n";
+		}
+		else {
+			*out << "return;\n";
+		}
+		break;
+	}
+}
+
+void CppEmitter::emitFor(const ir::Stmt& stmt) {
+	if (stmt.parallel) {
+		emitParallelFor(stmt);
+		return;
+	}
+
+	std::string var_name = variable(stmt.var, stmt.internal);
+	const ir::Expr& to = *stmt.to;
+	const ir::Expr* step = stmt.step.get();
+
+	step_counter++;
+
+	// Limit is evaluated once before the loop, unless it is a plain number. Direction is
+	// known at transpile time when the step is missing or a literal.
+	bool hoist_to = !isNumericLiteral(to);
+	double step_value = 1;
+	bool constant_step = !step || isNumericLiteral(*step, &step_value);
+
+	// The start value is evaluated before the limit and the step, as the VM does
+	std::string from_var_name;
+	if ((hoist_to || !constant_step) && !isNumericLiteral(*stmt.from)) {
+		from_var_name = fmt::format("__jagle_from_{}", step_counter);
+		*out << "auto " << from_var_name << " = ";
+		emitExpr(*stmt.from);
+		*out << "; // internal\n";
+	}
+
+	std::string to_var_name;
+	if (hoist_to) {
+		to_var_name = fmt::format("__jagle_to_{}", step_counter);
+		*out << "auto " << to_var_name << " = ";
+		emitExpr(to);
+		*out << "; // internal\n";
+	}
+
+	std::string step_var_name;
+	if (!constant_step) {
+		step_var_name = fmt::format("__jagle_step_{}", step_counter);
+		*out << "auto " << step_var_name << " = ";
+		emitExpr(*step);
+		*out << "; // internal\n";
+	}
+
+	*out << "for (";
+	if (stmt.declares) {
+		*out << cppType(stmt.var_type) << " ";
+	}
+	*out << var_name << " = ";
+	if (from_var_name.empty()) {
+		emitExpr(*stmt.from, 2);
+	}
+	else {
+		*out << from_var_name;
+	}
+	*out << "; ";
+
+	if (constant_step) {
+		*out << var_name << (step_value >= 0 ? " <= " : " >= ");
+		if (to_var_name.empty()) {
+			emitExpr(to, 11);
+		}
+		else {
+			*out << to_var_name;
+		}
+	}
+	else if (to_var_name.empty()) {
+		*out << "(" << step_var_name << " >= 0 ? " << var_name << " <= ";
+		size_t to_begin = out->size();
+		emitExpr(to, 11);
+		size_t to_end = out->size();
+		*out << " : " << var_name << " >= ";
+		out->repeat(to_begin, to_end);
+		*out << ")";
+	}
+	else {
+		*out << "(" << step_var_name << " >= 0 ? " << var_name << " <= " << to_var_name
+			<< " : " << var_name << " >= " << to_var_name << ")";
+	}
+
+	*out << "; " << var_name << " += ";
+	if (!step) {
+		*out << "1";
+	}
+	else if (constant_step) {
+		emitExpr(*step, 2);
+	}
+	else {
+		*out << step_var_name;
+	}
+	*out << ") {\n";
+
+	emitBlock(stmt.body);
+	*out << "}\n";
+}
+
+void CppEmitter::emitParallelFor(const ir::Stmt& stmt) {
+	std::string var_name = variable(stmt.var, stmt.internal);
+	step_counter++;
+	std::string range = fmt::format("__jagle_range_{}", step_counter);
+
+	// Bounds are evaluated once, before any thread starts. The arguments of a call are
+	// evaluated in any order, from and to are evaluated first when they are not numbers.
+	std::string bounds[2];
+	const ir::Expr* bound_exprs[2] = { stmt.from.get(), stmt.to.get() };
+	for (int i = 0; i < 2; i++) {
+		if (!isNumericLiteral(*bound_exprs[i])) {
+			bounds[i] = fmt::format("__jagle_{}_{}", i == 0 ? "from" : "to", step_counter);
+			*out << "auto " << bounds[i] << " = ";
+			emitExpr(*bound_exprs[i]);
+			*out << "; // internal\n";
+		}
+	}
+	*out << "ParallelRange " << range << "(";
+	for (int i = 0; i < 2; i++) {
+		if (bounds[i].empty()) {
+			emitExpr(*bound_exprs[i], 2);
+		}
+		else {
+			*out << bounds[i];
+		}
+		*out << ", ";
+	}
+	if (stmt.step) {
+		emitExpr(*stmt.step, 2);
+	}
+	else {
+		*out << "1";
+	}
+	*out << "); // internal\n";
+
+	std::vector<std::string> partials;
+	for (const auto& reduction : stmt.reductions) {
+		partials.push_back(fmt::format("__jagle_{}_{}", reduction.var, step_counter));
+		*out << "std::vector<Partial<" << cppType(reduction.type) << ">> " << partials.back() << "(" << range
+			<< ".chunks()); // internal\n";
+	}
+
+	// Every chunk runs the loop over its own iterations, with its own copies of the
+	// reduction variables that shadow the shared ones
+	*out << range << ".run([&](int __jagle_first, int __jagle_last, unsigned __jagle_chunk) {\n";
+	for (const auto& reduction : stmt.reductions) {
+		std::string_view identity = reduction.op == Op::Mul ? "1" : reduction.type == Type::Str ? "\"\"" : "0";
+		*out << cppType(reduction.type) << " " << variable(reduction.var, false) << " = " << identity << ";\n";
+	}
+
+	double step_value = 1;
+	bool constant_step = !stmt.step || isNumericLiteral(*stmt.step, &step_value);
+	*out << "for (" << cppType(stmt.var_type) << " " << var_name << " = __jagle_first; ";
+	if (constant_step) {
+		*out << var_name << (step_value >= 0 ? " <= " : " >= ") << "__jagle_last";
+	}
+	else {
+		*out << "(" << range << ".step() >= 0 ? " << var_name << " <= __jagle_last : " << var_name << " >= __jagle_last)";
+	}
+	*out << "; " << var_name << " += ";
+	if (!stmt.step) {
+		*out << "1";
+	}
+	else if (constant_step) {
+		emitExpr(*stmt.step, 2);
+	}
+	else {
+		*out << range << ".step()";
+	}
+	*out << ") {\n";
+	emitBlock(stmt.body);
+	*out << "}\n";
+
+	for (size_t i = 0; i < stmt.reductions.size(); i++) {
+		*out << partials[i] << "[__jagle_chunk].value = " << variable(stmt.reductions[i].var, false) << ";\n";
+	}
+	*out << "});\n";
+
+	// Combined in chunk order, the same for every run with the same number of threads
+	for (size_t i = 0; i < stmt.reductions.size(); i++) {
+		std::string reduced = variable(stmt.reductions[i].var, false);
+		*out << "for (const auto& __jagle_partial : " << partials[i] << ") {\n";
+		*out << reduced << " = " << reduced << spelling(stmt.reductions[i].op) << "__jagle_partial.value;\n";
+		*out << "}\n";
+	}
+}
+
+void CppEmitter::emitExpr(const ir::Expr& expr, int min_precedence) {
+	bool parenthesize = precedence(expr) < min_precedence;
+	if (parenthesize) {
+		*out << "(";
+	}
+
+	switch (expr.kind) {
+	case ExprKind::Literal:
+		// -2147483648 would be a long in C++, the negation of a literal too big for int
+		if (expr.text == std::string_view("-2147483648")) {
+			*out << "(-2147483647 - 1)";
+		}
+		else {
+			*out << expr.text;
+		}
+		break;
+
+	case ExprKind::Variable:
+		*out << variable(expr.name, expr.internal);
+		break;
+
+	case ExprKind::Unary:
+		if (expr.op == Op::Not) {
+			*out << "!";
+			emitExpr(*expr.operands[0], 15);
+		}
+		else {
+			*out << (expr.op == Op::Plus ? "+(" : "-(");
+			emitExpr(*expr.operands[0]);
+			*out << ")";
+		}
+		break;
+
+	case ExprKind::Binary:
+		emitBinary(expr);
+		break;
+
+	case ExprKind::Call:
+		*out << function(expr.name) << "(";
+		for (size_t i = 0; i < expr.operands.size(); i++) {
+			if (i > 0) {
+				*out << ", ";
+			}
+			emitExpr(*expr.operands[i]);
+		}
+		*out << ")";
+		break;
+
+	case ExprKind::Val:
+		// The variant is only needed when the use does not fix the type
+		*out << (expr.type == Type::Int ? "val_int(" : expr.type == Type::Float ? "val_float(" : "val(");
+		emitExpr(*expr.operands[0]);
+		*out << ")";
+		break;
+
+	case ExprKind::Assign:
+		*out << variable(expr.name, expr.internal) << " = ";
+		emitExpr(*expr.operands[0], 2);
+		break;
+
+	case ExprKind::Index:
+		emitElement(expr);
+		break;
+
+	case ExprKind::AssignElement:
+		emitElement(expr);
+		*out << " = ";
+		emitExpr(*expr.operands[1], 2);
+		break;
+	}
+
+	if (parenthesize) {
+		*out << ")";
+	}
+}
+
+void CppEmitter::emitBinary(const ir::Expr& expr) {
+	const ir::Expr& lhs = *expr.operands[0];
+	const ir::Expr& rhs = *expr.operands[1];
+
+	// % is only defined for integers in C++, std::pow computes in floating point
+	if (expr.op == Op::Pow || (expr.op == Op::Mod && expr.type == Type::Float)) {
+		if (expr.op == Op::Pow) {
+			*out << (expr.type == Type::Int ? "ipow(" : "std::pow(");
+		}
+		else {
+			*out << "std::fmod(";
+		}
+		emitExpr(lhs);
+		*out << ", ";
+		emitExpr(rhs);
+		*out << ")";
+		return;
+	}
+
+	int own = precedence(expr);
+
+	// Two string literals can't be added, and would be compared as pointers
+	bool comparison = own == 9 || own == 10;
+	if (isStringLiteral(lhs) && (expr.op == Op::Add || comparison)) {
+		*out << "std::string(";
+		emitExpr(lhs);
+		*out << ")";
+	}
+	else {
+		emitExpr(lhs, own);
+	}
+
+	*out << spelling(expr.op);
+	// Operators are left associative
+	emitExpr(rhs, own + 1);
+}
+
+bool CppEmitter::emitAppend(const ir::Expr& expr) {
+	std::vector<const ir::Expr*> parts = ir::selfAppendParts(expr);
+	if (parts.empty()) {
+		return false;
+	}
+
+	*out << "str_append(" << variable(expr.name, expr.internal);
+	for (const ir::Expr* part : parts) {
+		*out << ", ";
+		emitExpr(*part, 2);
+	}
+	*out << ")";
+	return true;
+}
+
+void CppEmitter::emitElement(const ir::Expr& expr) {
+	*out << variable(expr.name, expr.internal) << (bounds_checks ? ".at(" : "[");
+	emitExpr(*expr.operands[0]);
+	*out << (bounds_checks ? ")" : "]");
+}
+
+bool CppEmitter::isNumericLiteral(const ir::Expr& expr, double* value) const {
+	double sign = 1;
+	const ir::Expr* literal = &expr;
+	if (expr.kind == ExprKind::Unary) {
+		if (expr.op == Op::Not) {
+			return false;
+		}
+		sign = expr.op == Op::Neg ? -1 : 1;
+		literal = expr.operands[0].get();
+	}
+
+	if (literal->kind != ExprKind::Literal || literal->text.empty() || literal->text[0] == '"') {
+		return false;
+	}
+
+	if (value) {
+		*value = sign * std::stod(literal->text.str());
+	}
+	return true;
+}
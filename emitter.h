@@ -0,0 +1,194 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "ir.h"
+
+// Bytes of a string literal as the C++ compiler would read them
+std::string unescape(std::string_view literal);
+
+// DATA split by type, as the runtime's DataTable has it
+struct DataTables {
+	std::vector<unsigned char> tags;
+	std::vector<int> ints;
+	// Literals as written and their values
+	std::vector<std::string> float_texts;
+	std::vector<float> floats;
+	std::vector<uint32_t> str_offsets{ 0 };
+	std::string str_pool;
+};
+
+DataTables splitData(const std::vector<ir::DataItem>& data);
+
+// Append-only buffer the generated C++ is written into while the IR is emitted.
+// Every node is emitted exactly once; fragments needed more than once are copied from
+// the already emitted text with repeat() instead of being generated again.
+class CodeBuffer {
+private:
+	std::string buf_;
+
+public:
+	size_t size() const {
+		return buf_.size();
+	}
+
+	bool empty() const {
+		return buf_.empty();
+	}
+
+	const std::string& str() const {
+		return buf_;
+	}
+
+	std::string release() {
+		return std::move(buf_);
+	}
+
+	// Append a copy of the already emitted range [begin, end).
+	void repeat(size_t begin, size_t end) {
+		// Grow first, the source range points into the buffer itself.
+		buf_.reserve(buf_.size() + (end - begin));
+		buf_.append(buf_.data() + begin, end - begin);
+	}
+
+	CodeBuffer& operator<<(std::string_view s) {
+		buf_.append(s);
+		return *this;
+	}
+
+	CodeBuffer& operator<<(char c) {
+		buf_.push_back(c);
+		return *this;
+	}
+};
+
+// C++ of one function: its declaration and its definition
+struct EmittedFunction {
+	std::string name;
+	// Module the function is defined in, empty for the main program
+	std::string module;
+	std::string decl;
+	std::string body;
+};
+
+// One source file of a program split for separate compilation
+struct TranslationUnit {
+	// "main", the Jagle name of the function the unit defines, or "module_" and the name
+	// of the module it defines
+	std::string name;
+	std::string code;
+	// Declarations of the functions of a module, name.hpp, for the units that import it
+	std::string header;
+	// Units whose header the code includes
+	std::vector<std::string> includes;
+};
+
+// Writes the IR out as C++. Parentheses are added from C++ operator precedence, the IR
+// has no grouping of its own.
+class CppEmitter {
+private:
+	int step_counter = 0;
+	// DATA with at least this many items is written as one binary blob
+	size_t data_blob_items;
+	// Array elements are accessed through the checked at(), operator[] otherwise
+	bool bounds_checks;
+	// Statements count their executions for the source-line profile
+	bool profile;
+	// Results a memo func caches at most
+	size_t memo_entries;
+
+	// Profile sites of the function being emitted, and the name of their array
+	struct ProfileSiteInfo {
+		size_t line;
+		size_t column;
+		const char* statement;
+	};
+	std::vector<ProfileSiteInfo> sites;
+	std::string sites_array;
+	// Profile sites of main
+	std::string main_profile;
+
+	CodeBuffer data;
+	CodeBuffer func_decls;
+	CodeBuffer func_bodies;
+	CodeBuffer statements;
+
+	// Buffer the statements are currently emitted into
+	CodeBuffer* out = &statements;
+	std::vector<EmittedFunction> functions;
+
+	void emitData(const std::vector<ir::DataItem>& items);
+	void emitBlock(const ir::Block& block);
+	void emitStmt(const ir::Stmt& stmt);
+	void emitFor(const ir::Stmt& stmt);
+	void emitParallelFor(const ir::Stmt& stmt);
+	EmittedFunction emitFunction(const ir::Function& function);
+	// Parenthesized when the expression binds looser than min_precedence
+	void emitExpr(const ir::Expr& expr, int min_precedence = 0);
+	void emitBinary(const ir::Expr& expr);
+	// s = s + a + b ... as an in-place append. Returns false when the statement is not one.
+	bool emitAppend(const ir::Expr& expr);
+	void emitElement(const ir::Expr& expr);
+	// Definitions of the profile sites and the ProfileFunction of main or a function
+	std::string profileTables(const std::string& name, const std::string& suffix);
+	// "constexpr " or "inline " of the pure functions of the main program, by name
+	std::unordered_map<std::string, const char*> functionSpecifiers(const ir::Program& program) const;
+
+	std::string variable(std::string_view name, bool internal) const;
+	// C++ name of a function, "module.function" is qualified with the namespace of the module
+	std::string function(std::string_view name) const;
+	static std::string moduleNamespace(std::string_view module);
+	bool isNumericLiteral(const ir::Expr& expr, double* value = nullptr) const;
+
+public:
+	static constexpr size_t DefaultDataBlobItems = 10000;
+	static constexpr size_t DefaultMemoEntries = 1 << 20;
+
+	explicit CppEmitter(size_t data_blob_items = DefaultDataBlobItems, bool bounds_checks = true, bool profile = false,
+		size_t memo_entries = DefaultMemoEntries)
+		: data_blob_items(data_blob_items), bounds_checks(bounds_checks), profile(profile), memo_entries(memo_entries) {}
+
+	// Text of a function emitted earlier that can be used as is, null to emit it
+	using FunctionLookup = std::function<const EmittedFunction*(const ir::Function&)>;
+
+	void emit(const ir::Program& program, const FunctionLookup& lookup = nullptr);
+
+	// Complete C++ program
+	std::string getOutput() const;
+
+	// The program as a unit with the data and main, and a unit per function. Every unit
+	// declares all functions, so a function body only changes its own unit.
+	std::vector<TranslationUnit> getUnits() const;
+
+	// The program as a unit with the data, main and the functions of the main program, and a
+	// unit per module in the order of program.modules. A module unit includes the headers of
+	// the modules it imports, so it changes only with its own source and their interfaces.
+	std::vector<TranslationUnit> getModuleUnits(const ir::Program& program) const;
+
+	static std::string cppType(Type type);
+
+	const std::string& getStatements() const {
+		return statements.str();
+	}
+
+	const std::string& getData() const {
+		return data.str();
+	}
+
+	const std::string& getFuncDecls() const {
+		return func_decls.str();
+	}
+
+	const std::string& getFuncBodies() const {
+		return func_bodies.str();
+	}
+
+	const std::vector<EmittedFunction>& getFunctions() const {
+		return functions;
+	}
+};
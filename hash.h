@@ -0,0 +1,37 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+#include "fmt/format.h"
+
+// 64-bit FNV-1a, used to content-address generated code and build artifacts
+class ContentHash {
+private:
+	uint64_t hash_ = 14695981039346656037ull;
+
+public:
+	ContentHash& update(std::string_view data) {
+		for (unsigned char c : data) {
+			hash_ ^= c;
+			hash_ *= 1099511628211ull;
+		}
+		return *this;
+	}
+
+	// Length-prefixed update, ("ab", "c") and ("a", "bc") hash differently
+	ContentHash& field(std::string_view data) {
+		update(std::to_string(data.size()));
+		update(":");
+		return update(data);
+	}
+
+	uint64_t value() const {
+		return hash_;
+	}
+
+	std::string hex() const {
+		return fmt::format("{:016x}", hash_);
+	}
+};
@@ -0,0 +1,209 @@
+#include "ir.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <unordered_map>
+
+namespace ir {
+
+namespace {
+
+// Operands of a chain of str +, left to right
+void concatOperands(const Expr& expr, std::vector<const Expr*>& operands) {
+	if (expr.kind == ExprKind::Binary && expr.op == Op::Add && expr.type == Type::Str) {
+		concatOperands(*expr.operands[0], operands);
+		concatOperands(*expr.operands[1], operands);
+		return;
+	}
+	operands.push_back(&expr);
+}
+
+}
+
+Arena::~Arena() {
+	for (auto it = destructors_.rbegin(); it != destructors_.rend(); ++it) {
+		it->destroy(it->object);
+	}
+}
+
+void* Arena::allocate(size_t size, size_t alignment) {
+	size_t padding = (alignment - reinterpret_cast<uintptr_t>(next_) % alignment) % alignment;
+	if (padding + size > left_) {
+		// Larger objects get a block of their own
+		size_t block_size = std::max(BlockSize, size + alignment);
+		blocks_.push_back(std::make_unique<char[]>(block_size));
+		bytes_ += block_size;
+		next_ = blocks_.back().get();
+		left_ = block_size;
+		padding = (alignment - reinterpret_cast<uintptr_t>(next_) % alignment) % alignment;
+	}
+	void* memory = next_ + padding;
+	next_ += padding + size;
+	left_ -= padding + size;
+	return memory;
+}
+
+Name Arena::intern(std::string_view text) {
+	if (text.empty()) {
+		return Name();
+	}
+	auto found = names_.find(text);
+	if (found != names_.end()) {
+		return Name(*found);
+	}
+	char* copy = static_cast<char*>(allocate(text.size(), 1));
+	std::copy(text.begin(), text.end(), copy);
+	return Name(*names_.insert(std::string_view(copy, text.size())).first);
+}
+
+ExprPtr clone(Arena& arena, const Expr& expr) {
+	auto copy = arena.make<Expr>(expr.kind, expr.type, expr.line);
+	copy->op = expr.op;
+	copy->text = expr.text;
+	copy->name = expr.name;
+	copy->internal = expr.internal;
+	for (const auto& operand : expr.operands) {
+		copy->operands.push_back(clone(arena, *operand));
+	}
+	return copy;
+}
+
+bool sameExpr(const Expr& a, const Expr& b) {
+	if (a.kind != b.kind || a.op != b.op || a.text != b.text || a.name != b.name || a.internal != b.internal
+		|| a.operands.size() != b.operands.size()) {
+		return false;
+	}
+	for (size_t i = 0; i < a.operands.size(); i++) {
+		if (!sameExpr(*a.operands[i], *b.operands[i])) {
+			return false;
+		}
+	}
+	return true;
+}
+
+bool isPure(const Expr& expr) {
+	bool pure = true;
+	forEachExpr(expr, [&](const Expr& e) {
+		if (e.kind == ExprKind::Call || e.kind == ExprKind::Assign || e.kind == ExprKind::Val || e.kind == ExprKind::Index
+			|| e.kind == ExprKind::AssignElement) {
+			pure = false;
+		}
+	});
+	return pure;
+}
+
+std::unordered_set<std::string> pureFunctions(const Program& program) {
+	// Candidates by their own statements, then drop the ones calling a function that isn't
+	// pure until none is left
+	std::unordered_map<std::string, std::vector<std::string>> calls;
+	for (const auto& function : program.functions) {
+		bool pure = std::none_of(function.args.begin(), function.args.end(),
+			[](const Argument& arg) { return isArray(arg.type); });
+		std::vector<std::string> callees;
+		for (const auto& stmt : function.body) {
+			forEachStmt(*stmt, [&](const Stmt& s) {
+				if (s.kind == StmtKind::Print || s.kind == StmtKind::Read || s.kind == StmtKind::Restore
+					|| s.kind == StmtKind::Input) {
+					pure = false;
+				}
+				forEachOwnExpr(s, [&](const Expr& expr) {
+					forEachExpr(expr, [&](const Expr& e) {
+						if (e.kind == ExprKind::Call) {
+							callees.push_back(e.name.str());
+						}
+					});
+				});
+			});
+		}
+		if (pure) {
+			calls.emplace(function.name, std::move(callees));
+		}
+	}
+
+	for (bool changed = true; changed;) {
+		changed = false;
+		for (auto it = calls.begin(); it != calls.end();) {
+			bool calls_impure = std::any_of(it->second.begin(), it->second.end(),
+				[&](const std::string& callee) { return calls.count(callee) == 0; });
+			if (calls_impure) {
+				it = calls.erase(it);
+				changed = true;
+			}
+			else {
+				++it;
+			}
+		}
+	}
+
+	std::unordered_set<std::string> pure;
+	for (const auto& entry : calls) {
+		pure.insert(entry.first);
+	}
+	return pure;
+}
+
+bool reads(const Stmt& stmt, std::string_view var) {
+	bool found = false;
+	forEachStmt(stmt, [&](const Stmt& s) {
+		// Loops compare and step their variable
+		if (s.kind == StmtKind::For && s.var == var) {
+			found = true;
+		}
+		forEachOwnExpr(s, [&](const Expr& expr) {
+			forEachExpr(expr, [&](const Expr& e) {
+				if ((e.kind == ExprKind::Variable || e.kind == ExprKind::Index) && e.name == var) {
+					found = true;
+				}
+			});
+		});
+	});
+	return found;
+}
+
+bool writes(const Stmt& stmt, std::string_view var) {
+	bool found = false;
+	forEachStmt(stmt, [&](const Stmt& s) {
+		bool sets_var = s.kind == StmtKind::Declare || s.kind == StmtKind::DeclareArray || s.kind == StmtKind::For
+			|| s.kind == StmtKind::Read || s.kind == StmtKind::Input;
+		if (sets_var && s.var == var) {
+			found = true;
+		}
+		forEachOwnExpr(s, [&](const Expr& expr) {
+			forEachExpr(expr, [&](const Expr& e) {
+				if ((e.kind == ExprKind::Assign || e.kind == ExprKind::AssignElement) && e.name == var) {
+					found = true;
+				}
+			});
+		});
+	});
+	return found;
+}
+
+std::vector<const Expr*> selfAppendParts(const Expr& expr) {
+	if (expr.kind != ExprKind::Assign || expr.type != Type::Str) {
+		return {};
+	}
+	std::vector<const Expr*> operands;
+	concatOperands(*expr.operands[0], operands);
+	const Expr& first = *operands[0];
+	if (operands.size() < 2 || first.kind != ExprKind::Variable || first.name != expr.name || first.internal != expr.internal) {
+		return {};
+	}
+
+	// The parts are appended one by one, none of them may see s change
+	for (size_t i = 1; i < operands.size(); i++) {
+		bool reads_target = false;
+		forEachExpr(*operands[i], [&](const Expr& e) {
+			if ((e.kind == ExprKind::Variable || e.kind == ExprKind::Assign) && e.name == expr.name) {
+				reads_target = true;
+			}
+		});
+		if (reads_target) {
+			return {};
+		}
+	}
+	operands.erase(operands.begin());
+	return operands;
+}
+
+}
@@ -0,0 +1,378 @@
+#pragma once
+
+#include <memory>
+#include <new>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <unordered_set>
+#include <vector>
+
+#include <fmt/format.h>
+
+#include "semantic.h"
+
+// Typed intermediate representation between the parse tree and the C++ emitter. It does
+// not depend on ANTLR, every node carries its source line and expressions their static
+// type (Unknown when the program was not analyzed). The nodes and their names live in the
+// Arena of the program.
+namespace ir {
+
+// Interned string of an Arena, valid as long as the arena is. Only arenas make them, the
+// empty name aside.
+class Name {
+private:
+	std::string_view text;
+
+	friend class Arena;
+	explicit Name(std::string_view text) : text(text) {}
+
+public:
+	Name() = default;
+
+	operator std::string_view() const {
+		return text;
+	}
+
+	std::string str() const {
+		return std::string(text);
+	}
+
+	bool empty() const {
+		return text.empty();
+	}
+
+	size_t size() const {
+		return text.size();
+	}
+
+	char operator[](size_t i) const {
+		return text[i];
+	}
+
+	friend bool operator==(Name a, Name b) {
+		return a.text == b.text;
+	}
+
+	friend bool operator==(Name a, std::string_view b) {
+		return a.text == b;
+	}
+
+	friend bool operator==(std::string_view a, Name b) {
+		return a == b.text;
+	}
+
+	friend bool operator!=(Name a, Name b) {
+		return a.text != b.text;
+	}
+
+	friend bool operator!=(Name a, std::string_view b) {
+		return a.text != b;
+	}
+
+	friend bool operator!=(std::string_view a, Name b) {
+		return a != b.text;
+	}
+};
+
+// Bump allocator of the nodes and names of a program. Nodes are constructed in large blocks
+// and destroyed with the arena, all at once; a node a pass replaces stays until then. Each
+// distinct name is stored once.
+class Arena {
+private:
+	struct Destructor {
+		void* object;
+		void (*destroy)(void*);
+	};
+
+	static constexpr size_t BlockSize = 64 * 1024;
+
+	std::vector<std::unique_ptr<char[]>> blocks_;
+	char* next_ = nullptr;
+	size_t left_ = 0;
+	size_t bytes_ = 0;
+	// Objects that are not trivially destructible, in the order they were made
+	std::vector<Destructor> destructors_;
+	std::unordered_set<std::string_view> names_;
+
+	void* allocate(size_t size, size_t alignment);
+
+public:
+	// Deleter of the nodes' unique_ptr: the node belongs to its parent, its memory to the arena
+	struct Owned {
+		void operator()(const void*) const {}
+	};
+
+	Arena() = default;
+	Arena(const Arena&) = delete;
+	Arena& operator=(const Arena&) = delete;
+	~Arena();
+
+	template <typename T, typename... Args>
+	std::unique_ptr<T, Owned> make(Args&&... args) {
+		T* object = new (allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+		if constexpr (!std::is_trivially_destructible_v<T>) {
+			destructors_.push_back({ object, [](void* p) { static_cast<T*>(p)->~T(); } });
+		}
+		return std::unique_ptr<T, Owned>(object);
+	}
+
+	Name intern(std::string_view text);
+
+	// Bytes of the blocks allocated so far
+	size_t bytes() const {
+		return bytes_;
+	}
+};
+
+enum class Op {
+	Add,
+	Sub,
+	Mul,
+	Div,
+	Mod,
+	Pow,
+	Eq,
+	Ne,
+	Lt,
+	Le,
+	Gt,
+	Ge,
+	And,
+	Or,
+	Not,
+	Neg,
+	Plus,
+};
+
+struct Expr;
+struct Stmt;
+using ExprPtr = std::unique_ptr<Expr, Arena::Owned>;
+using StmtPtr = std::unique_ptr<Stmt, Arena::Owned>;
+using Block = std::vector<StmtPtr>;
+
+enum class ExprKind {
+	// text is the literal as written, string literals with their quotes
+	Literal,
+	// name is the Jagle name, or the C++ name when internal
+	Variable,
+	// op with one operand
+	Unary,
+	// op with two operands
+	Binary,
+	// name is the function, operands are the arguments
+	Call,
+	// val() of the single operand
+	Val,
+	// name = operands[0], the value is the assigned value
+	Assign,
+	// Element operands[0] of the array name
+	Index,
+	// name[operands[0]] = operands[1], the value is the assigned value
+	AssignElement,
+};
+
+struct Expr {
+	ExprKind kind;
+	Type type = Type::Unknown;
+	size_t line = 0;
+	Op op = Op::Add;
+	// Compiler generated variable, emitted as is
+	bool internal = false;
+	Name text;
+	Name name;
+	std::vector<ExprPtr> operands;
+
+	Expr(ExprKind kind, Type type, size_t line) : kind(kind), type(type), line(line) {}
+};
+
+enum class StmtKind {
+	// var of var_type, initialized with value unless it is null (Nothing)
+	Declare,
+	// Array var of var_type with value elements
+	DeclareArray,
+	// value evaluated for its side effects: assignment, call or val()
+	Eval,
+	// items, a line feed after them when newline is set
+	Print,
+	// var from "from" to "to" by step (null for 1), declared by the loop when declares is set.
+	// A parallel loop runs its iterations on many threads, each with its own copy of the
+	// reduction variables.
+	For,
+	// if value then body else else_body
+	If,
+	Read,
+	Restore,
+	// var, prompt, default value (or null)
+	Input,
+	// value, null in functions without a result
+	Return,
+};
+
+// Variable of a parallel for that the threads' copies are combined into with op, Add or Mul
+struct Reduction {
+	Name var;
+	Op op = Op::Add;
+	Type type = Type::Unknown;
+};
+
+struct Stmt {
+	StmtKind kind;
+	size_t line = 0;
+	size_t column = 0;
+
+	Name var;
+	Type var_type = Type::Unknown;
+	// Compiler generated variable, emitted as is
+	bool internal = false;
+	ExprPtr value;
+
+	ExprPtr from;
+	ExprPtr to;
+	ExprPtr step;
+	bool declares = false;
+	bool parallel = false;
+	std::vector<Reduction> reductions;
+
+	std::vector<ExprPtr> items;
+	bool newline = true;
+
+	Block body;
+	Block else_body;
+	bool has_else = false;
+
+	Name prompt;
+
+	Stmt(StmtKind kind, size_t line) : kind(kind), line(line) {}
+};
+
+struct Argument {
+	std::string name;
+	Type type;
+};
+
+struct Function {
+	// "module.function" for the functions of imported modules
+	std::string name;
+	// Module the function is defined in, empty for the main program
+	std::string module;
+	// memo func, results are cached by the arguments
+	bool memo = false;
+	Type result = Type::Void;
+	std::vector<Argument> args;
+	Block body;
+	size_t line = 0;
+	// Definition as written, nested functions included. Identifies the function across
+	// edits of the rest of the file.
+	std::string source;
+};
+
+struct DataItem {
+	// Literal as written, with a leading - or + when it had one
+	std::string text;
+	Type type = Type::Unknown;
+};
+
+// Module the program imports, directly or through another module
+struct Module {
+	std::string name;
+	std::string source_fname;
+	// Modules it imports itself
+	std::vector<std::string> imports;
+};
+
+struct Program {
+	// The nodes and names of the program, and of the modules whose functions it took over
+	std::vector<std::unique_ptr<Arena>> arenas;
+	std::vector<DataItem> data;
+	// In the order their definitions end, nested functions before the enclosing one
+	std::vector<Function> functions;
+	Block main;
+	// Modules the main program imports
+	std::vector<std::string> imports;
+	// Every module of the program, each after the ones it imports
+	std::vector<Module> modules;
+
+	Program() {
+		arenas.push_back(std::make_unique<Arena>());
+	}
+
+	// Where the nodes of the program are made
+	Arena& arena() {
+		return *arenas.front();
+	}
+};
+
+ExprPtr clone(Arena& arena, const Expr& expr);
+
+// Same computation: kind, operator, names and literals of the whole tree
+bool sameExpr(const Expr& a, const Expr& b);
+
+// No side effects and can't fail: no calls, assignments, val() or array indexing
+bool isPure(const Expr& expr);
+
+// Functions whose result depends on their arguments alone and that have no effect
+// besides it: no PRINT, INPUT, READ or RESTORE, no array arguments whose elements they
+// could write, and calls of pure functions only. Functions can't see global variables.
+std::unordered_set<std::string> pureFunctions(const Program& program);
+
+// Calls f for every expression node of the tree, parents before children
+template <typename F>
+void forEachExpr(const Expr& expr, F&& f) {
+	f(expr);
+	for (const auto& operand : expr.operands) {
+		forEachExpr(*operand, f);
+	}
+}
+
+// Calls f for the expressions of the statement itself, not of nested blocks
+template <typename F>
+void forEachOwnExpr(const Stmt& stmt, F&& f) {
+	for (const Expr* expr : { stmt.value.get(), stmt.from.get(), stmt.to.get(), stmt.step.get() }) {
+		if (expr) {
+			f(*expr);
+		}
+	}
+	for (const auto& item : stmt.items) {
+		f(*item);
+	}
+}
+
+// Calls f for every statement of the tree, parents before children
+template <typename F>
+void forEachStmt(const Stmt& stmt, F&& f) {
+	f(stmt);
+	for (const Block* block : { &stmt.body, &stmt.else_body }) {
+		for (const auto& nested : *block) {
+			forEachStmt(*nested, f);
+		}
+	}
+}
+
+// Variable is read anywhere in the statement, nested blocks included. Indexing reads
+// the array.
+bool reads(const Stmt& stmt, std::string_view var);
+// Variable is assigned or declared anywhere in the statement, nested blocks included.
+// Assigning an element writes the array.
+bool writes(const Stmt& stmt, std::string_view var);
+
+// Parts a, b ... of a str assignment s = s + a + b ... that can be appended to s one by
+// one, none of them reads s. Empty when the assignment is not one.
+std::vector<const Expr*> selfAppendParts(const Expr& expr);
+
+}
+
+template <>
+struct fmt::formatter<ir::Name> : fmt::formatter<std::string_view> {
+	template <typename FormatContext>
+	auto format(ir::Name name, FormatContext& ctx) const {
+		return fmt::formatter<std::string_view>::format(name, ctx);
+	}
+};
+
+template <>
+struct std::hash<ir::Name> {
+	size_t operator()(ir::Name name) const {
+		return std::hash<std::string_view>()(name);
+	}
+};
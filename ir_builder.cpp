@@ -0,0 +1,363 @@
+#include "ir_builder.h"
+
+#include <algorithm>
+
+using ir::ExprKind;
+using ir::Op;
+using ir::StmtKind;
+
+ir::Program IrBuilder::build(JP::ProgContext* ctx) {
+	program = ir::Program();
+	block = &program.main;
+
+	for (const auto& stmtList : ctx->stmtList()) {
+		visit(stmtList);
+	}
+
+	return std::move(program);
+}
+
+Type IrBuilder::typeOf(antlr4::tree::ParseTree* ctx) const {
+	return semantic ? semantic->typeOf(ctx) : Type::Unknown;
+}
+
+Type IrBuilder::declaredType(JP::VariableTypeContext* ctx) {
+	if (ctx->INT_TYPE()) {
+		return Type::Int;
+	}
+	if (ctx->FLOAT_TYPE()) {
+		return Type::Float;
+	}
+	return Type::Str;
+}
+
+ir::Name IrBuilder::intern(std::string_view text) {
+	return program.arena().intern(text);
+}
+
+std::string IrBuilder::qualifiedName(const std::string& function) const {
+	return semantic ? semantic->qualifiedName(function) : function;
+}
+
+size_t IrBuilder::lineOf(antlr4::ParserRuleContext* ctx) {
+	return ctx->getStart()->getLine();
+}
+
+ir::ExprPtr IrBuilder::build(JP::ExpressionContext* ctx) {
+	return ir::ExprPtr(std::any_cast<ir::Expr*>(visit(ctx)));
+}
+
+std::any IrBuilder::release(ir::ExprPtr expr) {
+	return expr.release();
+}
+
+ir::Stmt& IrBuilder::add(StmtKind kind, antlr4::ParserRuleContext* ctx) {
+	block->push_back(program.arena().make<ir::Stmt>(kind, lineOf(ctx)));
+	block->back()->column = ctx->getStart()->getCharPositionInLine();
+	return *block->back();
+}
+
+void IrBuilder::buildBlock(JP::StmtListContext* ctx, ir::Block& target) {
+	ir::Block* enclosing = block;
+	block = &target;
+	visit(ctx);
+	block = enclosing;
+}
+
+ir::ExprPtr IrBuilder::binary(antlr4::ParserRuleContext* ctx, Op op, JP::ExpressionContext* lhs, JP::ExpressionContext* rhs) {
+	auto expr = program.arena().make<ir::Expr>(ExprKind::Binary, typeOf(ctx), lineOf(ctx));
+	expr->op = op;
+	expr->operands.push_back(build(lhs));
+	expr->operands.push_back(build(rhs));
+	return expr;
+}
+
+ir::ExprPtr IrBuilder::assignment(JP::VariableAssignmentContext* ctx) {
+	auto expr = program.arena().make<ir::Expr>(ExprKind::Assign, typeOf(ctx), lineOf(ctx));
+	expr->name = intern(ctx->identifier()->getText());
+	expr->operands.push_back(build(ctx->expression()));
+	return expr;
+}
+
+ir::ExprPtr IrBuilder::elementAssignment(JP::ElementAssignmentContext* ctx) {
+	auto expr = program.arena().make<ir::Expr>(ExprKind::AssignElement, typeOf(ctx), lineOf(ctx));
+	expr->name = intern(ctx->identifier()->getText());
+	expr->operands.push_back(build(ctx->expression(0)));
+	expr->operands.push_back(build(ctx->expression(1)));
+	return expr;
+}
+
+ir::ExprPtr IrBuilder::call(JP::FuncCallContext* ctx) {
+	auto expr = program.arena().make<ir::Expr>(ExprKind::Call, typeOf(ctx), lineOf(ctx));
+	expr->name = intern(qualifiedName(ctx->identifier()->getText()));
+	if (auto params = ctx->paramList()) {
+		for (auto param : params->expression()) {
+			expr->operands.push_back(build(param));
+		}
+	}
+	return expr;
+}
+
+ir::ExprPtr IrBuilder::func(JP::FuncContext* ctx) {
+	// val() is the only built-in function
+	auto val_func = dynamic_cast<JP::ValFuncContext*>(ctx);
+	auto expr = program.arena().make<ir::Expr>(ExprKind::Val, typeOf(val_func), lineOf(val_func));
+	expr->operands.push_back(build(val_func->expression()));
+	return expr;
+}
+
+// Statements
+
+std::any IrBuilder::visitVariableDeclStmt(JP::VariableDeclStmtContext* ctx) {
+	JP::VariableDeclContext* decl = ctx->variableDecl();
+	ir::Stmt& stmt = add(StmtKind::Declare, ctx);
+	stmt.var = intern(decl->identifier()->getText());
+	stmt.var_type = declaredType(decl->variableType());
+
+	auto literal_expr = dynamic_cast<JP::LiteralExpressionContext*>(decl->expression());
+	if (!literal_expr || !literal_expr->literal()->NOTHING()) {
+		stmt.value = build(decl->expression());
+	}
+	return std::any();
+}
+
+std::any IrBuilder::visitArrayDeclStmt(JP::ArrayDeclStmtContext* ctx) {
+	JP::ArrayDeclContext* decl = ctx->arrayDecl();
+	ir::Stmt& stmt = add(StmtKind::DeclareArray, ctx);
+	stmt.var = intern(decl->identifier()->getText());
+	stmt.var_type = arrayOf(declaredType(decl->variableType()));
+	stmt.value = build(decl->expression());
+	return std::any();
+}
+
+std::any IrBuilder::visitVariableAssignmentStmt(JP::VariableAssignmentStmtContext* ctx) {
+	add(StmtKind::Eval, ctx).value = assignment(ctx->variableAssignment());
+	return std::any();
+}
+
+std::any IrBuilder::visitElementAssignmentStmt(JP::ElementAssignmentStmtContext* ctx) {
+	add(StmtKind::Eval, ctx).value = elementAssignment(ctx->elementAssignment());
+	return std::any();
+}
+
+std::any IrBuilder::visitPrintStmt(JP::PrintStmtContext* ctx) {
+	ir::Stmt& stmt = add(StmtKind::Print, ctx);
+
+	if (JP::PrintListContext* print_list = ctx->printList()) {
+		for (auto expr : print_list->expression()) {
+			stmt.items.push_back(build(expr));
+		}
+		// A trailing separator leaves the line open
+		stmt.newline = !dynamic_cast<antlr4::tree::TerminalNode*>(print_list->children.back());
+	}
+	return std::any();
+}
+
+std::any IrBuilder::visitForStmt(JP::ForStmtContext* ctx) {
+	ir::Stmt& stmt = add(StmtKind::For, ctx);
+
+	if (auto variable_decl = ctx->variableDecl()) {
+		stmt.declares = true;
+		stmt.var = intern(variable_decl->identifier()->getText());
+		stmt.var_type = declaredType(variable_decl->variableType());
+		stmt.from = build(variable_decl->expression());
+	}
+	else {
+		auto variable_assign = ctx->variableAssignment();
+		stmt.var = intern(variable_assign->identifier()->getText());
+		stmt.var_type = typeOf(variable_assign);
+		stmt.from = build(variable_assign->expression());
+	}
+
+	stmt.to = build(ctx->expression(0));
+	if (ctx->STEP()) {
+		stmt.step = build(ctx->expression(1));
+	}
+
+	stmt.parallel = ctx->PARALLEL() != nullptr;
+	for (auto reduce : ctx->reduceClause()) {
+		stmt.reductions.push_back({ intern(reduce->identifier()->getText()), reduce->PLUS() ? Op::Add : Op::Mul, typeOf(reduce) });
+	}
+
+	buildBlock(ctx->stmtList(), stmt.body);
+	return std::any();
+}
+
+std::any IrBuilder::visitIfStmt(JP::IfStmtContext* ctx) {
+	ir::Stmt& stmt = add(StmtKind::If, ctx);
+	stmt.value = build(ctx->expression());
+	buildBlock(ctx->stmtList(0), stmt.body);
+
+	if (ctx->ELSE()) {
+		stmt.has_else = true;
+		buildBlock(ctx->stmtList(1), stmt.else_body);
+	}
+	return std::any();
+}
+
+std::any IrBuilder::visitDataStmt(JP::DataStmtContext* ctx) {
+	// DATA is global, it does not matter where the statement is
+	std::string unary;
+	for (const auto& child : ctx->dataList()->children) {
+		if (auto unary_node = dynamic_cast<JP::UnaryContext*>(child)) {
+			unary = unary_node->getText();
+		}
+		if (auto literal_node = dynamic_cast<JP::LiteralContext*>(child)) {
+			Type type = literal_node->STRINGLITERAL() ? Type::Str
+				: literal_node->FLOAT() || literal_node->getText().find('E') != std::string::npos ? Type::Float
+				: literal_node->NUMBER() ? Type::Int : Type::Nothing;
+			program.data.push_back({ unary + literal_node->getText(), type });
+			unary.clear();
+		}
+	}
+	return std::any();
+}
+
+std::any IrBuilder::visitReadStmt(JP::ReadStmtContext* ctx) {
+	add(StmtKind::Read, ctx).var = intern(ctx->identifier()->getText());
+	return std::any();
+}
+
+std::any IrBuilder::visitRestoreStmt(JP::RestoreStmtContext* ctx) {
+	add(StmtKind::Restore, ctx);
+	return std::any();
+}
+
+std::any IrBuilder::visitInputStmt(JP::InputStmtContext* ctx) {
+	ir::Stmt& stmt = add(StmtKind::Input, ctx);
+	stmt.var = intern(ctx->identifier()->getText());
+	stmt.prompt = intern(ctx->prompt ? ctx->prompt->getText() : "\"? \"");
+	if (auto default_expr = ctx->expression()) {
+		stmt.value = build(default_expr);
+	}
+	return std::any();
+}
+
+std::any IrBuilder::visitFuncDef(JP::FuncDefContext* ctx) {
+	ir::Function function;
+	function.name = qualifiedName(ctx->identifier()->getText());
+	if (auto dot = function.name.find('.'); dot != std::string::npos) {
+		function.module = function.name.substr(0, dot);
+	}
+	function.memo = ctx->MEMO() != nullptr;
+	function.line = lineOf(ctx);
+	function.source = ctx->getStart()->getInputStream()->getText(
+		antlr4::misc::Interval(ctx->getStart()->getStartIndex(), ctx->getStop()->getStopIndex()));
+	if (auto result_type = ctx->variableType()) {
+		function.result = declaredType(result_type);
+	}
+	if (auto args = ctx->argList()) {
+		for (auto arg : args->argument()) {
+			Type type = declaredType(arg->variableType());
+			function.args.push_back({ arg->identifier()->getText(), arg->LBRACKET() ? arrayOf(type) : type });
+		}
+	}
+
+	// Nested functions are completed, and stored, before the enclosing one
+	buildBlock(ctx->stmtList(), function.body);
+	program.functions.push_back(std::move(function));
+	return std::any();
+}
+
+std::any IrBuilder::visitFuncCallStmt(JP::FuncCallStmtContext* ctx) {
+	add(StmtKind::Eval, ctx).value = call(ctx->funcCall());
+	return std::any();
+}
+
+std::any IrBuilder::visitFuncStmt(JP::FuncStmtContext* ctx) {
+	add(StmtKind::Eval, ctx).value = func(ctx->func());
+	return std::any();
+}
+
+std::any IrBuilder::visitReturnStmt(JP::ReturnStmtContext* ctx) {
+	ir::Stmt& stmt = add(StmtKind::Return, ctx);
+	if (auto value = ctx->expression()) {
+		stmt.value = build(value);
+	}
+	return std::any();
+}
+
+std::any IrBuilder::visitImportStmt(JP::ImportStmtContext* ctx) {
+	// The modules of a program are loaded by the driver, the importing file only names them
+	auto name = ctx->identifier()->getText();
+	if (std::find(program.imports.begin(), program.imports.end(), name) == program.imports.end()) {
+		program.imports.push_back(name);
+	}
+	return std::any();
+}
+
+// Expressions
+
+std::any IrBuilder::visitFuncCallExpression(JP::FuncCallExpressionContext* ctx) {
+	return release(call(ctx->funcCall()));
+}
+
+std::any IrBuilder::visitFuncExpression(JP::FuncExpressionContext* ctx) {
+	return release(func(ctx->func()));
+}
+
+std::any IrBuilder::visitParenExpression(JP::ParenExpressionContext* ctx) {
+	// Grouping is implied by the tree, the emitter adds parentheses where C++ needs them
+	return release(build(ctx->expression()));
+}
+
+std::any IrBuilder::visitExponentExpression(JP::ExponentExpressionContext* ctx) {
+	return release(binary(ctx, Op::Pow, ctx->expression(0), ctx->expression(1)));
+}
+
+std::any IrBuilder::visitUnaryExpression(JP::UnaryExpressionContext* ctx) {
+	auto expr = program.arena().make<ir::Expr>(ExprKind::Unary, typeOf(ctx), lineOf(ctx));
+	expr->op = ctx->NOT() ? Op::Not : ctx->unary()->MINUS() ? Op::Neg : Op::Plus;
+	expr->operands.push_back(build(ctx->expression()));
+	return release(std::move(expr));
+}
+
+std::any IrBuilder::visitMultiplyingExpression(JP::MultiplyingExpressionContext* ctx) {
+	Op op = ctx->TIMES() ? Op::Mul : ctx->DIV() ? Op::Div : Op::Mod;
+	return release(binary(ctx, op, ctx->expression(0), ctx->expression(1)));
+}
+
+std::any IrBuilder::visitAddingExpression(JP::AddingExpressionContext* ctx) {
+	return release(binary(ctx, ctx->PLUS() ? Op::Add : Op::Sub, ctx->expression(0), ctx->expression(1)));
+}
+
+std::any IrBuilder::visitRelationalExpression(JP::RelationalExpressionContext* ctx) {
+	JP::RelopContext* relop = ctx->relop();
+	Op op = relop->EQ() ? Op::Eq : relop->NEQ() ? Op::Ne : relop->GTE() ? Op::Ge
+		: relop->LTE() ? Op::Le : relop->GT() ? Op::Gt : Op::Lt;
+	return release(binary(ctx, op, ctx->expression(0), ctx->expression(1)));
+}
+
+std::any IrBuilder::visitLogicalExpression(JP::LogicalExpressionContext* ctx) {
+	return release(binary(ctx, ctx->AND() ? Op::And : Op::Or, ctx->expression(0), ctx->expression(1)));
+}
+
+std::any IrBuilder::visitVariableAssignmentExpression(JP::VariableAssignmentExpressionContext* ctx) {
+	return release(assignment(ctx->variableAssignment()));
+}
+
+std::any IrBuilder::visitElementAssignmentExpression(JP::ElementAssignmentExpressionContext* ctx) {
+	return release(elementAssignment(ctx->elementAssignment()));
+}
+
+std::any IrBuilder::visitIndexExpression(JP::IndexExpressionContext* ctx) {
+	auto expr = program.arena().make<ir::Expr>(ExprKind::Index, typeOf(ctx), lineOf(ctx));
+	expr->name = intern(ctx->identifier()->getText());
+	expr->operands.push_back(build(ctx->expression()));
+	return release(std::move(expr));
+}
+
+std::any IrBuilder::visitIdentifierExpression(JP::IdentifierExpressionContext* ctx) {
+	auto expr = program.arena().make<ir::Expr>(ExprKind::Variable, typeOf(ctx), lineOf(ctx));
+	expr->name = intern(ctx->identifier()->getText());
+	return release(std::move(expr));
+}
+
+std::any IrBuilder::visitLiteralExpression(JP::LiteralExpressionContext* ctx) {
+	auto expr = program.arena().make<ir::Expr>(ExprKind::Literal, typeOf(ctx), lineOf(ctx));
+	// Nothing has no C++ spelling
+	if (!ctx->literal()->NOTHING()) {
+		expr->text = intern(ctx->literal()->getText());
+	}
+	return release(std::move(expr));
+}
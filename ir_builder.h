@@ -0,0 +1,76 @@
+#pragma once
+
+#include "antlr4-runtime.h"
+#include "JagleLexer.h"
+#include "JagleBaseVisitor.h"
+
+#include "ir.h"
+#include "semantic.h"
+
+// Lowers the parse tree into the IR. Expression types come from the semantic analyzer when
+// one is given, otherwise they are Unknown.
+class IrBuilder : public JagleBaseVisitor {
+private:
+	const SemanticAnalyzer* semantic = nullptr;
+	ir::Program program;
+
+	// Block the statement visits append to
+	ir::Block* block = &program.main;
+
+	Type typeOf(antlr4::tree::ParseTree* ctx) const;
+	static Type declaredType(JP::VariableTypeContext* ctx);
+	static size_t lineOf(antlr4::ParserRuleContext* ctx);
+	ir::Name intern(std::string_view text);
+	std::string qualifiedName(const std::string& function) const;
+
+	ir::ExprPtr build(JP::ExpressionContext* ctx);
+	ir::Stmt& add(ir::StmtKind kind, antlr4::ParserRuleContext* ctx);
+	void buildBlock(JP::StmtListContext* ctx, ir::Block& target);
+	// Expression visits return a released ir::Expr*, build() takes the ownership back
+	static std::any release(ir::ExprPtr expr);
+	ir::ExprPtr assignment(JP::VariableAssignmentContext* ctx);
+	ir::ExprPtr elementAssignment(JP::ElementAssignmentContext* ctx);
+	ir::ExprPtr call(JP::FuncCallContext* ctx);
+	ir::ExprPtr func(JP::FuncContext* ctx);
+	ir::ExprPtr binary(antlr4::ParserRuleContext* ctx, ir::Op op, JP::ExpressionContext* lhs, JP::ExpressionContext* rhs);
+
+public:
+	IrBuilder() = default;
+	explicit IrBuilder(const SemanticAnalyzer* semantic) : semantic(semantic) {}
+
+	ir::Program build(JP::ProgContext* ctx);
+
+	// Statements
+	std::any visitVariableDeclStmt(JP::VariableDeclStmtContext* ctx) override;
+	std::any visitArrayDeclStmt(JP::ArrayDeclStmtContext* ctx) override;
+	std::any visitVariableAssignmentStmt(JP::VariableAssignmentStmtContext* ctx) override;
+	std::any visitElementAssignmentStmt(JP::ElementAssignmentStmtContext* ctx) override;
+	std::any visitPrintStmt(JP::PrintStmtContext* ctx) override;
+	std::any visitForStmt(JP::ForStmtContext* ctx) override;
+	std::any visitIfStmt(JP::IfStmtContext* ctx) override;
+	std::any visitDataStmt(JP::DataStmtContext* ctx) override;
+	std::any visitReadStmt(JP::ReadStmtContext* ctx) override;
+	std::any visitRestoreStmt(JP::RestoreStmtContext* ctx) override;
+	std::any visitInputStmt(JP::InputStmtContext* ctx) override;
+	std::any visitFuncDef(JP::FuncDefContext* ctx) override;
+	std::any visitFuncCallStmt(JP::FuncCallStmtContext* ctx) override;
+	std::any visitFuncStmt(JP::FuncStmtContext* ctx) override;
+	std::any visitReturnStmt(JP::ReturnStmtContext* ctx) override;
+	std::any visitImportStmt(JP::ImportStmtContext* ctx) override;
+
+	// Expressions
+	std::any visitFuncCallExpression(JP::FuncCallExpressionContext* ctx) override;
+	std::any visitFuncExpression(JP::FuncExpressionContext* ctx) override;
+	std::any visitParenExpression(JP::ParenExpressionContext* ctx) override;
+	std::any visitExponentExpression(JP::ExponentExpressionContext* ctx) override;
+	std::any visitUnaryExpression(JP::UnaryExpressionContext* ctx) override;
+	std::any visitMultiplyingExpression(JP::MultiplyingExpressionContext* ctx) override;
+	std::any visitAddingExpression(JP::AddingExpressionContext* ctx) override;
+	std::any visitRelationalExpression(JP::RelationalExpressionContext* ctx) override;
+	std::any visitLogicalExpression(JP::LogicalExpressionContext* ctx) override;
+	std::any visitVariableAssignmentExpression(JP::VariableAssignmentExpressionContext* ctx) override;
+	std::any visitElementAssignmentExpression(JP::ElementAssignmentExpressionContext* ctx) override;
+	std::any visitIndexExpression(JP::IndexExpressionContext* ctx) override;
+	std::any visitIdentifierExpression(JP::IdentifierExpressionContext* ctx) override;
+	std::any visitLiteralExpression(JP::LiteralExpressionContext* ctx) override;
+};
@@ -1,113 +1,465 @@
 #pragma once
 
+// Jagle runtime used by the generated programs. Only declarations live here, the
+// functions are compiled once into the jagle_runtime library. Small functions used
+// in hot loops are the exception, they are inline.
+
+#include <algorithm>
+#include <atomic>
+#include <charconv>
 #include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <functional>
 #include <iostream>
-#include <sstream>
 #include <string>
+#include <string_view>
+#include <tuple>
 #include <variant>
 #include <vector>
 
-extern int _jagle_data_idx;
-extern std::variant<int, float, std::string> _jagle_data[];
+// Type of each DATA item
+enum class DataTag : unsigned char {
+    Int,
+    Float,
+    Str,
+};
 
-std::variant<int, float> val(const std::string& s) {
-    int int_val = std::stoi(s);
-    return (std::to_string(int_val) == s) ? int_val : std::stof(s);
-}
+// DATA of the program as typed tables: a tag per item, and the ints, floats and strings
+// in separate arrays. READ takes the next item and the next value of its type. Values
+// are copied out with memcpy, the arrays may point into an unaligned blob.
+struct DataTable {
+    const unsigned char* tags = nullptr;
+    size_t size = 0;
+    const void* ints = nullptr;
+    const void* floats = nullptr;
+    // One more than there are strings, string i is str_pool[offsets[i], offsets[i + 1])
+    const void* str_offsets = nullptr;
+    const char* str_pool = nullptr;
+};
 
-template <typename T, typename... Ts>
-std::ostream& operator<<(std::ostream& os, const std::variant<T, Ts...>& var) {
-    std::visit([&os](const auto& val) { os << val; }, var);
-    return os;
-}
+// Defined by the generated program
+extern const DataTable _jagle_data;
 
-void data_read(int& x) {
-    x = std::get<int>(_jagle_data[_jagle_data_idx]);
-    _jagle_data_idx++;
-}
+// READ and RESTORE use table instead of _jagle_data from now on. For programs that are
+// not compiled: jagle run executes them in its VM, which defines an empty _jagle_data.
+void data_use(const DataTable& table);
+
+// Tables of a binary DATA blob. The blob holds uint32 item, int, float and string
+// counts, then the tags, ints, floats, string offsets and string bytes.
+DataTable data_blob(const char* blob);
 
-void data_read(float& x) {
-    x = std::get<float>(_jagle_data[_jagle_data_idx]);
-    _jagle_data_idx++;
+// The whole of s as a number. Leading whitespace and a + sign are allowed, as with
+// std::cin >> value, anything after the number is not.
+template <typename T>
+bool parse_number(std::string_view s, T& value) {
+    size_t start = s.find_first_not_of(" \t\n\v\f\r");
+    if (start == std::string_view::npos) {
+        return false;
+    }
+    s.remove_prefix(start);
+    if (s.size() > 1 && s[0] == '+' && s[1] != '-') {
+        s.remove_prefix(1);
+    }
+    auto result = std::from_chars(s.data(), s.data() + s.size(), value);
+    return result.ec == std::errc() && result.ptr == s.data() + s.size();
 }
 
-void data_read(std::string& x) {
-    x = std::get<std::string>(_jagle_data[_jagle_data_idx]);
-    _jagle_data_idx++;
+// int when s is written exactly as an int is printed, float otherwise
+std::variant<int, float> val(const std::string& s);
+// The leading int exactly, like std::stoi. A fraction or an exponent is truncated.
+int val_int(const std::string& s);
+float val_float(const std::string& s);
+
+// int ^ int by squaring. Wraps around on overflow. Negative exponents give 0 unless
+// the base is 1 or -1, the way integer division truncates.
+constexpr int ipow(int base, int exp) {
+    if (exp < 0) {
+        if (base == 1 || base == -1) {
+            return exp % 2 == 0 ? 1 : base;
+        }
+        return 0;
+    }
+    unsigned int result = 1;
+    unsigned int factor = static_cast<unsigned int>(base);
+    while (exp > 0) {
+        if (exp & 1) {
+            result *= factor;
+        }
+        factor *= factor;
+        exp >>= 1;
+    }
+    return static_cast<int>(result);
 }
 
-void data_restore() {
-    _jagle_data_idx = 0;
+// s = s + a + b ... in place, without copying s. Room for all the parts is made at once,
+// at least doubling the capacity so that appending in a loop stays linear.
+template <typename... Parts>
+void str_append(std::string& s, const Parts&... parts) {
+    size_t size = (s.size() + ... + std::string_view(parts).size());
+    if (size > s.capacity()) {
+        s.reserve(std::max(size, 2 * s.capacity()));
+    }
+    (s.append(parts), ...);
 }
 
+// Report a bad array size or index and exit, out of line so that at() stays small
+[[noreturn]] void array_size_error(int size);
+[[noreturn]] void array_index_error(int index, size_t size);
+
+// Jagle array: one contiguous block of zero (or "") initialized elements. at() checks
+// the index, operator[] does not. The generated code uses operator[] when bounds checks
+// are turned off, which leaves the compiler free to vectorize loops over arrays.
+template <typename T>
+class Array {
+public:
+    explicit Array(int size) : elements_(checked_size(size)) {}
+
+    int size() const {
+        return static_cast<int>(elements_.size());
+    }
 
-void prompt_input(const std::string& prompt, int& variable, bool allow_empty, int default_value = 0) {
-    std::cout << prompt;
-    std::string input;
-    std::getline(std::cin, input);
+    T* data() {
+        return elements_.data();
+    }
 
-    if (input.empty()) {
-        if (allow_empty) {
-            variable = default_value;
-            return;
+    T& at(int index) {
+        if (index < 0 || static_cast<size_t>(index) >= elements_.size()) {
+            array_index_error(index, elements_.size());
         }
-        else {
-            std::cerr << "Input cannot be empty." << std::endl;
-            prompt_input(prompt, variable, allow_empty, default_value);
-            return;
+        return elements_[index];
+    }
+
+    T& operator[](int index) {
+        return elements_[index];
+    }
+
+private:
+    std::vector<T> elements_;
+
+    static size_t checked_size(int size) {
+        if (size < 0) {
+            array_size_error(size);
         }
+        return static_cast<size_t>(size);
     }
+};
+
+// Threads a parallel for runs on: JAGLE_THREADS when it is set, one per core otherwise
+unsigned parallel_threads();
+
+// Calls chunk(0) to chunk(chunks - 1) on the worker threads and the calling thread, and
+// returns when all of them have returned. Called from inside a chunk, by a nested
+// parallel for, it runs the chunks one after another on the current thread.
+void parallel_run(unsigned chunks, const std::function<void(unsigned)>& chunk);
+
+// One chunk's copy of a parallel for reduction variable, on a cache line of its own so
+// that the threads don't keep invalidating each other's
+template <typename T>
+struct alignas(64) Partial {
+    T value{};
+};
 
-    std::stringstream ss(input);
-    ss >> variable;
+// Iterations of a parallel for, from to to by step, split into chunks of consecutive
+// iterations. There are a few chunks per thread so that uneven iterations even out.
+class ParallelRange {
+public:
+    ParallelRange() = default;
+    ParallelRange(int from, double to, int step);
 
-    if (ss.fail() || !ss.eof()) {
-        std::cerr << "Invalid input. Please try again." << std::endl;
-        prompt_input(prompt, variable, allow_empty, default_value);
-        return;
+    unsigned chunks() const {
+        return chunks_;
+    }
+
+    int step() const {
+        return step_;
+    }
+
+    // First and last iteration of a chunk
+    int first(unsigned chunk) const {
+        return static_cast<int>(from_ + count_ * chunk / chunks_ * step_);
+    }
+
+    int last(unsigned chunk) const {
+        return static_cast<int>(from_ + (count_ * (chunk + 1) / chunks_ - 1) * step_);
+    }
+
+    // body(first, last, chunk) runs the iterations from first to last of one chunk
+    template <typename Body>
+    void run(Body&& body) const {
+        parallel_run(chunks_, [&](unsigned chunk) { body(first(chunk), last(chunk), chunk); });
     }
-}
 
-void prompt_input(const std::string& prompt, float& variable, bool allow_empty, float default_value = 0.0f) {
-    std::cout << prompt;
-    std::string input;
-    std::getline(std::cin, input);
+private:
+    int64_t from_ = 0;
+    int step_ = 1;
+    int64_t count_ = 0;
+    unsigned chunks_ = 0;
+};
 
-    if (input.empty()) {
-        if (allow_empty) {
-            variable = default_value;
-            return;
+// Results of a memo func by its arguments, in one flat open-addressing table. The table
+// doubles until it has max_entries slots (rounded up to a power of two), then a new result
+// takes the slot of an old one, so the memory stays bounded whatever the arguments. Each
+// thread has its own cache, a memo func may be called in a parallel for.
+template <typename Result, typename... Args>
+class MemoCache {
+public:
+    explicit MemoCache(size_t max_entries) {
+        while (capacity_ < max_entries) {
+            capacity_ *= 2;
         }
-        else {
-            std::cerr << "Input cannot be empty." << std::endl;
-            prompt_input(prompt, variable, allow_empty, default_value);
-            return;
+    }
+
+    // The cached result, or the one compute() returns, cached. Recursive calls made by
+    // compute() may add to the table meanwhile.
+    template <typename Compute>
+    Result get(Compute&& compute, const Args&... args) {
+        Key key(args...);
+        size_t hash = hashOf(key);
+        if (!slots_.empty()) {
+            for (size_t i = 0, slot = hash & mask(); i < MaxProbes && slots_[slot].used; i++, slot = (slot + 1) & mask()) {
+                if (slots_[slot].hash == hash && slots_[slot].key == key) {
+                    return slots_[slot].result;
+                }
+            }
         }
+        Result result = compute();
+        insert(std::move(key), hash, result);
+        return result;
+    }
+
+private:
+    using Key = std::tuple<Args...>;
+    struct Slot {
+        Key key{};
+        Result result{};
+        size_t hash = 0;
+        bool used = false;
+    };
+    // Lookups stop after this many slots, a full table is still searched in constant time
+    static constexpr size_t MaxProbes = 8;
+
+    std::vector<Slot> slots_;
+    size_t used_ = 0;
+    size_t capacity_ = 16;
+
+    size_t mask() const {
+        return slots_.size() - 1;
     }
 
-    std::stringstream ss(input);
-    ss >> variable;
+    static size_t hashOf(const Key& key) {
+        uint64_t hash = 0;
+        std::apply([&](const auto&... part) {
+            ((hash = (hash ^ std::hash<std::decay_t<decltype(part)>>()(part)) * 0x9e3779b97f4a7c15ull), ...);
+        }, key);
+        return static_cast<size_t>(hash ^ (hash >> 32));
+    }
+
+    // False when the probed slots are all taken by other keys
+    bool place(Key&& key, size_t hash, const Result& result) {
+        for (size_t i = 0, slot = hash & mask(); i < MaxProbes; i++, slot = (slot + 1) & mask()) {
+            Slot& s = slots_[slot];
+            if (!s.used || (s.hash == hash && s.key == key)) {
+                used_ += s.used ? 0 : 1;
+                s = { std::move(key), result, hash, true };
+                return true;
+            }
+        }
+        return false;
+    }
 
-    if (ss.fail() || !ss.eof()) {
-        std::cerr << "Invalid input. Please try again." << std::endl;
-        prompt_input(prompt, variable, allow_empty, default_value);
-        return;
+    void insert(Key&& key, size_t hash, const Result& result) {
+        if (slots_.size() < capacity_ && (used_ + 1) * 2 > slots_.size()) {
+            std::vector<Slot> old(std::max<size_t>(16, slots_.size() * 2));
+            old.swap(slots_);
+            used_ = 0;
+            // A result that finds no slot is computed again when it is needed
+            for (auto& slot : old) {
+                if (slot.used) {
+                    place(std::move(slot.key), slot.hash, slot.result);
+                }
+            }
+        }
+        if (!place(std::move(key), hash, result)) {
+            slots_[hash & mask()] = { std::move(key), result, hash, true };
+        }
     }
+};
+
+template <typename T, typename... Ts>
+std::ostream& operator<<(std::ostream& os, const std::variant<T, Ts...>& var) {
+    std::visit([&os](const auto& val) { os << val; }, var);
+    return os;
 }
 
-void prompt_input(const std::string& prompt, std::string& variable, bool allow_empty, const std::string& default_value = "") {
-    std::cout << prompt;
-    std::getline(std::cin, variable);
+// Output of PRINT. Collects everything in a large buffer and writes it to the file only
+// when the buffer is full, before input and at exit, instead of flushing every line.
+// Numbers are formatted with std::to_chars the way std::cout formats them by default.
+// Unbuffered writes every PRINT out at once, for interactive programs.
+class PrintBuffer {
+public:
+    explicit PrintBuffer(std::FILE* file, bool unbuffered = false) : file_(file), unbuffered_(unbuffered) {}
+
+    PrintBuffer(const PrintBuffer&) = delete;
+    PrintBuffer& operator=(const PrintBuffer&) = delete;
 
-    if (variable.empty()) {
-        if (allow_empty) {
-            variable = default_value;
-            return;
+    ~PrintBuffer() {
+        flush();
+    }
+
+    void flush() {
+        if (used_ > 0) {
+            std::fwrite(buf_, 1, used_, file_);
+            used_ = 0;
+        }
+        std::fflush(file_);
+    }
+
+    void write(const char* s, size_t size) {
+        if (size > sizeof(buf_) - used_) {
+            flush();
+            if (size > sizeof(buf_)) {
+                std::fwrite(s, 1, size, file_);
+                return;
+            }
         }
-        else {
-            std::cerr << "Input cannot be empty." << std::endl;
-            prompt_input(prompt, variable, allow_empty, default_value);
-            return;
+        std::memcpy(buf_ + used_, s, size);
+        used_ += size;
+        if (unbuffered_) {
+            flush();
         }
     }
-}
\ No newline at end of file
+
+    PrintBuffer& operator<<(std::string_view s) {
+        write(s.data(), s.size());
+        return *this;
+    }
+
+    PrintBuffer& operator<<(const char* s) {
+        return *this << std::string_view(s);
+    }
+
+    PrintBuffer& operator<<(const std::string& s) {
+        return *this << std::string_view(s);
+    }
+
+    PrintBuffer& operator<<(char c) {
+        write(&c, 1);
+        return *this;
+    }
+
+    // Printed as 1 and 0, like std::cout does
+    PrintBuffer& operator<<(bool b) {
+        return *this << (b ? '1' : '0');
+    }
+
+    PrintBuffer& operator<<(int i) {
+        char digits[16];
+        auto result = std::to_chars(digits, digits + sizeof(digits), i);
+        write(digits, result.ptr - digits);
+        return *this;
+    }
+
+    PrintBuffer& operator<<(float f) {
+        return formatFloat(f);
+    }
+
+    PrintBuffer& operator<<(double d) {
+        return formatFloat(d);
+    }
+
+    template <typename T, typename... Ts>
+    PrintBuffer& operator<<(const std::variant<T, Ts...>& var) {
+        std::visit([this](const auto& val) { *this << val; }, var);
+        return *this;
+    }
+
+private:
+    std::FILE* file_;
+    bool unbuffered_;
+    size_t used_ = 0;
+    char buf_[1 << 16];
+
+    // %g with 6 significant digits
+    template <typename T>
+    PrintBuffer& formatFloat(T value) {
+        char digits[32];
+        auto result = std::to_chars(digits, digits + sizeof(digits), value, std::chars_format::general, 6);
+        write(digits, result.ptr - digits);
+        return *this;
+    }
+};
+
+// PRINT writes here. Unbuffered when the JAGLE_UNBUFFERED environment variable is set
+// to anything but 0.
+extern PrintBuffer _jagle_out;
+
+void data_read(int& x);
+void data_read(float& x);
+void data_read(std::string& x);
+void data_restore();
+
+void prompt_input(const std::string& prompt, int& variable, bool allow_empty, int default_value = 0);
+void prompt_input(const std::string& prompt, float& variable, bool allow_empty, float default_value = 0.0f);
+void prompt_input(const std::string& prompt, std::string& variable, bool allow_empty, const std::string& default_value = "");
+
+// Source-line profile of programs built with --profile. Every statement has a site that
+// counts its executions and every function counts its calls. A profiling timer samples the
+// site each thread is at, every ProfileIntervalMicros of CPU time or the kernel's tick when
+// that is longer. There is no timer on Windows, only the counts.
+constexpr int ProfileIntervalMicros = 1000;
+
+struct ProfileSite {
+    int line;
+    int column;
+    // What the statement does: assign, call, print, for ...
+    const char* statement;
+    std::atomic<uint64_t> count;
+    std::atomic<uint64_t> samples;
+};
+
+// Sites of main or of one function. Registers itself for the report.
+class ProfileFunction {
+public:
+    ProfileFunction(const char* name, ProfileSite* sites, size_t site_count);
+
+    const char* name;
+    ProfileSite* sites;
+    size_t site_count;
+    std::atomic<uint64_t> calls{ 0 };
+};
+
+// Site the thread is at, the sampling timer counts it
+inline thread_local ProfileSite* _jagle_profile_site = nullptr;
+
+// A plain load and store, not a locked increment: concurrent iterations of a parallel
+// for may lose some counts, the program does not slow down
+inline void profile_count(std::atomic<uint64_t>& counter) {
+    counter.store(counter.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+}
+
+inline void profile_at(ProfileSite& site) {
+    profile_count(site.count);
+    _jagle_profile_site = &site;
+}
+
+// One call of a function. The caller's site is current again after the return.
+class ProfileCall {
+public:
+    explicit ProfileCall(ProfileFunction& function) : caller_(_jagle_profile_site) {
+        profile_count(function.calls);
+    }
+
+    ~ProfileCall() {
+        _jagle_profile_site = caller_;
+    }
+
+private:
+    ProfileSite* caller_;
+};
+
+// Starts the sampling timer. At exit the report is written next to the program, sorted
+// by the hottest lines, as program.profile.txt and program.profile.json.
+void profile_start(const char* program);
@@ -0,0 +1,595 @@
+#include "jagle.hpp"
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef _WIN32
+#include <io.h>
+#define isatty _isatty
+#define fileno _fileno
+#else
+#include <signal.h>
+#include <sys/time.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+bool unbufferedOutput() {
+    // stdin and stdout are used through stdio only, the C++ streams don't need to stay
+    // in step with it
+    std::ios::sync_with_stdio(false);
+    const char* unbuffered = std::getenv("JAGLE_UNBUFFERED");
+    return unbuffered && *unbuffered && std::string(unbuffered) != "0";
+}
+
+}
+
+PrintBuffer _jagle_out(stdout, unbufferedOutput());
+
+namespace {
+
+[[noreturn]] void val_error(const std::string& s) {
+    _jagle_out.flush();
+    std::cerr << "val: '" << s << "' is not a number" << std::endl;
+    std::exit(1);
+}
+
+// The number s starts with, like std::stof
+float leading_float(const std::string& s) {
+    std::string_view text = s;
+    size_t start = text.find_first_not_of(" \t\n\v\f\r");
+    if (start == std::string_view::npos) {
+        val_error(s);
+    }
+    text.remove_prefix(start);
+    if (text.size() > 1 && text[0] == '+' && text[1] != '-') {
+        text.remove_prefix(1);
+    }
+    float value;
+    auto result = std::from_chars(text.data(), text.data() + text.size(), value);
+    if (result.ec != std::errc()) {
+        val_error(s);
+    }
+    return value;
+}
+
+}
+
+std::variant<int, float> val(const std::string& s) {
+    // Only the text of a printed int: no sign, leading zeros or spaces
+    bool canonical = !s.empty() && s[0] != '0' && !(s[0] == '-' && (s.size() == 1 || s[1] == '0'));
+    int int_val;
+    auto result = std::from_chars(s.data(), s.data() + s.size(), int_val);
+    if ((canonical || s == "0") && result.ec == std::errc() && result.ptr == s.data() + s.size()) {
+        return int_val;
+    }
+    return leading_float(s);
+}
+
+[[noreturn]] void val_range_error(const std::string& s) {
+    _jagle_out.flush();
+    std::cerr << "val: '" << s << "' is out of range for an int" << std::endl;
+    std::exit(1);
+}
+
+int val_int(const std::string& s) {
+    // The leading int, exactly like std::stoi. Only a number with a fraction or an
+    // exponent goes through float, truncated toward zero.
+    std::string_view text = s;
+    size_t start = text.find_first_not_of(" \t\n\v\f\r");
+    if (start != std::string_view::npos) {
+        text.remove_prefix(start);
+        if (text.size() > 1 && text[0] == '+' && text[1] != '-') {
+            text.remove_prefix(1);
+        }
+        int value;
+        auto result = std::from_chars(text.data(), text.data() + text.size(), value);
+        bool more = result.ptr != text.data() + text.size() &&
+            (*result.ptr == '.' || *result.ptr == 'e' || *result.ptr == 'E');
+        if (result.ec == std::errc::result_out_of_range) {
+            val_range_error(s);
+        }
+        if (result.ec == std::errc() && !more) {
+            return value;
+        }
+    }
+    float value = leading_float(s);
+    // Also false for NaN
+    if (!(value >= -2147483648.0f && value < 2147483648.0f)) {
+        val_range_error(s);
+    }
+    return static_cast<int>(value);
+}
+
+float val_float(const std::string& s) {
+    return leading_float(s);
+}
+
+void array_size_error(int size) {
+    _jagle_out.flush();
+    std::cerr << "array size " << size << " is negative" << std::endl;
+    std::exit(1);
+}
+
+void array_index_error(int index, size_t size) {
+    _jagle_out.flush();
+    std::cerr << "array index " << index << " out of bounds, the array has " << size << " elements" << std::endl;
+    std::exit(1);
+}
+
+namespace {
+
+// Set while the thread runs a chunk of a parallel for
+thread_local bool in_parallel = false;
+
+// Worker threads started once, on the first parallel for. The thread that runs a parallel
+// for takes chunks too, so threads - 1 workers are started. Chunks are handed out under
+// the mutex, there are only a few per thread.
+class ThreadPool {
+public:
+    explicit ThreadPool(unsigned threads) {
+        for (unsigned i = 1; i < threads; i++) {
+            workers_.emplace_back([this]() { work(); });
+        }
+    }
+
+    void run(unsigned chunks, const std::function<void(unsigned)>& chunk) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        job_ = &chunk;
+        next_ = 0;
+        chunks_ = chunks;
+        pending_ = chunks;
+        work_ready_.notify_all();
+
+        while (next_ < chunks_) {
+            unsigned index = next_++;
+            lock.unlock();
+            runChunk(chunk, index);
+            lock.lock();
+            pending_--;
+        }
+        done_.wait(lock, [this]() { return pending_ == 0; });
+        job_ = nullptr;
+        chunks_ = 0;
+    }
+
+private:
+    std::vector<std::thread> workers_;
+    std::mutex mutex_;
+    std::condition_variable work_ready_;
+    std::condition_variable done_;
+    const std::function<void(unsigned)>* job_ = nullptr;
+    unsigned next_ = 0;
+    unsigned chunks_ = 0;
+    unsigned pending_ = 0;
+
+    static void runChunk(const std::function<void(unsigned)>& chunk, unsigned index) {
+        in_parallel = true;
+        chunk(index);
+        in_parallel = false;
+    }
+
+    void work() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        while (true) {
+            work_ready_.wait(lock, [this]() { return next_ < chunks_; });
+            unsigned index = next_++;
+            const auto& chunk = *job_;
+            lock.unlock();
+            runChunk(chunk, index);
+            lock.lock();
+            if (--pending_ == 0) {
+                done_.notify_all();
+            }
+        }
+    }
+};
+
+}
+
+unsigned parallel_threads() {
+    static const unsigned threads = []() {
+        const char* setting = std::getenv("JAGLE_THREADS");
+        int value = 0;
+        if (setting && parse_number(setting, value) && value > 0) {
+            return static_cast<unsigned>(value);
+        }
+        return std::max(1u, std::thread::hardware_concurrency());
+    }();
+    return threads;
+}
+
+void parallel_run(unsigned chunks, const std::function<void(unsigned)>& chunk) {
+    if (in_parallel || parallel_threads() == 1) {
+        for (unsigned index = 0; index < chunks; index++) {
+            chunk(index);
+        }
+        return;
+    }
+
+    // Never destroyed: a worker may still be running when the program exits on an error
+    static ThreadPool* pool = new ThreadPool(parallel_threads());
+    pool->run(chunks, chunk);
+}
+
+ParallelRange::ParallelRange(int from, double to, int step) : from_(from), step_(step) {
+    if (step == 0) {
+        _jagle_out.flush();
+        std::cerr << "parallel for step can't be 0" << std::endl;
+        std::exit(1);
+    }
+
+    double iterations = std::floor((to - from) / step) + 1;
+    count_ = iterations > 0 ? static_cast<int64_t>(iterations) : 0;
+    chunks_ = static_cast<unsigned>(std::min<int64_t>(count_, int64_t(parallel_threads()) * 4));
+}
+
+namespace {
+
+// Next item, and the next value of each type
+struct DataCursor {
+    size_t item = 0;
+    size_t ints = 0;
+    size_t floats = 0;
+    size_t strs = 0;
+} data_cursor;
+
+const char* type_names[] = { "int", "float", "str" };
+
+const DataTable* data_table = &_jagle_data;
+
+// Moves to the next item, which must be of the given type
+void data_next(DataTag tag) {
+    if (data_cursor.item >= data_table->size) {
+        _jagle_out.flush();
+        std::cerr << "READ past the end of DATA (" << data_table->size << " items)" << std::endl;
+        std::exit(1);
+    }
+    auto found = static_cast<DataTag>(data_table->tags[data_cursor.item]);
+    if (found != tag) {
+        _jagle_out.flush();
+        std::cerr << "READ of " << type_names[static_cast<int>(tag)] << ", DATA item " << data_cursor.item + 1
+                  << " is " << type_names[static_cast<int>(found)] << std::endl;
+        std::exit(1);
+    }
+    data_cursor.item++;
+}
+
+template <typename T>
+T data_value(const void* table, size_t index) {
+    T value;
+    std::memcpy(&value, static_cast<const char*>(table) + index * sizeof(T), sizeof(T));
+    return value;
+}
+
+}
+
+DataTable data_blob(const char* blob) {
+    DataTable table;
+    uint32_t ints = data_value<uint32_t>(blob, 1);
+    uint32_t floats = data_value<uint32_t>(blob, 2);
+    uint32_t strs = data_value<uint32_t>(blob, 3);
+    table.size = data_value<uint32_t>(blob, 0);
+
+    const char* p = blob + 4 * sizeof(uint32_t);
+    table.tags = reinterpret_cast<const unsigned char*>(p);
+    p += table.size;
+    table.ints = p;
+    p += ints * sizeof(int);
+    table.floats = p;
+    p += floats * sizeof(float);
+    table.str_offsets = p;
+    p += (strs + 1) * sizeof(uint32_t);
+    table.str_pool = p;
+    return table;
+}
+
+void data_read(int& x) {
+    data_next(DataTag::Int);
+    x = data_value<int>(data_table->ints, data_cursor.ints++);
+}
+
+void data_read(float& x) {
+    data_next(DataTag::Float);
+    x = data_value<float>(data_table->floats, data_cursor.floats++);
+}
+
+void data_read(std::string& x) {
+    data_next(DataTag::Str);
+    auto begin = data_value<uint32_t>(data_table->str_offsets, data_cursor.strs);
+    auto end = data_value<uint32_t>(data_table->str_offsets, data_cursor.strs + 1);
+    data_cursor.strs++;
+    // Reuses the capacity x already has
+    x.assign(data_table->str_pool + begin, end - begin);
+}
+
+void data_restore() {
+    data_cursor = DataCursor();
+}
+
+void data_use(const DataTable& table) {
+    data_table = &table;
+    data_restore();
+}
+
+namespace {
+
+// Lines of stdin. Pipes and files are read in large blocks, a terminal a line at a time
+// so that INPUT does not wait for more than one line.
+class InputReader {
+public:
+    InputReader() : interactive_(isatty(fileno(stdin))) {}
+
+    // Prompts are only shown on a terminal
+    bool interactive() const {
+        return interactive_;
+    }
+
+    // The next line without its line ending, false at the end of input
+    bool read_line(std::string& line) {
+        line.clear();
+        bool any = false;
+        while (true) {
+            if (pos_ == end_ && !fill()) {
+                return any;
+            }
+            any = true;
+            auto newline = static_cast<const char*>(std::memchr(buf_ + pos_, '\n', end_ - pos_));
+            if (!newline) {
+                line.append(buf_ + pos_, end_ - pos_);
+                pos_ = end_;
+                continue;
+            }
+            line.append(buf_ + pos_, newline - (buf_ + pos_));
+            pos_ = newline - buf_ + 1;
+            if (!line.empty() && line.back() == '\r') {
+                line.pop_back();
+            }
+            return true;
+        }
+    }
+
+private:
+    bool interactive_;
+    size_t pos_ = 0;
+    size_t end_ = 0;
+    char buf_[1 << 16];
+
+    bool fill() {
+        pos_ = 0;
+        if (interactive_) {
+            end_ = std::fgets(buf_, sizeof(buf_), stdin) ? std::strlen(buf_) : 0;
+        }
+        else {
+            end_ = std::fread(buf_, 1, sizeof(buf_), stdin);
+        }
+        return end_ > 0;
+    }
+};
+
+InputReader& input_reader() {
+    static InputReader reader;
+    return reader;
+}
+
+bool parse_input(const std::string& line, int& variable) {
+    return parse_number(line, variable);
+}
+
+bool parse_input(const std::string& line, float& variable) {
+    return parse_number(line, variable);
+}
+
+bool parse_input(const std::string& line, std::string& variable) {
+    variable = line;
+    return true;
+}
+
+// Asks until the line is valid. An empty line gives the default when there is one.
+template <typename T>
+void read_input(const std::string& prompt, T& variable, bool allow_empty, const T& default_value) {
+    InputReader& reader = input_reader();
+    std::string line;
+    while (true) {
+        if (reader.interactive()) {
+            _jagle_out << prompt;
+            _jagle_out.flush();
+        }
+
+        if (!reader.read_line(line)) {
+            if (allow_empty) {
+                variable = default_value;
+                return;
+            }
+            _jagle_out.flush();
+            std::cerr << "INPUT: no more input" << std::endl;
+            std::exit(1);
+        }
+
+        if (line.empty()) {
+            if (allow_empty) {
+                variable = default_value;
+                return;
+            }
+            std::cerr << "Input cannot be empty." << std::endl;
+            continue;
+        }
+
+        if (parse_input(line, variable)) {
+            return;
+        }
+        std::cerr << "Invalid input. Please try again." << std::endl;
+    }
+}
+
+}
+
+void prompt_input(const std::string& prompt, int& variable, bool allow_empty, int default_value) {
+    read_input(prompt, variable, allow_empty, default_value);
+}
+
+void prompt_input(const std::string& prompt, float& variable, bool allow_empty, float default_value) {
+    read_input(prompt, variable, allow_empty, default_value);
+}
+
+void prompt_input(const std::string& prompt, std::string& variable, bool allow_empty, const std::string& default_value) {
+    read_input(prompt, variable, allow_empty, default_value);
+}
+
+namespace {
+
+std::vector<ProfileFunction*>& profile_functions() {
+    static std::vector<ProfileFunction*> functions;
+    return functions;
+}
+
+std::string profile_program;
+// Also the samples outside of any site, in the runtime before main
+std::atomic<uint64_t> profile_samples{ 0 };
+
+#ifndef _WIN32
+void profile_sample(int) {
+    profile_samples.fetch_add(1, std::memory_order_relaxed);
+    if (ProfileSite* site = _jagle_profile_site) {
+        site->samples.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+#endif
+
+std::string json_string(std::string_view s) {
+    std::string quoted = "\"";
+    for (char c : s) {
+        if (c == '"' || c == '\\') {
+            quoted += '\\';
+            quoted += c;
+        }
+        else if (static_cast<unsigned char>(c) < 0x20) {
+            char escape[8];
+            std::snprintf(escape, sizeof(escape), "\\u%04x", c);
+            quoted += escape;
+        }
+        else {
+            quoted += c;
+        }
+    }
+    return quoted + "\"";
+}
+
+void profile_report() {
+#ifndef _WIN32
+    itimerval off = {};
+    setitimer(ITIMER_PROF, &off, nullptr);
+#endif
+
+    struct Line {
+        const ProfileFunction* function;
+        const ProfileSite* site;
+    };
+    std::vector<Line> lines;
+    for (const ProfileFunction* function : profile_functions()) {
+        for (size_t i = 0; i < function->site_count; i++) {
+            const ProfileSite& site = function->sites[i];
+            if (site.count || site.samples) {
+                lines.push_back({ function, &site });
+            }
+        }
+    }
+    // Hottest first, the counts decide between lines without samples
+    std::stable_sort(lines.begin(), lines.end(), [](const Line& a, const Line& b) {
+        if (a.site->samples != b.site->samples) {
+            return a.site->samples > b.site->samples;
+        }
+        if (a.site->count != b.site->count) {
+            return a.site->count > b.site->count;
+        }
+        return a.site->line < b.site->line;
+    });
+
+    // The timer fires at the kernel's tick at most, the samples are shares of the CPU time
+    double cpu_seconds = static_cast<double>(std::clock()) / CLOCKS_PER_SEC;
+    uint64_t total = profile_samples;
+    auto percent = [&](uint64_t samples) {
+        return total ? 100.0 * samples / total : 0.0;
+    };
+    auto function_samples = [](const ProfileFunction* function) {
+        uint64_t samples = 0;
+        for (size_t i = 0; i < function->site_count; i++) {
+            samples += function->sites[i].samples;
+        }
+        return samples;
+    };
+
+    std::vector<const ProfileFunction*> functions(profile_functions().begin(), profile_functions().end());
+    std::stable_sort(functions.begin(), functions.end(), [&](const ProfileFunction* a, const ProfileFunction* b) {
+        return function_samples(a) > function_samples(b);
+    });
+
+    std::string base = profile_program + ".profile";
+    if (std::FILE* text = std::fopen((base + ".txt").c_str(), "w")) {
+        std::fprintf(text, "Profile of %s: %llu samples in %.3f s of CPU time\n\n", profile_program.c_str(),
+            static_cast<unsigned long long>(total), cpu_seconds);
+        std::fprintf(text, "%10s  %-9s %14s %9s %7s  %s\n", "line:col", "statement", "count", "samples", "time", "function");
+        for (const Line& line : lines) {
+            std::string location = std::to_string(line.site->line) + ":" + std::to_string(line.site->column);
+            std::fprintf(text, "%10s  %-9s %14llu %9llu %6.1f%%  %s\n", location.c_str(), line.site->statement,
+                static_cast<unsigned long long>(line.site->count), static_cast<unsigned long long>(line.site->samples),
+                percent(line.site->samples), line.function->name);
+        }
+        std::fprintf(text, "\n%14s %9s %7s  %s\n", "calls", "samples", "time", "function");
+        for (const ProfileFunction* function : functions) {
+            uint64_t samples = function_samples(function);
+            std::fprintf(text, "%14llu %9llu %6.1f%%  %s\n", static_cast<unsigned long long>(function->calls.load()),
+                static_cast<unsigned long long>(samples), percent(samples), function->name);
+        }
+        std::fclose(text);
+    }
+
+    if (std::FILE* json = std::fopen((base + ".json").c_str(), "w")) {
+        std::fprintf(json, "{\n  \"program\": %s,\n  \"cpu_seconds\": %.3f,\n  \"samples\": %llu,\n  \"lines\": [",
+            json_string(profile_program).c_str(), cpu_seconds, static_cast<unsigned long long>(total));
+        for (size_t i = 0; i < lines.size(); i++) {
+            const ProfileSite& site = *lines[i].site;
+            std::fprintf(json, "%s\n    { \"line\": %d, \"column\": %d, \"statement\": \"%s\", \"function\": %s, \"count\": %llu, \"samples\": %llu }",
+                i ? "," : "", site.line, site.column, site.statement, json_string(lines[i].function->name).c_str(),
+                static_cast<unsigned long long>(site.count.load()), static_cast<unsigned long long>(site.samples.load()));
+        }
+        std::fprintf(json, "\n  ],\n  \"functions\": [");
+        for (size_t i = 0; i < functions.size(); i++) {
+            std::fprintf(json, "%s\n    { \"name\": %s, \"calls\": %llu, \"samples\": %llu }", i ? "," : "",
+                json_string(functions[i]->name).c_str(), static_cast<unsigned long long>(functions[i]->calls.load()),
+                static_cast<unsigned long long>(function_samples(functions[i])));
+        }
+        std::fprintf(json, "\n  ]\n}\n");
+        std::fclose(json);
+    }
+}
+
+}
+
+ProfileFunction::ProfileFunction(const char* name, ProfileSite* sites, size_t site_count)
+    : name(name), sites(sites), site_count(site_count) {
+    profile_functions().push_back(this);
+}
+
+void profile_start(const char* program) {
+    profile_program = program;
+    std::atexit(profile_report);
+
+#ifndef _WIN32
+    struct sigaction action = {};
+    action.sa_handler = profile_sample;
+    action.sa_flags = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGPROF, &action, nullptr);
+    itimerval timer = { { 0, ProfileIntervalMicros }, { 0, ProfileIntervalMicros } };
+    setitimer(ITIMER_PROF, &timer, nullptr);
+#endif
+}
@@ -1,68 +1,268 @@
+#include <chrono>
 #include <iostream>
 #include <filesystem>
+#include <memory>
+#include <thread>
 
 #include <toml.hpp>
 #include <fmt/core.h>
 
 #include "CLI/CLI.hpp"
 
-#include "antlr4-runtime.h"
-#include "JagleLexer.h"
-#include "JagleParser.h"
-
-#include "visitor.h"
+#include "driver.h"
+#include "watch.h"
 
 int main(int argc, const char* argv[]) {
 	std::string source_fname;
 	std::string target_fname;
 	std::string config_fname = "jagle.toml";
+	std::string prediction = "auto";
+	std::vector<std::string> batch_fnames;
+	std::string manifest_fname;
+	unsigned int jobs = std::thread::hardware_concurrency();
+	bool no_compile = false;
+	bool no_cache = false;
+	bool echo = false;
+	std::vector<std::string> disabled_passes;
+	bool no_optimize = false;
+	bool no_bounds_check = false;
+	bool watch = false;
+	bool profile = false;
+	std::string time_report;
+	PgoTraining pgo;
 
 	CLI::App app{ "Jagle transpiler to C++" };
-	app.add_option("input file", source_fname, "Jagle source file to transpile")->required()->check(CLI::ExistingFile);
-	app.add_option("target name", target_fname, "A target name to build")->required();
+	app.add_option("input file", source_fname, "Jagle source file to transpile")->check(CLI::ExistingFile);
+	app.add_option("target name", target_fname, "A target name to build");
 	app.add_option("-c,--config", config_fname, "A configuration file. Defaults to jagle.toml")->check(CLI::ExistingFile);
+	app.add_option("--prediction", prediction, "Parser prediction mode: auto (SLL, LL on failure), sll or ll. Defaults to auto")
+		->check(CLI::IsMember({ "auto", "sll", "ll" }));
+	app.add_option("-b,--batch", batch_fnames, "Transpile many Jagle source files, each to a target named after the source")
+		->check(CLI::ExistingFile);
+	app.add_option("-m,--manifest", manifest_fname, "Transpile the files listed in a manifest, one '<source> [target]' per line")
+		->check(CLI::ExistingFile);
+	app.add_option("-j,--jobs", jobs,
+		"Worker threads for batch mode and for compiling the modules of a program. Defaults to the number of cores");
+	app.add_flag("--no-compile", no_compile, "Only generate the C++ sources");
+	app.add_flag("--no-cache", no_cache, "Always run the compiler, do not use the build cache");
+	app.add_flag("--echo", echo, "Print the generated C++ to stdout");
+
+	std::vector<std::string> pass_names;
+	for (const auto& pass : passPipeline()) {
+		pass_names.emplace_back(pass.name);
+	}
+	app.add_option("--disable-pass", disabled_passes, "Do not run an optimization pass, can be given many times")
+		->check(CLI::IsMember(pass_names));
+	app.add_flag("--no-optimize", no_optimize, "Do not run any optimization pass");
+	app.add_flag("--no-bounds-check", no_bounds_check, "Do not check array indexes at run time, for release builds");
+	app.add_option("--pgo", pgo.input, "Build with profile-guided optimization, training on this file as stdin")
+		->check(CLI::ExistingFile);
+	app.add_option("--pgo-args", pgo.args, "Command line arguments of the --pgo training run");
+	app.add_flag("--profile", profile, "Build a program that writes a profile of its Jagle source lines at exit");
+	app.add_flag("--time-report{text}", time_report,
+		"Print the time and CPU time of each build phase, the sizes and the peak memory use. "
+		"--time-report=json prints only a JSON document")
+		->check(CLI::IsMember({ "text", "json" }));
+	app.add_flag("-w,--watch", watch, "Rebuild whenever a source is saved, compiling only the functions that changed");
+
+	std::string run_fname;
+	CLI::App* run = app.add_subcommand("run", "Run a Jagle program in the bytecode VM, without compiling it");
+	run->add_option("input file", run_fname, "Jagle source file to run")->required()->check(CLI::ExistingFile);
+	// Options of the app, like --disable-pass, may follow the file name
+	run->fallthrough();
 
 	CLI11_PARSE(app, argc, argv);
 
-	std::string executable_fname(target_fname);
-	target_fname += ".cpp";
-	
+	DriverOptions options;
+	if (no_optimize) {
+		options.passes = PassOptions::none();
+	}
+	for (const auto& name : disabled_passes) {
+		setPass(options.passes, name, false);
+	}
+	if (prediction == "sll") {
+		options.prediction = PredictionMode::SLL;
+	}
+	else if (prediction == "ll") {
+		options.prediction = PredictionMode::LL;
+	}
+
+	// Needs neither the configuration nor a compiler. stdout is the program's.
+	if (*run) {
+		options.verbose = false;
+		TranspileResult result = runFile(run_fname, options);
+		if (!result.ok) {
+			std::cerr << run_fname << ": " << result.error << std::endl;
+			return 1;
+		}
+		return 0;
+	}
+
+	bool batch = !batch_fnames.empty() || !manifest_fname.empty();
+	if (!batch && (source_fname.empty() || target_fname.empty())) {
+		std::cout << "An input file and a target name are required (or --batch / --manifest)" << std::endl;
+		return 1;
+	}
+	if (!time_report.empty() && watch) {
+		std::cout << "--time-report is not available with --watch" << std::endl;
+		return 1;
+	}
+	if (!pgo.input.empty() && (batch || watch || no_compile)) {
+		std::cout << "--pgo builds a single program, without --batch, --manifest, --watch or --no-compile" << std::endl;
+		return 1;
+	}
+
 	// Configuration
 	auto config = toml::parse_file(config_fname);
 
-	bool compiler_keep_source = config["compiler"]["keep_source"].value_or(false);
-	std::string compiler_cmd(config["compiler"]["cmd"].value_or("g++"));
-	std::string cmd = fmt::format(compiler_cmd, fmt::arg("source", target_fname), fmt::arg("target", executable_fname));
-	
-	std::ifstream stream;
-	stream.open(source_fname);
-	if (!stream.is_open()) {
-		std::cout << "File '" << source_fname << "' does not exist!" << std::endl;
-		return 1;
+	CompilerConfig compiler;
+	compiler.keep_source = config["compiler"]["keep_source"].value_or(false);
+	compiler.pipe_source = config["compiler"]["pipe_source"].value_or(false);
+	compiler.cmd = std::string(config["compiler"]["cmd"].value_or("g++"));
+	compiler.output = std::string(config["compiler"]["output"].value_or("{target}"));
+	compiler.runtime_header = std::string(config["compiler"]["runtime_header"].value_or("jagle.hpp"));
+	compiler.runtime_library = std::string(config["compiler"]["runtime_library"].value_or("build/libjagle_runtime.a"));
+	compiler.unit_cmd = std::string(config["watch"]["unit_cmd"].value_or(compiler.unit_cmd));
+	compiler.link_cmd = std::string(config["watch"]["link_cmd"].value_or(compiler.link_cmd));
+	compiler.units_dir = std::string(config["watch"]["dir"].value_or(compiler.units_dir));
+	compiler.pgo_generate_flags = std::string(config["pgo"]["generate_flags"].value_or(compiler.pgo_generate_flags));
+	compiler.pgo_use_flags = std::string(config["pgo"]["use_flags"].value_or(compiler.pgo_use_flags));
+	compiler.pgo_dir = std::string(config["pgo"]["dir"].value_or(compiler.pgo_dir));
+	if (config["pch"]["enabled"].value_or(false)) {
+		compiler.pch_cmd = std::string(config["pch"]["cmd"].value_or("g++ -std=c++17 -x c++-header {header} -o {pch}"));
 	}
 
-	std::cout << "Parsing " << source_fname << " ..." << std::endl;
-	std::cout << "Generating" << target_fname << std::endl;
+	CacheConfig cache_config;
+	cache_config.enabled = config["cache"]["enabled"].value_or(false) && !no_cache;
+	cache_config.dir = std::string(config["cache"]["dir"].value_or(".jagle-cache"));
+	cache_config.max_size = config["cache"]["max_size_mb"].value_or(int64_t(512)) * 1024 * 1024;
 
-	antlr4::ANTLRInputStream input(stream);
-	jagle::JagleLexer lexer(&input);
-	antlr4::CommonTokenStream tokens(&lexer);
-	jagle::JagleParser parser(&tokens);
-	parser.setErrorHandler(std::make_shared<antlr4::BailErrorStrategy>());
+	options.compile = !no_compile;
+	options.data_blob_items = config["data"]["blob_items"].value_or(int64_t(CppEmitter::DefaultDataBlobItems));
+	options.memo_entries = config["memo"]["max_entries"].value_or(int64_t(CppEmitter::DefaultMemoEntries));
+	options.echo = echo;
+	options.bounds_checks = !no_bounds_check;
+	options.profile = profile;
+	// Batch mode builds the programs in parallel instead
+	options.jobs = batch ? 1 : std::max(1u, jobs);
+	// stdout is the report's alone
+	bool json_report = time_report == "json";
+	if (json_report) {
+		options.verbose = false;
+	}
+
+	std::unique_ptr<BuildCache> cache;
+	if (cache_config.enabled && options.compile) {
+		cache = std::make_unique<BuildCache>(cache_config);
+		options.cache = cache.get();
+	}
+
+	auto print_cache_stats = [&]() {
+		if (cache) {
+			cache->evict();
+		}
+		if (cache && !json_report) {
+			auto [size, entries] = cache->usage();
+			std::cout << fmt::format("Build cache: {} hits, {} misses, {} entries, {:.1f} MB in {}",
+				cache->hits(), cache->misses(), entries, size / (1024.0 * 1024.0), cache_config.dir) << std::endl;
+		}
+	};
+
+	// Compiles without the precompiled header when this fails, only slower
+	if (!compiler.pch_cmd.empty() && options.compile) {
+		std::string error;
+		if (!buildPrecompiledHeader(compiler, !batch && options.verbose, error)) {
+			std::cout << "Warning: " << error << std::endl;
+		}
+	}
+
+	std::vector<TranspileJob> batch_jobs;
+	if (!manifest_fname.empty()) {
+		batch_jobs = readManifest(manifest_fname);
+	}
+	for (const auto& fname : batch_fnames) {
+		batch_jobs.push_back({ fname, defaultTargetName(fname) });
+	}
 
-	antlr4::tree::ParseTree* tree = parser.prog();
+	// Runs until interrupted. Each function is compiled on its own, the build cache is not used.
+	if (watch) {
+		if (!batch) {
+			batch_jobs.push_back({ source_fname, target_fname });
+		}
+		options.verbose = false;
+		watchFiles(batch_jobs, compiler, options, std::max(1u, jobs));
+		return 0;
+	}
 
-	GeneratingVisitor visitor;
-	auto done = visitor.visit(tree);
+	if (!batch && !pgo.input.empty()) {
+		TranspileResult result = transpilePgo({ source_fname, target_fname }, compiler, options, pgo);
+		print_cache_stats();
+		if (!time_report.empty()) {
+			std::cout << formatTimeReport({ { source_fname, target_fname } }, { result }, json_report);
+		}
+		if (!result.ok) {
+			if (!json_report) {
+				std::cout << source_fname << ": " << result.error << std::endl;
+			}
+			return 1;
+		}
+		if (!result.profile_reused && !json_report) {
+			std::cout << fmt::format("Training run took {:.3f} s", result.training_seconds) << std::endl;
+		}
+		return 0;
+	}
 
-	// Compile to exe
-	if (done.has_value()) {
-		visitor.writeOutput(target_fname);
+	if (!batch) {
+		TranspileResult result = transpileFile({ source_fname, target_fname }, compiler, options);
+		print_cache_stats();
+		if (!time_report.empty()) {
+			std::cout << formatTimeReport({ { source_fname, target_fname } }, { result }, json_report);
+		}
+		if (!result.ok) {
+			if (!json_report) {
+				std::cout << source_fname << ": " << result.error << std::endl;
+			}
+			return 1;
+		}
+		return 0;
+	}
 
-		std::cout << "Compiling " << target_fname << " ..." << std::endl;
-		std::ostringstream msgbuf;
-		std::cout << cmd << std::endl;
-		system(cmd.c_str());
+	// Batch mode
+	options.verbose = false;
+	auto started = std::chrono::steady_clock::now();
+	auto results = transpileBatch(batch_jobs, compiler, options, std::max(1u, jobs));
+	double wall_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+
+	size_t failed = 0;
+	double serial_seconds = 0;
+	for (size_t i = 0; i < batch_jobs.size(); i++) {
+		const auto& result = results[i];
+		serial_seconds += result.seconds;
+		if (json_report) {
+			failed += result.ok ? 0 : 1;
+		}
+		else if (result.ok) {
+			std::cout << fmt::format("ok    {} -> {}.cpp ({:.1f} ms{})", batch_jobs[i].source_fname, batch_jobs[i].target_name,
+				result.seconds * 1000, result.cached ? ", cached" : "") << std::endl;
+		}
+		else {
+			failed++;
+			std::cout << fmt::format("FAIL  {}: {}", batch_jobs[i].source_fname, result.error) << std::endl;
+		}
 	}
-	return 0;
+
+	if (!time_report.empty()) {
+		std::cout << formatTimeReport(batch_jobs, results, json_report);
+	}
+	if (json_report) {
+		return failed ? 1 : 0;
+	}
+
+	// Sum of per-file times is what a single thread would have needed
+	std::cout << fmt::format("{} files, {} failed, {} jobs: {:.3f} s wall, {:.3f} s single-threaded, {:.2f}x",
+		batch_jobs.size(), failed, std::max(1u, jobs), wall_seconds, serial_seconds,
+		wall_seconds > 0 ? serial_seconds / wall_seconds : 1.0) << std::endl;
+	print_cache_stats();
+
+	return failed ? 1 : 0;
 }
@@ -0,0 +1,1045 @@
+#include "passes.h"
+
+#include <algorithm>
+#include <charconv>
+#include <climits>
+#include <cmath>
+#include <functional>
+#include <map>
+#include <optional>
+#include <set>
+#include <unordered_map>
+#include <unordered_set>
+
+#include <fmt/core.h>
+
+using ir::ExprKind;
+using ir::ExprPtr;
+using ir::Op;
+using ir::StmtKind;
+
+namespace {
+
+// Calls f(block, top_level) for every block of the program, nested blocks before the block
+// containing them. Top level blocks are the bodies of main and of the functions.
+void forEachBlock(ir::Block& block, bool top_level, const std::function<void(ir::Block&, bool)>& f) {
+	for (auto& stmt : block) {
+		forEachBlock(stmt->body, false, f);
+		forEachBlock(stmt->else_body, false, f);
+	}
+	f(block, top_level);
+}
+
+void forEachBlock(ir::Program& program, const std::function<void(ir::Block&, bool)>& f) {
+	for (auto& function : program.functions) {
+		forEachBlock(function.body, true, f);
+	}
+	forEachBlock(program.main, true, f);
+}
+
+template <typename F>
+void forEachOwnExprPtr(ir::Stmt& stmt, F&& f) {
+	for (ExprPtr* expr : { &stmt.value, &stmt.from, &stmt.to, &stmt.step }) {
+		if (*expr) {
+			f(*expr);
+		}
+	}
+	for (auto& item : stmt.items) {
+		f(item);
+	}
+}
+
+// Replaces every read of var in the tree with a copy of value
+void replaceReads(ir::Arena& arena, ExprPtr& expr, ir::Name var, const ir::Expr& value) {
+	if (expr->kind == ExprKind::Variable && expr->name == var && !expr->internal) {
+		size_t line = expr->line;
+		expr = ir::clone(arena, value);
+		expr->line = line;
+		return;
+	}
+	for (auto& operand : expr->operands) {
+		replaceReads(arena, operand, var, value);
+	}
+}
+
+void replaceReads(ir::Arena& arena, ir::Stmt& stmt, ir::Name var, const ir::Expr& value) {
+	forEachOwnExprPtr(stmt, [&](ExprPtr& expr) { replaceReads(arena, expr, var, value); });
+	for (ir::Block* block : { &stmt.body, &stmt.else_body }) {
+		for (auto& nested : *block) {
+			replaceReads(arena, *nested, var, value);
+		}
+	}
+}
+
+// Variable the statement stores a new value into as a whole, empty if none
+const ir::Name* storedVariable(const ir::Stmt& stmt) {
+	if (stmt.kind == StmtKind::Declare && stmt.value) {
+		return &stmt.var;
+	}
+	if (stmt.kind == StmtKind::Eval && stmt.value->kind == ExprKind::Assign) {
+		return &stmt.value->name;
+	}
+	return nullptr;
+}
+
+bool isNonZeroLiteral(const ir::Expr& expr, bool& non_zero) {
+	if (expr.kind != ExprKind::Literal || expr.text.empty() || expr.text[0] == '"') {
+		return false;
+	}
+	non_zero = std::stod(expr.text.str()) != 0;
+	return true;
+}
+
+// Copy propagation
+
+void propagateCopies(ir::Arena& arena, ir::Block& block) {
+	struct Copy {
+		ir::Name var;
+		ExprPtr value;
+	};
+	std::vector<Copy> copies;
+
+	for (auto& stmt : block) {
+		for (auto it = copies.begin(); it != copies.end();) {
+			const ir::Expr& value = *it->value;
+			bool source_written = value.kind == ExprKind::Variable && ir::writes(*stmt, value.name);
+			if (ir::writes(*stmt, it->var) || source_written) {
+				it = copies.erase(it);
+				continue;
+			}
+			replaceReads(arena, *stmt, it->var, value);
+			++it;
+		}
+
+		// x = y or x = literal of the same type starts a copy. Not a float literal: it is a
+		// double in C++, the variable holds it rounded to float.
+		Type var_type = Type::Unknown;
+		const ir::Expr* value = nullptr;
+		if (stmt->kind == StmtKind::Declare && stmt->value && !stmt->internal) {
+			var_type = stmt->var_type;
+			value = stmt->value.get();
+		}
+		else if (stmt->kind == StmtKind::Eval && stmt->value->kind == ExprKind::Assign && !stmt->value->internal) {
+			var_type = stmt->value->type;
+			value = stmt->value->operands[0].get();
+		}
+		if (value && var_type != Type::Unknown && value->type == var_type
+			&& ((value->kind == ExprKind::Literal && var_type != Type::Float)
+				|| (value->kind == ExprKind::Variable && value->name != *storedVariable(*stmt)))) {
+			copies.push_back({ *storedVariable(*stmt), ir::clone(arena, *value) });
+		}
+	}
+}
+
+// Constant folding
+
+// Value of a literal, computed the way the emitted C++ would
+struct Constant {
+	enum Kind {
+		Int,
+		Float,
+		Str,
+	} kind;
+	int64_t i = 0;
+	double f = 0;
+	std::string s;
+
+	double number() const {
+		return kind == Int ? double(i) : f;
+	}
+};
+
+std::optional<Constant> constantOf(const ir::Expr& expr) {
+	if (expr.kind != ExprKind::Literal || expr.text.empty()) {
+		return std::nullopt;
+	}
+	std::string_view text = expr.text;
+
+	if (text[0] == '"') {
+		// Escapes could change meaning when two literals are joined
+		if (text.find('\\') != std::string_view::npos) {
+			return std::nullopt;
+		}
+		return Constant{ Constant::Str, 0, 0, std::string(text.substr(1, text.size() - 2)) };
+	}
+
+	int64_t i;
+	auto [end, ec] = std::from_chars(text.data(), text.data() + text.size(), i);
+	if (ec == std::errc() && end == text.data() + text.size()) {
+		if (i < INT_MIN || i > INT_MAX) {
+			return std::nullopt;
+		}
+		return Constant{ Constant::Int, i };
+	}
+	// Floats have a decimal point, 1E5 is left alone
+	if (text.find('.') != std::string_view::npos) {
+		return Constant{ Constant::Float, 0, std::stod(std::string(text)) };
+	}
+	return std::nullopt;
+}
+
+ExprPtr literal(ir::Arena& arena, const ir::Expr& folded, Type type, std::string_view text) {
+	auto expr = arena.make<ir::Expr>(ExprKind::Literal, type, folded.line);
+	expr->text = arena.intern(text);
+	return expr;
+}
+
+ExprPtr intLiteral(ir::Arena& arena, const ir::Expr& folded, int64_t value, Type type = Type::Int) {
+	// Overflow is undefined for int, it is left to run time
+	if (value < INT_MIN || value > INT_MAX) {
+		return nullptr;
+	}
+	return literal(arena, folded, type, std::to_string(value));
+}
+
+ExprPtr floatLiteral(ir::Arena& arena, const ir::Expr& folded, double value) {
+	if (!std::isfinite(value)) {
+		return nullptr;
+	}
+	// Shortest text that reads back as the same double
+	std::string text = fmt::format("{}", value);
+	if (text.find_first_of(".e") == std::string::npos) {
+		text += ".0";
+	}
+	return literal(arena, folded, Type::Float, text);
+}
+
+ExprPtr boolLiteral(ir::Arena& arena, const ir::Expr& folded, bool value) {
+	return literal(arena, folded, Type::Bool, value ? "1" : "0");
+}
+
+template <typename T>
+ExprPtr compare(ir::Arena& arena, const ir::Expr& expr, const T& a, const T& b) {
+	switch (expr.op) {
+	case Op::Eq:
+		return boolLiteral(arena, expr, a == b);
+	case Op::Ne:
+		return boolLiteral(arena, expr, a != b);
+	case Op::Lt:
+		return boolLiteral(arena, expr, a < b);
+	case Op::Le:
+		return boolLiteral(arena, expr, a <= b);
+	case Op::Gt:
+		return boolLiteral(arena, expr, a > b);
+	case Op::Ge:
+		return boolLiteral(arena, expr, a >= b);
+	default:
+		return nullptr;
+	}
+}
+
+ExprPtr foldUnary(ir::Arena& arena, const ir::Expr& expr, const Constant& value) {
+	if (value.kind == Constant::Str) {
+		return nullptr;
+	}
+	switch (expr.op) {
+	case Op::Not:
+		return boolLiteral(arena, expr, value.number() == 0);
+	case Op::Neg:
+		return value.kind == Constant::Int ? intLiteral(arena, expr, -value.i) : floatLiteral(arena, expr, -value.f);
+	default:
+		return value.kind == Constant::Int ? intLiteral(arena, expr, value.i) : floatLiteral(arena, expr, value.f);
+	}
+}
+
+ExprPtr foldBinary(ir::Arena& arena, const ir::Expr& expr, const Constant& a, const Constant& b) {
+	if (a.kind == Constant::Str || b.kind == Constant::Str) {
+		if (a.kind != b.kind) {
+			return nullptr;
+		}
+		if (expr.op == Op::Add) {
+			return literal(arena, expr, Type::Str, "\"" + a.s + b.s + "\"");
+		}
+		return compare(arena, expr, a.s, b.s);
+	}
+
+	if (expr.op == Op::And) {
+		return boolLiteral(arena, expr, a.number() != 0 && b.number() != 0);
+	}
+	if (expr.op == Op::Or) {
+		return boolLiteral(arena, expr, a.number() != 0 || b.number() != 0);
+	}
+
+	// Float literals are doubles in C++, mixed arithmetic is done in double
+	if (a.kind == Constant::Float || b.kind == Constant::Float || expr.type == Type::Float) {
+		double x = a.number();
+		double y = b.number();
+		switch (expr.op) {
+		case Op::Add:
+			return floatLiteral(arena, expr, x + y);
+		case Op::Sub:
+			return floatLiteral(arena, expr, x - y);
+		case Op::Mul:
+			return floatLiteral(arena, expr, x * y);
+		case Op::Div:
+			return floatLiteral(arena, expr, x / y);
+		case Op::Mod:
+			return floatLiteral(arena, expr, std::fmod(x, y));
+		case Op::Pow:
+			return floatLiteral(arena, expr, std::pow(x, y));
+		default:
+			return compare(arena, expr, x, y);
+		}
+	}
+
+	int64_t x = a.i;
+	int64_t y = b.i;
+	switch (expr.op) {
+	case Op::Add:
+		return intLiteral(arena, expr, x + y);
+	case Op::Sub:
+		return intLiteral(arena, expr, x - y);
+	case Op::Mul:
+		return intLiteral(arena, expr, x * y);
+	case Op::Div:
+	case Op::Mod:
+		// Division by zero fails at run time, as it would unoptimized
+		if (y == 0 || (x == INT_MIN && y == -1)) {
+			return nullptr;
+		}
+		return intLiteral(arena, expr, expr.op == Op::Div ? x / y : x % y);
+	case Op::Pow: {
+		// Negative exponents are left to ipow
+		if (y < 0) {
+			return nullptr;
+		}
+		if (x == 0 || x == 1 || x == -1) {
+			return intLiteral(arena, expr, y == 0 || (x == -1 && y % 2 == 0) ? 1 : x);
+		}
+		// Overflows within 32 steps
+		int64_t result = 1;
+		for (int64_t n = 0; n < y; n++) {
+			result *= x;
+			if (result < INT_MIN || result > INT_MAX) {
+				return nullptr;
+			}
+		}
+		return intLiteral(arena, expr, result);
+	}
+	default:
+		return compare(arena, expr, x, y);
+	}
+}
+
+// x ^ 0 as 1 and int x ^ 1 as x. Larger powers stay ipow and std::pow: int
+// multiplication is undefined on overflow where ipow wraps, like the VM, and std::pow of
+// a float computes in double where x * x rounds and overflows in float. With a constant
+// exponent the C++ compiler unrolls the inline ipow into multiplications itself.
+ExprPtr simplifyPower(ir::Arena& arena, const ir::Expr& expr) {
+	const ir::Expr& base = *expr.operands[0];
+	auto exponent = constantOf(*expr.operands[1]);
+	if (base.kind != ExprKind::Variable || !exponent || exponent->kind != Constant::Int) {
+		return nullptr;
+	}
+	int64_t max = base.type == Type::Int ? 1 : base.type == Type::Float ? 0 : -1;
+	int64_t n = exponent->i;
+	if (n < 0 || n > max || expr.type != base.type) {
+		return nullptr;
+	}
+
+	if (n == 0) {
+		return base.type == Type::Int ? intLiteral(arena, expr, 1) : floatLiteral(arena, expr, 1);
+	}
+	return ir::clone(arena, base);
+}
+
+void foldConstants(ir::Arena& arena, ExprPtr& expr) {
+	for (auto& operand : expr->operands) {
+		foldConstants(arena, operand);
+	}
+
+	ExprPtr folded;
+	if (expr->kind == ExprKind::Unary) {
+		if (auto value = constantOf(*expr->operands[0])) {
+			folded = foldUnary(arena, *expr, *value);
+		}
+	}
+	else if (expr->kind == ExprKind::Binary) {
+		auto lhs = constantOf(*expr->operands[0]);
+		auto rhs = constantOf(*expr->operands[1]);
+		if (lhs && rhs) {
+			folded = foldBinary(arena, *expr, *lhs, *rhs);
+		}
+		else if (expr->op == Op::Pow) {
+			folded = simplifyPower(arena, *expr);
+		}
+	}
+
+	if (folded) {
+		expr = std::move(folded);
+	}
+}
+
+void foldConstants(ir::Arena& arena, ir::Block& block) {
+	for (auto& stmt : block) {
+		forEachOwnExprPtr(*stmt, [&](ExprPtr& expr) { foldConstants(arena, expr); });
+	}
+}
+
+// Calls of pure int functions with constant arguments
+
+// Runs int functions at transpile time the way the C++ program computes them. Gives up on
+// what the program would not compute the same or at all: int overflow, division by zero, a
+// missing return, or a call taking more than MaxSteps statements and calls.
+class CallEvaluator {
+public:
+	explicit CallEvaluator(const ir::Program& program) {
+		std::unordered_set<std::string> pure = ir::pureFunctions(program);
+		for (const auto& function : program.functions) {
+			// Modules are compiled on their own, their code is not folded into the main program
+			if (pure.count(function.name) && function.module.empty() && intOnly(function)) {
+				foldable.emplace(function.name, &function);
+			}
+		}
+	}
+
+	bool canEvaluate(std::string_view function) const {
+		return foldable.count(function) > 0;
+	}
+
+	std::optional<int64_t> call(std::string_view function, const std::vector<int64_t>& args) {
+		// A call that gave up left the depth of the call it gave up in
+		steps = 0;
+		depth = 0;
+		try {
+			return invoke(function, args);
+		}
+		catch (const GiveUp&) {
+			return std::nullopt;
+		}
+	}
+
+private:
+	struct GiveUp {};
+
+	// Variables of a call, a scope per block being run. A declaration in a nested block
+	// shadows the variable of the enclosing one until the block ends, as in C++.
+	class Frame {
+	public:
+		Frame() : scopes(1) {}
+
+		void push() {
+			scopes.emplace_back();
+		}
+
+		void pop() {
+			scopes.pop_back();
+		}
+
+		void declare(std::string_view name, int64_t value) {
+			scopes.back()[name] = value;
+		}
+
+		int64_t& at(std::string_view name) {
+			for (auto scope = scopes.rbegin(); scope != scopes.rend(); ++scope) {
+				if (auto found = scope->find(name); found != scope->end()) {
+					return found->second;
+				}
+			}
+			throw GiveUp();
+		}
+
+	private:
+		// Names of the IR and of the functions' arguments, both outlive the evaluator
+		std::vector<std::unordered_map<std::string_view, int64_t>> scopes;
+	};
+
+	static constexpr size_t MaxSteps = 1000000;
+	// Keeps the recursion within the transpiler's stack
+	static constexpr size_t MaxDepth = 200;
+
+	std::unordered_map<std::string_view, const ir::Function*> foldable;
+	// The functions are pure, a call with the same arguments has the same result
+	std::map<std::pair<std::string_view, std::vector<int64_t>>, int64_t> results;
+	size_t steps = 0;
+	size_t depth = 0;
+
+	static bool integral(Type type) {
+		return type == Type::Int || type == Type::Bool;
+	}
+
+	// Ints, comparisons and logic only, and the statements evaluate() runs. Callees are
+	// checked when they are called.
+	static bool intOnly(const ir::Function& function) {
+		bool ok = function.result == Type::Int && std::all_of(function.args.begin(), function.args.end(),
+			[](const ir::Argument& arg) { return arg.type == Type::Int; });
+		for (const auto& stmt : function.body) {
+			ir::forEachStmt(*stmt, [&](const ir::Stmt& s) {
+				bool supported = (s.kind == StmtKind::Declare && s.value && integral(s.var_type))
+					|| (s.kind == StmtKind::For && !s.parallel && s.var_type == Type::Int) || s.kind == StmtKind::Eval
+					|| s.kind == StmtKind::If || (s.kind == StmtKind::Return && s.value);
+				ok = ok && supported;
+				ir::forEachOwnExpr(s, [&](const ir::Expr& expr) {
+					ir::forEachExpr(expr, [&](const ir::Expr& e) {
+						bool kind = e.kind == ExprKind::Literal || e.kind == ExprKind::Variable || e.kind == ExprKind::Unary
+							|| e.kind == ExprKind::Binary || e.kind == ExprKind::Call || e.kind == ExprKind::Assign;
+						ok = ok && kind && integral(e.type);
+					});
+				});
+			});
+		}
+		return ok;
+	}
+
+	void step() {
+		if (++steps > MaxSteps) {
+			throw GiveUp();
+		}
+	}
+
+	// INT_MIN is kept, the emitter writes it as an int expression
+	static int64_t checked(int64_t value) {
+		if (value < INT_MIN || value > INT_MAX) {
+			throw GiveUp();
+		}
+		return value;
+	}
+
+	int64_t invoke(std::string_view name, const std::vector<int64_t>& args) {
+		auto found = foldable.find(name);
+		if (found == foldable.end() || depth >= MaxDepth) {
+			throw GiveUp();
+		}
+		auto key = std::make_pair(name, args);
+		if (auto cached = results.find(key); cached != results.end()) {
+			return cached->second;
+		}
+		step();
+
+		const ir::Function& function = *found->second;
+		Frame frame;
+		for (size_t i = 0; i < args.size(); i++) {
+			frame.declare(function.args[i].name, args[i]);
+		}
+		depth++;
+		int64_t result;
+		bool returned = run(function.body, frame, result);
+		depth--;
+		if (!returned) {
+			throw GiveUp();
+		}
+		results.emplace(std::move(key), result);
+		return result;
+	}
+
+	// True when a return ran, with its value in result
+	bool run(const ir::Block& block, Frame& frame, int64_t& result) {
+		for (const auto& stmt : block) {
+			step();
+			switch (stmt->kind) {
+			case StmtKind::Declare:
+				frame.declare(stmt->var, evaluate(*stmt->value, frame));
+				break;
+			case StmtKind::Eval:
+				evaluate(*stmt->value, frame);
+				break;
+			case StmtKind::If:
+				if (runNested(evaluate(*stmt->value, frame) != 0 ? stmt->body : stmt->else_body, frame, result)) {
+					return true;
+				}
+				break;
+			case StmtKind::For:
+				if (runFor(*stmt, frame, result)) {
+					return true;
+				}
+				break;
+			case StmtKind::Return:
+				result = evaluate(*stmt->value, frame);
+				return true;
+			default:
+				throw GiveUp();
+			}
+		}
+		return false;
+	}
+
+	bool runNested(const ir::Block& block, Frame& frame, int64_t& result) {
+		frame.push();
+		bool returned = run(block, frame, result);
+		frame.pop();
+		return returned;
+	}
+
+	// Start value, limit and step are evaluated once, in this order, like the C++ loop
+	bool runFor(const ir::Stmt& stmt, Frame& frame, int64_t& result) {
+		int64_t from = evaluate(*stmt.from, frame);
+		int64_t to = evaluate(*stmt.to, frame);
+		int64_t by = stmt.step ? evaluate(*stmt.step, frame) : 1;
+		// The loop's own variable lives in a scope around the body
+		frame.push();
+		if (stmt.declares) {
+			frame.declare(stmt.var, from);
+		}
+		else {
+			frame.at(stmt.var) = from;
+		}
+		bool returned = false;
+		while (!returned && (by >= 0 ? frame.at(stmt.var) <= to : frame.at(stmt.var) >= to)) {
+			returned = runNested(stmt.body, frame, result);
+			if (!returned) {
+				step();
+				int64_t& var = frame.at(stmt.var);
+				var = checked(var + by);
+			}
+		}
+		frame.pop();
+		return returned;
+	}
+
+	int64_t evaluate(const ir::Expr& expr, Frame& frame) {
+		switch (expr.kind) {
+		case ExprKind::Literal: {
+			auto constant = constantOf(expr);
+			if (!constant || constant->kind != Constant::Int) {
+				throw GiveUp();
+			}
+			return constant->i;
+		}
+		case ExprKind::Variable:
+			return frame.at(expr.name);
+		case ExprKind::Assign: {
+			int64_t value = evaluate(*expr.operands[0], frame);
+			return frame.at(expr.name) = value;
+		}
+		case ExprKind::Call: {
+			std::vector<int64_t> args;
+			for (const auto& operand : expr.operands) {
+				args.push_back(evaluate(*operand, frame));
+			}
+			return invoke(expr.name, args);
+		}
+		case ExprKind::Unary: {
+			int64_t value = evaluate(*expr.operands[0], frame);
+			return expr.op == Op::Not ? value == 0 : expr.op == Op::Neg ? checked(-value) : value;
+		}
+		default:
+			break;
+		}
+
+		// Binary. And and or don't evaluate their right side when the left one decides.
+		int64_t a = evaluate(*expr.operands[0], frame);
+		if (expr.op == Op::And || expr.op == Op::Or) {
+			if ((a != 0) == (expr.op == Op::Or)) {
+				return expr.op == Op::Or;
+			}
+			return evaluate(*expr.operands[1], frame) != 0;
+		}
+		int64_t b = evaluate(*expr.operands[1], frame);
+		switch (expr.op) {
+		case Op::Add:
+			return checked(a + b);
+		case Op::Sub:
+			return checked(a - b);
+		case Op::Mul:
+			return checked(a * b);
+		case Op::Div:
+		case Op::Mod:
+			if (b == 0 || (a == INT_MIN && b == -1)) {
+				throw GiveUp();
+			}
+			return expr.op == Op::Div ? a / b : a % b;
+		case Op::Pow: {
+			// Negative exponents are left to ipow, as by the constant folding
+			if (b < 0) {
+				throw GiveUp();
+			}
+			if (a == 0 || a == 1 || a == -1) {
+				return b == 0 || (a == -1 && b % 2 == 0) ? 1 : a;
+			}
+			int64_t power = 1;
+			for (int64_t n = 0; n < b; n++) {
+				power = checked(power * a);
+			}
+			return power;
+		}
+		case Op::Eq:
+			return a == b;
+		case Op::Ne:
+			return a != b;
+		case Op::Lt:
+			return a < b;
+		case Op::Le:
+			return a <= b;
+		case Op::Gt:
+			return a > b;
+		case Op::Ge:
+			return a >= b;
+		default:
+			throw GiveUp();
+		}
+	}
+};
+
+void foldCalls(ir::Arena& arena, ExprPtr& expr, CallEvaluator& evaluator) {
+	for (auto& operand : expr->operands) {
+		foldCalls(arena, operand, evaluator);
+	}
+
+	// The rest is left to const-fold, which can be turned off on its own
+	if (expr->kind != ExprKind::Call || !evaluator.canEvaluate(expr->name)) {
+		return;
+	}
+	std::vector<int64_t> args;
+	for (const auto& operand : expr->operands) {
+		auto constant = constantOf(*operand);
+		if (!constant || constant->kind != Constant::Int) {
+			return;
+		}
+		args.push_back(constant->i);
+	}
+	if (auto result = evaluator.call(expr->name, args)) {
+		expr = intLiteral(arena, *expr, *result);
+	}
+}
+
+// Common subexpressions
+
+class CseRewriter {
+private:
+	ir::Arena* arena;
+	int counter = 0;
+
+	static bool isCandidate(const ir::Expr& expr) {
+		if (expr.kind != ExprKind::Binary) {
+			return false;
+		}
+		if (!ir::isPure(expr)) {
+			return false;
+		}
+		bool has_variable = false;
+		ir::forEachExpr(expr, [&](const ir::Expr& e) {
+			if (e.kind == ExprKind::Variable) {
+				has_variable = true;
+			}
+		});
+		return has_variable;
+	}
+
+	// Subexpressions evaluated whenever the statement runs, largest first. The right side
+	// of and/or is skipped, it may not be evaluated.
+	static void collect(ExprPtr& expr, std::vector<ExprPtr*>& found) {
+		found.push_back(&expr);
+		bool short_circuit = expr->kind == ExprKind::Binary && (expr->op == Op::And || expr->op == Op::Or);
+		for (size_t i = 0; i < expr->operands.size(); i++) {
+			if (!(short_circuit && i == 1)) {
+				collect(expr->operands[i], found);
+			}
+		}
+	}
+
+	static std::vector<ExprPtr*> occurrences(ir::Stmt& stmt) {
+		std::vector<ExprPtr*> found;
+		if (stmt.kind == StmtKind::For) {
+			return found;
+		}
+		forEachOwnExprPtr(stmt, [&](ExprPtr& expr) { collect(expr, found); });
+		return found;
+	}
+
+	static bool writesAny(const ir::Stmt& stmt, const ir::Expr& expr) {
+		bool found = false;
+		ir::forEachExpr(expr, [&](const ir::Expr& e) {
+			if (e.kind == ExprKind::Variable && ir::writes(stmt, e.name)) {
+				found = true;
+			}
+		});
+		return found;
+	}
+
+	// Hoists one repeated expression of the block, returns false when there is none
+	bool rewriteOne(ir::Block& block) {
+		for (size_t first = 0; first < block.size(); first++) {
+			for (ExprPtr* candidate : occurrences(*block[first])) {
+				if (!isCandidate(**candidate)) {
+					continue;
+				}
+
+				// Same value until a statement writes one of its variables. Within that
+				// statement it is not known whether the write comes first.
+				std::vector<ExprPtr*> uses;
+				for (size_t i = first; i < block.size(); i++) {
+					ir::Stmt& stmt = *block[i];
+					if (writesAny(stmt, **candidate)) {
+						break;
+					}
+					for (ExprPtr* occurrence : occurrences(stmt)) {
+						if (ir::sameExpr(**occurrence, **candidate)) {
+							uses.push_back(occurrence);
+						}
+					}
+				}
+				if (uses.size() < 2) {
+					continue;
+				}
+
+				const ir::Expr& expr = **candidate;
+				auto temp = arena->make<ir::Stmt>(StmtKind::Declare, block[first]->line);
+				temp->var = arena->intern(fmt::format("__jagle_cse_{}", ++counter));
+				// A float expression computes in double in C++ when it has a literal, as auto the
+				// temporary keeps the precision and range of the expression it replaces
+				temp->var_type = expr.type == Type::Float ? Type::Unknown : expr.type;
+				temp->internal = true;
+				temp->value = ir::clone(*arena, expr);
+
+				for (ExprPtr* use : uses) {
+					auto variable = arena->make<ir::Expr>(ExprKind::Variable, (*use)->type, (*use)->line);
+					variable->name = temp->var;
+					variable->internal = true;
+					*use = std::move(variable);
+				}
+				block.insert(block.begin() + first, std::move(temp));
+				return true;
+			}
+		}
+		return false;
+	}
+
+public:
+	explicit CseRewriter(ir::Arena& arena) : arena(&arena) {}
+
+	void rewrite(ir::Block& block) {
+		while (rewriteOne(block)) {
+		}
+	}
+};
+
+// Dead stores
+
+bool overwrites(const ir::Stmt& stmt, ir::Name var) {
+	if (ir::reads(stmt, var)) {
+		return false;
+	}
+	const ir::Name* stored = storedVariable(stmt);
+	if (stored && *stored == var) {
+		return true;
+	}
+	return (stmt.kind == StmtKind::Read || stmt.kind == StmtKind::Input) && stmt.var == var;
+}
+
+void eliminateDeadStores(ir::Arena& arena, ir::Block& block, bool top_level) {
+	for (size_t i = 0; i < block.size(); i++) {
+		ir::Stmt& stmt = *block[i];
+		const ir::Name* stored = storedVariable(stmt);
+		if (!stored || (stmt.kind == StmtKind::Declare && stmt.internal)) {
+			continue;
+		}
+
+		// Dead when overwritten before any read. Nothing reads a variable after the last
+		// statement of main or a function, or of the block that declares it.
+		bool dead = top_level || std::any_of(block.begin(), block.begin() + i + 1, [&](const ir::StmtPtr& s) {
+			return s->kind == StmtKind::Declare && s->var == *stored;
+		});
+		for (size_t j = i + 1; j < block.size(); j++) {
+			// A declaration of the name in a nested block shadows the variable, it is still
+			// read after the block
+			bool redeclares = (block[j]->kind == StmtKind::Declare || block[j]->kind == StmtKind::DeclareArray)
+				&& block[j]->var == *stored;
+			if (redeclares) {
+				dead = dead && !ir::reads(*block[j], *stored);
+				break;
+			}
+			if (overwrites(*block[j], *stored)) {
+				dead = true;
+				break;
+			}
+			if (ir::reads(*block[j], *stored) || block[j]->kind == StmtKind::Return) {
+				dead = false;
+				break;
+			}
+		}
+		if (!dead) {
+			continue;
+		}
+
+		ExprPtr value = stmt.kind == StmtKind::Declare ? std::move(stmt.value) : std::move(stmt.value->operands[0]);
+		if (stmt.kind == StmtKind::Eval) {
+			if (ir::isPure(*value)) {
+				block.erase(block.begin() + i);
+				i--;
+			}
+			else {
+				stmt.value = std::move(value);
+			}
+		}
+		else if (!ir::isPure(*value)) {
+			// Side effects of the initializer stay, it can't refer to the variable
+			auto eval = arena.make<ir::Stmt>(StmtKind::Eval, stmt.line);
+			eval->value = std::move(value);
+			block.insert(block.begin() + i, std::move(eval));
+			i++;
+		}
+	}
+}
+
+// Dead code
+
+bool declaresVariables(const ir::Block& block) {
+	return std::any_of(block.begin(), block.end(), [](const ir::StmtPtr& stmt) {
+		return stmt->kind == StmtKind::Declare || stmt->kind == StmtKind::DeclareArray;
+	});
+}
+
+bool eliminateDeadCodeOnce(ir::Block& block) {
+	for (size_t i = 0; i < block.size(); i++) {
+		ir::Stmt& stmt = *block[i];
+
+		if (stmt.kind == StmtKind::Return && i + 1 < block.size()) {
+			block.erase(block.begin() + i + 1, block.end());
+			return true;
+		}
+
+		if (stmt.kind == StmtKind::Eval && ir::isPure(*stmt.value)) {
+			block.erase(block.begin() + i);
+			return true;
+		}
+
+		bool non_zero;
+		if (stmt.kind == StmtKind::If && isNonZeroLiteral(*stmt.value, non_zero)) {
+			ir::Block& taken = non_zero ? stmt.body : stmt.else_body;
+			// Declarations would move into the enclosing scope
+			if (!declaresVariables(taken)) {
+				ir::Block statements = std::move(taken);
+				block.erase(block.begin() + i);
+				block.insert(block.begin() + i, std::make_move_iterator(statements.begin()), std::make_move_iterator(statements.end()));
+				return true;
+			}
+		}
+
+		if (stmt.kind == StmtKind::If && stmt.body.empty() && stmt.else_body.empty() && ir::isPure(*stmt.value)) {
+			block.erase(block.begin() + i);
+			return true;
+		}
+
+		if (stmt.kind == StmtKind::Declare && (!stmt.value || ir::isPure(*stmt.value))) {
+			bool used = false;
+			for (size_t j = i + 1; j < block.size() && !used; j++) {
+				used = ir::reads(*block[j], stmt.var) || ir::writes(*block[j], stmt.var);
+			}
+			if (!used) {
+				block.erase(block.begin() + i);
+				return true;
+			}
+		}
+	}
+
+	return false;
+}
+
+void collectCalls(const ir::Block& block, std::vector<std::string>& calls) {
+	for (const auto& stmt : block) {
+		ir::forEachStmt(*stmt, [&](const ir::Stmt& s) {
+			ir::forEachOwnExpr(s, [&](const ir::Expr& expr) {
+				ir::forEachExpr(expr, [&](const ir::Expr& e) {
+					if (e.kind == ExprKind::Call) {
+						calls.push_back(e.name.str());
+					}
+				});
+			});
+		});
+	}
+}
+
+}
+
+PassOptions PassOptions::none() {
+	PassOptions options;
+	for (const auto& pass : passPipeline()) {
+		options.*pass.enabled = false;
+	}
+	return options;
+}
+
+const std::vector<PassInfo>& passPipeline() {
+	static const std::vector<PassInfo> pipeline = {
+		{ "copy-prop", "propagate copies of variables and literals", &PassOptions::copy_propagation, propagateCopies },
+		{ "const-fold", "compute constant expressions, drop x ^ 0 and x ^ 1", &PassOptions::constant_folding, foldConstants },
+		{ "fold-calls", "compute calls of pure int functions with constant arguments", &PassOptions::call_folding, foldCalls },
+		{ "cse", "compute repeated expressions once", &PassOptions::cse, eliminateCommonSubexpressions },
+		{ "dse", "remove stores that are never read", &PassOptions::dead_stores, eliminateDeadStores },
+		{ "dce", "remove code without effect", &PassOptions::dead_code, eliminateDeadCode },
+		{ "unreachable-functions", "remove functions that are never called", &PassOptions::unreachable_functions,
+			removeUnreachableFunctions },
+	};
+	return pipeline;
+}
+
+bool setPass(PassOptions& options, std::string_view name, bool enabled) {
+	for (const auto& pass : passPipeline()) {
+		if (pass.name == name) {
+			options.*pass.enabled = enabled;
+			return true;
+		}
+	}
+	return false;
+}
+
+void runPasses(ir::Program& program, const PassOptions& options) {
+	for (const auto& pass : passPipeline()) {
+		if (options.*pass.enabled) {
+			pass.run(program);
+		}
+	}
+}
+
+void propagateCopies(ir::Program& program) {
+	forEachBlock(program, [&](ir::Block& block, bool) { propagateCopies(program.arena(), block); });
+}
+
+void foldConstants(ir::Program& program) {
+	forEachBlock(program, [&](ir::Block& block, bool) { foldConstants(program.arena(), block); });
+}
+
+void foldCalls(ir::Program& program) {
+	CallEvaluator evaluator(program);
+	forEachBlock(program, [&](ir::Block& block, bool) {
+		for (auto& stmt : block) {
+			forEachOwnExprPtr(*stmt, [&](ExprPtr& expr) { foldCalls(program.arena(), expr, evaluator); });
+		}
+	});
+}
+
+void eliminateCommonSubexpressions(ir::Program& program) {
+	CseRewriter rewriter(program.arena());
+	forEachBlock(program, [&](ir::Block& block, bool top_level) {
+		rewriter.rewrite(block);
+		// Temporaries are numbered per function, they don't change with the other functions
+		if (top_level) {
+			rewriter = CseRewriter(program.arena());
+		}
+	});
+}
+
+void eliminateDeadStores(ir::Program& program) {
+	forEachBlock(program, [&](ir::Block& block, bool top_level) { eliminateDeadStores(program.arena(), block, top_level); });
+}
+
+void eliminateDeadCode(ir::Program& program) {
+	forEachBlock(program, [](ir::Block& block, bool) {
+		while (eliminateDeadCodeOnce(block)) {
+		}
+	});
+}
+
+void removeUnreachableFunctions(ir::Program& program) {
+	std::vector<std::string> pending;
+	collectCalls(program.main, pending);
+
+	std::set<std::string> reachable;
+	while (!pending.empty()) {
+		std::string name = std::move(pending.back());
+		pending.pop_back();
+		if (!reachable.insert(name).second) {
+			continue;
+		}
+		for (const auto& function : program.functions) {
+			if (function.name == name) {
+				collectCalls(function.body, pending);
+			}
+		}
+	}
+
+	auto& functions = program.functions;
+	functions.erase(std::remove_if(functions.begin(), functions.end(),
+		[&](const ir::Function& function) { return function.module.empty() && reachable.count(function.name) == 0; }),
+		functions.end());
+}
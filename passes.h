@@ -0,0 +1,56 @@
+#pragma once
+
+#include <string_view>
+#include <vector>
+
+#include "ir.h"
+
+// Which optimization passes run on the IR
+struct PassOptions {
+	bool copy_propagation = true;
+	bool constant_folding = true;
+	bool call_folding = true;
+	bool cse = true;
+	bool dead_stores = true;
+	bool dead_code = true;
+	bool unreachable_functions = true;
+
+	// Every pass off, the IR is emitted as built
+	static PassOptions none();
+};
+
+struct PassInfo {
+	// Name on the command line
+	std::string_view name;
+	std::string_view description;
+	bool PassOptions::*enabled;
+	void (*run)(ir::Program& program);
+};
+
+// All passes in the order they run
+const std::vector<PassInfo>& passPipeline();
+
+// Turns the named pass on or off. Returns false for an unknown name.
+bool setPass(PassOptions& options, std::string_view name, bool enabled);
+
+void runPasses(ir::Program& program, const PassOptions& options);
+
+// Replaces reads of a variable assigned a plain variable or literal with that value, until
+// either is written again
+void propagateCopies(ir::Program& program);
+// Computes expressions of literals at compile time and turns x ^ 0 into 1 and int x ^ 1
+// into x. Other powers are left to ipow and std::pow.
+void foldConstants(ir::Program& program);
+// Computes calls of pure int functions with literal arguments, memo funcs included, at
+// compile time. Calls that overflow, divide by zero or run too long are left to run time.
+void foldCalls(ir::Program& program);
+// Computes a pure expression repeated within a block once, into an internal variable
+void eliminateCommonSubexpressions(ir::Program& program);
+// Drops assignments whose value is overwritten, or never read, before any read
+void eliminateDeadStores(ir::Program& program);
+// Drops statements after return, branches of constant conditions, expression statements
+// without side effects and variables that are never used
+void eliminateDeadCode(ir::Program& program);
+// Drops functions main can't reach through calls. The functions of modules are kept, a
+// module compiles the same whichever program imports it.
+void removeUnreachableFunctions(ir::Program& program);
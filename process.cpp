@@ -0,0 +1,203 @@
+#include "process.h"
+
+#include <ctime>
+
+#ifdef JAGLE_HAS_SPAWN
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <mutex>
+
+#include <fcntl.h>
+#include <spawn.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+extern char** environ;
+#endif
+
+#ifndef _WIN32
+#include <sys/resource.h>
+#endif
+
+#include <fmt/core.h>
+
+std::vector<std::string> splitCommand(std::string_view cmd) {
+	std::vector<std::string> args;
+	std::string arg;
+	bool in_arg = false;
+	char quote = 0;
+
+	for (char c : cmd) {
+		if (quote) {
+			if (c == quote) {
+				quote = 0;
+			}
+			else {
+				arg += c;
+			}
+		}
+		else if (c == '"' || c == '\'') {
+			quote = c;
+			in_arg = true;
+		}
+		else if (c == ' ' || c == '\t' || c == '\n' || c == '\r') {
+			if (in_arg) {
+				args.push_back(std::move(arg));
+				arg.clear();
+				in_arg = false;
+			}
+		}
+		else {
+			arg += c;
+			in_arg = true;
+		}
+	}
+	if (in_arg) {
+		args.push_back(std::move(arg));
+	}
+
+	return args;
+}
+
+#ifdef JAGLE_HAS_SPAWN
+namespace {
+
+// Pipes are created and the child spawned under this lock. Otherwise a compiler started
+// by another thread could inherit the write end of our pipe and keep it open, and our
+// compiler would never see the end of its input.
+std::mutex spawn_mutex;
+
+// A pipe whose ends are closed in children. pipe2 sets FD_CLOEXEC as it creates them, so
+// that not even a fork outside runProcess, like std::system(), can inherit them.
+// Elsewhere the flags are set right after, under spawn_mutex.
+int closeOnExecPipe(int fds[2]) {
+#if defined(__linux__) || defined(__FreeBSD__) || defined(__NetBSD__) || defined(__OpenBSD__)
+	return pipe2(fds, O_CLOEXEC);
+#else
+	if (pipe(fds) != 0) {
+		return -1;
+	}
+	fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+	fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+	return 0;
+#endif
+}
+
+}
+
+int runProcess(const std::vector<std::string>& args, std::string_view input, std::string& error) {
+	if (args.empty()) {
+		error = "empty command";
+		return -1;
+	}
+
+	std::vector<char*> argv;
+	for (const auto& arg : args) {
+		argv.push_back(const_cast<char*>(arg.c_str()));
+	}
+	argv.push_back(nullptr);
+
+	// A compiler that exits early must not kill us with SIGPIPE, write() fails instead
+	static std::once_flag ignore_sigpipe;
+	std::call_once(ignore_sigpipe, []() { std::signal(SIGPIPE, SIG_IGN); });
+
+	pid_t pid;
+	int fds[2];
+	{
+		std::lock_guard<std::mutex> lock(spawn_mutex);
+		if (closeOnExecPipe(fds) != 0) {
+			error = fmt::format("pipe failed: {}", std::strerror(errno));
+			return -1;
+		}
+
+		posix_spawn_file_actions_t actions;
+		posix_spawn_file_actions_init(&actions);
+		posix_spawn_file_actions_adddup2(&actions, fds[0], STDIN_FILENO);
+
+		// The child gets the default SIGPIPE back
+		posix_spawnattr_t attr;
+		posix_spawnattr_init(&attr);
+		sigset_t default_signals;
+		sigemptyset(&default_signals);
+		sigaddset(&default_signals, SIGPIPE);
+		posix_spawnattr_setsigdefault(&attr, &default_signals);
+		posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGDEF);
+
+		int rc = posix_spawnp(&pid, argv[0], &actions, &attr, argv.data(), environ);
+		posix_spawnattr_destroy(&attr);
+		posix_spawn_file_actions_destroy(&actions);
+		close(fds[0]);
+
+		if (rc != 0) {
+			close(fds[1]);
+			error = fmt::format("cannot run '{}': {}", args[0], std::strerror(rc));
+			return -1;
+		}
+	}
+
+	const char* data = input.data();
+	size_t left = input.size();
+	while (left > 0) {
+		ssize_t written = write(fds[1], data, left);
+		if (written < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			// EPIPE, the process stopped reading. Its exit status tells why.
+			break;
+		}
+		data += written;
+		left -= written;
+	}
+	close(fds[1]);
+
+	int status;
+	while (waitpid(pid, &status, 0) < 0) {
+		if (errno != EINTR) {
+			error = fmt::format("waitpid failed: {}", std::strerror(errno));
+			return -1;
+		}
+	}
+	if (!WIFEXITED(status)) {
+		error = fmt::format("'{}' terminated abnormally", args[0]);
+		return -1;
+	}
+	return WEXITSTATUS(status);
+}
+#endif
+
+double threadCpuSeconds() {
+#ifdef CLOCK_THREAD_CPUTIME_ID
+	timespec now;
+	if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now) == 0) {
+		return now.tv_sec + now.tv_nsec / 1e9;
+	}
+#endif
+	return static_cast<double>(std::clock()) / CLOCKS_PER_SEC;
+}
+
+double childCpuSeconds() {
+#ifndef _WIN32
+	rusage usage;
+	if (getrusage(RUSAGE_CHILDREN, &usage) == 0) {
+		return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+	}
+#endif
+	return 0;
+}
+
+size_t peakResidentBytes() {
+#ifndef _WIN32
+	rusage usage;
+	if (getrusage(RUSAGE_SELF, &usage) == 0) {
+#ifdef __APPLE__
+		return static_cast<size_t>(usage.ru_maxrss);
+#else
+		// Kilobytes on Linux and the BSDs
+		return static_cast<size_t>(usage.ru_maxrss) * 1024;
+#endif
+	}
+#endif
+	return 0;
+}
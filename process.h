@@ -0,0 +1,31 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+
+// posix_spawn is not available on Windows, the compiler is started through the shell there
+#ifndef _WIN32
+#define JAGLE_HAS_SPAWN 1
+#endif
+
+// Splits a command line into arguments at whitespace. Single and double quotes group
+// whitespace into one argument and are removed, there are no escapes.
+std::vector<std::string> splitCommand(std::string_view cmd);
+
+#ifdef JAGLE_HAS_SPAWN
+// Runs args[0] (searched from PATH) without a shell and writes input to its stdin.
+// stdout and stderr are inherited. Returns the exit status, or -1 and sets error when the
+// process could not be started or did not exit normally.
+int runProcess(const std::vector<std::string>& args, std::string_view input, std::string& error);
+#endif
+
+// CPU time the calling thread used so far, in seconds. The whole process where threads
+// can't be measured on their own.
+double threadCpuSeconds();
+
+// CPU time of the child processes that exited and were waited for, in seconds. 0 on Windows.
+double childCpuSeconds();
+
+// Peak resident set size of the process in bytes, 0 where unknown
+size_t peakResidentBytes();
@@ -0,0 +1,864 @@
+#include "semantic.h"
+
+#include <algorithm>
+
+#include <fmt/core.h>
+
+namespace {
+
+bool isNumeric(Type type) {
+	return type == Type::Int || type == Type::Float || type == Type::Bool || type == Type::Number;
+}
+
+Type declaredType(JP::VariableTypeContext* ctx) {
+	return ctx->INT_TYPE() ? Type::Int : ctx->FLOAT_TYPE() ? Type::Float : Type::Str;
+}
+
+Type argumentType(JP::ArgumentContext* ctx) {
+	Type type = declaredType(ctx->variableType());
+	return ctx->LBRACKET() ? arrayOf(type) : type;
+}
+
+// Operands added (or multiplied) in a chain of the operator, a + (b + c) gives a, b and
+// c. Of a - b only a is added.
+void operandsOf(JP::ExpressionContext* ctx, const std::string& op, std::vector<JP::ExpressionContext*>& operands) {
+	while (auto paren = dynamic_cast<JP::ParenExpressionContext*>(ctx)) {
+		ctx = paren->expression();
+	}
+	auto adding = dynamic_cast<JP::AddingExpressionContext*>(ctx);
+	if (op == "+" && adding) {
+		operandsOf(adding->expression(0), op, operands);
+		if (adding->PLUS()) {
+			operandsOf(adding->expression(1), op, operands);
+		}
+		return;
+	}
+	auto multiplying = dynamic_cast<JP::MultiplyingExpressionContext*>(ctx);
+	if (op == "*" && multiplying && multiplying->TIMES()) {
+		operandsOf(multiplying->expression(0), op, operands);
+		operandsOf(multiplying->expression(1), op, operands);
+		return;
+	}
+	operands.push_back(ctx);
+}
+
+}
+
+std::string_view typeName(Type type) {
+	switch (type) {
+	case Type::Int:
+		return "int";
+	case Type::Float:
+		return "float";
+	case Type::Str:
+		return "str";
+	case Type::Bool:
+		return "bool";
+	case Type::Number:
+		return "number";
+	case Type::Nothing:
+		return "Nothing";
+	case Type::Void:
+		return "no value";
+	case Type::IntArray:
+		return "int[]";
+	case Type::FloatArray:
+		return "float[]";
+	case Type::StrArray:
+		return "str[]";
+	default:
+		return "unknown";
+	}
+}
+
+bool isArray(Type type) {
+	return type == Type::IntArray || type == Type::FloatArray || type == Type::StrArray;
+}
+
+Type elementType(Type array) {
+	switch (array) {
+	case Type::IntArray:
+		return Type::Int;
+	case Type::FloatArray:
+		return Type::Float;
+	case Type::StrArray:
+		return Type::Str;
+	default:
+		return Type::Unknown;
+	}
+}
+
+Type arrayOf(Type element) {
+	switch (element) {
+	case Type::Int:
+		return Type::IntArray;
+	case Type::Float:
+		return Type::FloatArray;
+	case Type::Str:
+		return Type::StrArray;
+	default:
+		return Type::Unknown;
+	}
+}
+
+std::string SemanticError::describe() const {
+	return fmt::format("error at line {}:{}: {}", line, column, message);
+}
+
+bool SemanticAnalyzer::analyze(JP::ProgContext* ctx) {
+	// Functions can be called before they are defined, the generated code declares them all
+	// up front
+	declareFunctions(ctx);
+
+	std::unordered_map<std::string, std::vector<std::string>> calls;
+	findUnsafeFunctions(ctx, "", calls);
+	// Calling an unsafe function makes the caller unsafe too
+	for (bool changed = true; changed;) {
+		changed = false;
+		for (const auto& [function, callees] : calls) {
+			bool calls_unsafe = std::any_of(callees.begin(), callees.end(),
+				[&](const std::string& callee) { return unsafe_functions.count(callee) > 0; });
+			if (calls_unsafe && unsafe_functions.insert(function).second) {
+				changed = true;
+			}
+		}
+	}
+
+	scopes.emplace_back();
+	for (const auto& stmtList : ctx->stmtList()) {
+		if (!module.empty()) {
+			for (auto statement : stmtList->statement()) {
+				if (!statement->funcDefStmt() && !statement->importStmt()) {
+					error(statement, fmt::format("module '{}' can only define functions and import modules", module));
+				}
+			}
+		}
+		visit(stmtList);
+	}
+	scopes.pop_back();
+
+	return errors.empty();
+}
+
+Type SemanticAnalyzer::typeOf(const antlr4::tree::ParseTree* ctx) const {
+	auto it = types.find(ctx);
+	return it == types.end() ? Type::Unknown : it->second;
+}
+
+const std::vector<SemanticError>& SemanticAnalyzer::getErrors() const {
+	return errors;
+}
+
+ModuleInterface SemanticAnalyzer::exports() const {
+	ModuleInterface exported;
+	for (const auto& [name, signature] : functions) {
+		if (signature.module == module) {
+			exported.functions.emplace(name, signature);
+			if (unsafe_functions.count(name)) {
+				exported.unsafe_functions.insert(name);
+			}
+		}
+	}
+	return exported;
+}
+
+std::string SemanticAnalyzer::qualifiedName(const std::string& function) const {
+	auto it = functions.find(function);
+	if (it == functions.end() || it->second.module.empty()) {
+		return function;
+	}
+	return it->second.module + "." + function;
+}
+
+void SemanticAnalyzer::error(antlr4::ParserRuleContext* ctx, std::string message) {
+	antlr4::Token* token = ctx->getStart();
+	errors.push_back({ token->getLine(), token->getCharPositionInLine(), std::move(message) });
+}
+
+Type SemanticAnalyzer::lookup(JP::IdentifierContext* ctx) {
+	std::string name = ctx->getText();
+	for (size_t i = scopes.size(); i > function_scope; i--) {
+		auto it = scopes[i - 1].find(name);
+		if (it != scopes[i - 1].end()) {
+			return it->second;
+		}
+	}
+
+	error(ctx, fmt::format("'{}' is not declared", name));
+	// Declared here so that the same name is reported only once
+	scopes.back()[name] = Type::Unknown;
+	return Type::Unknown;
+}
+
+void SemanticAnalyzer::declare(JP::IdentifierContext* ctx, Type type) {
+	if (!scopes.back().emplace(ctx->getText(), type).second) {
+		error(ctx, fmt::format("'{}' is already declared", ctx->getText()));
+	}
+}
+
+void SemanticAnalyzer::declareFunctions(antlr4::tree::ParseTree* tree) {
+	if (auto func_def = dynamic_cast<JP::FuncDefContext*>(tree)) {
+		FunctionSignature signature;
+		if (auto result_type = func_def->variableType()) {
+			signature.result = record(result_type, result_type->INT_TYPE() ? Type::Int
+				: result_type->FLOAT_TYPE() ? Type::Float : Type::Str);
+		}
+		if (auto args = func_def->argList()) {
+			for (auto arg : args->argument()) {
+				signature.args.push_back(argumentType(arg));
+			}
+		}
+
+		signature.module = module;
+
+		std::string name = func_def->identifier()->getText();
+		auto [it, added] = functions.emplace(name, signature);
+		if (!added && it->second.module != module) {
+			error(func_def->identifier(), fmt::format("function '{}' is already imported from module '{}'", name, it->second.module));
+		}
+		else if (!added) {
+			error(func_def->identifier(), fmt::format("function '{}' is already defined", name));
+		}
+	}
+	else if (auto import = dynamic_cast<JP::ImportStmtContext*>(tree)) {
+		// Statement, statement list, program. Imports anywhere else are reported by visitImportStmt.
+		if (dynamic_cast<JP::ProgContext*>(import->parent->parent->parent)) {
+			importFunctions(import);
+		}
+	}
+
+	for (auto child : tree->children) {
+		declareFunctions(child);
+	}
+}
+
+void SemanticAnalyzer::importFunctions(JP::ImportStmtContext* ctx) {
+	std::string name = ctx->identifier()->getText();
+	const ModuleInterface* imported = nullptr;
+	if (modules) {
+		auto it = modules->find(name);
+		imported = it == modules->end() ? nullptr : &it->second;
+	}
+	if (!imported) {
+		error(ctx, fmt::format("module '{}' is not available", name));
+		return;
+	}
+
+	// Importing a module twice adds its functions once
+	for (const auto& [function, signature] : imported->functions) {
+		auto [it, added] = functions.emplace(function, signature);
+		if (!added && it->second.module != signature.module) {
+			error(ctx, fmt::format("function '{}' of module '{}' is already defined{}", function, name,
+				it->second.module.empty() ? "" : fmt::format(" in module '{}'", it->second.module)));
+		}
+	}
+	unsafe_functions.insert(imported->unsafe_functions.begin(), imported->unsafe_functions.end());
+}
+
+void SemanticAnalyzer::findUnsafeFunctions(antlr4::tree::ParseTree* tree, const std::string& function,
+	std::unordered_map<std::string, std::vector<std::string>>& calls) {
+	const std::string* owner = &function;
+	std::string name;
+	if (auto func_def = dynamic_cast<JP::FuncDefContext*>(tree)) {
+		name = func_def->identifier()->getText();
+		owner = &name;
+	}
+	else if (!function.empty()) {
+		bool unsafe = dynamic_cast<JP::PrintStmtContext*>(tree) || dynamic_cast<JP::InputStmtContext*>(tree)
+			|| dynamic_cast<JP::ReadStmtContext*>(tree) || dynamic_cast<JP::RestoreStmtContext*>(tree);
+		if (unsafe) {
+			unsafe_functions.insert(function);
+		}
+		if (auto call = dynamic_cast<JP::FuncCallContext*>(tree)) {
+			calls[function].push_back(call->identifier()->getText());
+		}
+	}
+
+	for (auto child : tree->children) {
+		findUnsafeFunctions(child, *owner, calls);
+	}
+}
+
+size_t SemanticAnalyzer::scopeOf(const std::string& name) const {
+	for (size_t i = scopes.size(); i > function_scope; i--) {
+		if (scopes[i - 1].count(name)) {
+			return i - 1;
+		}
+	}
+	return SIZE_MAX;
+}
+
+void SemanticAnalyzer::checkParallelSafe(antlr4::ParserRuleContext* ctx, std::string_view statement) {
+	if (parallel_loop) {
+		error(ctx, fmt::format("{} can't be used in a parallel for", statement));
+	}
+}
+
+void SemanticAnalyzer::checkParallelWrite(JP::VariableAssignmentContext* ctx) {
+	std::string name = ctx->identifier()->getText();
+	size_t scope = scopeOf(name);
+	if (scope == parallel_loop->scope && name == parallel_loop->variable) {
+		error(ctx, fmt::format("parallel for can't assign its loop variable '{}'", name));
+		return;
+	}
+	if (scope == SIZE_MAX || scope >= parallel_loop->scope) {
+		return;
+	}
+
+	auto reduction = parallel_loop->reductions.find(name);
+	if (reduction == parallel_loop->reductions.end()) {
+		error(ctx, fmt::format("parallel for can't assign '{}', declared outside the loop: declare it in the loop or reduce it",
+			name));
+		return;
+	}
+
+	// Each thread updates a copy of its own, that only works for name = name op ...
+	const std::string& op = reduction->second;
+	std::vector<JP::ExpressionContext*> operands;
+	operandsOf(ctx->expression(), op, operands);
+	std::vector<JP::ExpressionContext*> reads;
+	for (auto operand : operands) {
+		auto identifier = dynamic_cast<JP::IdentifierExpressionContext*>(operand);
+		if (identifier && identifier->getText() == name) {
+			reads.push_back(operand);
+		}
+	}
+	// Partial strings are joined in chunk order after the partial of the chunks before, so a
+	// str can only be appended to
+	bool prepends = scopes[scope].at(name) == Type::Str && !reads.empty() && reads.front() != operands.front();
+	if (reads.size() != 1 || prepends) {
+		error(ctx, fmt::format("reduction variable '{}' must be updated as {} = {} {} ...", name, name, name, op));
+		return;
+	}
+	reduction_read = reads.front();
+}
+
+Type SemanticAnalyzer::record(antlr4::tree::ParseTree* ctx, Type type) {
+	types[ctx] = type;
+	return type;
+}
+
+Type SemanticAnalyzer::check(JP::ExpressionContext* ctx) {
+	return std::any_cast<Type>(visit(ctx));
+}
+
+void SemanticAnalyzer::checkIndex(JP::ExpressionContext* ctx) {
+	Type type = check(ctx);
+	if (type != Type::Unknown && type != Type::Int && type != Type::Bool && type != Type::Number) {
+		error(ctx, fmt::format("array index must be an int, got {}", typeName(type)));
+	}
+	convertNumber(ctx, Type::Int);
+}
+
+Type SemanticAnalyzer::lookupArray(JP::IdentifierContext* ctx) {
+	Type type = lookup(ctx);
+	if (type != Type::Unknown && !isArray(type)) {
+		error(ctx, fmt::format("'{}' is not an array", ctx->getText()));
+		return Type::Unknown;
+	}
+	return elementType(type);
+}
+
+void SemanticAnalyzer::checkAssignable(Type to, JP::ExpressionContext* ctx, antlr4::ParserRuleContext* where) {
+	Type from = check(ctx);
+	if (to == Type::Unknown || from == Type::Unknown || to == from) {
+		return;
+	}
+
+	if ((to == Type::Int || to == Type::Float) && isNumeric(from)) {
+		convertNumber(ctx, to);
+		return;
+	}
+
+	error(where, fmt::format("cannot use {} as {}", typeName(from), typeName(to)));
+}
+
+void SemanticAnalyzer::convertNumber(JP::ExpressionContext* ctx, Type to) {
+	// val() is converted straight to the type it is used as, no variant in between. An int
+	// is parsed as an int, never through float, so it keeps every digit as std::stoi did.
+	while (auto paren = dynamic_cast<JP::ParenExpressionContext*>(ctx)) {
+		ctx = paren->expression();
+	}
+	auto func_expr = dynamic_cast<JP::FuncExpressionContext*>(ctx);
+	if (func_expr && typeOf(func_expr) == Type::Number) {
+		record(func_expr->func(), to);
+	}
+}
+
+void SemanticAnalyzer::checkCondition(JP::ExpressionContext* ctx) {
+	Type type = check(ctx);
+	if (type != Type::Unknown && !isNumeric(type)) {
+		error(ctx, fmt::format("condition must be a number, got {}", typeName(type)));
+	}
+	convertNumber(ctx, Type::Float);
+}
+
+Type SemanticAnalyzer::arithmetic(antlr4::ParserRuleContext* ctx, JP::ExpressionContext* lhs, JP::ExpressionContext* rhs,
+	const std::string& op) {
+	Type left = check(lhs);
+	Type right = check(rhs);
+
+	if (left == Type::Unknown || right == Type::Unknown) {
+		return record(ctx, Type::Unknown);
+	}
+	if (op == "+" && left == Type::Str && right == Type::Str) {
+		return record(ctx, Type::Str);
+	}
+	if (!isNumeric(left) || !isNumeric(right)) {
+		error(ctx, fmt::format("operator '{}' needs numbers, got {} and {}", op, typeName(left), typeName(right)));
+		return record(ctx, Type::Unknown);
+	}
+
+	// val() mixed into arithmetic is computed as float
+	convertNumber(lhs, Type::Float);
+	convertNumber(rhs, Type::Float);
+	bool integral = (left == Type::Int || left == Type::Bool) && (right == Type::Int || right == Type::Bool);
+	return record(ctx, integral ? Type::Int : Type::Float);
+}
+
+// Statements
+
+std::any SemanticAnalyzer::visitStmtList(JP::StmtListContext* ctx) {
+	for (auto stmt : ctx->statement()) {
+		visit(stmt);
+	}
+	return std::any();
+}
+
+std::any SemanticAnalyzer::visitVariableDecl(JP::VariableDeclContext* ctx) {
+	auto type_ctx = ctx->variableType();
+	Type type = record(type_ctx, type_ctx->INT_TYPE() ? Type::Int : type_ctx->FLOAT_TYPE() ? Type::Float : Type::Str);
+
+	// The initializer can't see the variable it initializes
+	auto literal_expr = dynamic_cast<JP::LiteralExpressionContext*>(ctx->expression());
+	if (literal_expr && literal_expr->literal()->NOTHING()) {
+		record(literal_expr, Type::Nothing);
+	}
+	else {
+		checkAssignable(type, ctx->expression(), ctx);
+	}
+
+	declare(ctx->identifier(), type);
+	return std::any();
+}
+
+std::any SemanticAnalyzer::visitArrayDecl(JP::ArrayDeclContext* ctx) {
+	Type type = record(ctx->variableType(), declaredType(ctx->variableType()));
+
+	Type size = check(ctx->expression());
+	if (size != Type::Unknown && size != Type::Int && size != Type::Bool && size != Type::Number) {
+		error(ctx->expression(), fmt::format("array size must be an int, got {}", typeName(size)));
+	}
+	convertNumber(ctx->expression(), Type::Int);
+
+	declare(ctx->identifier(), arrayOf(type));
+	return std::any();
+}
+
+std::any SemanticAnalyzer::visitVariableAssignmentStmt(JP::VariableAssignmentStmtContext* ctx) {
+	visit(ctx->variableAssignment());
+	return std::any();
+}
+
+std::any SemanticAnalyzer::visitElementAssignmentStmt(JP::ElementAssignmentStmtContext* ctx) {
+	visit(ctx->elementAssignment());
+	return std::any();
+}
+
+std::any SemanticAnalyzer::visitPrintStmt(JP::PrintStmtContext* ctx) {
+	checkParallelSafe(ctx, "PRINT");
+	if (auto print_list = ctx->printList()) {
+		for (auto expr : print_list->expression()) {
+			if (isArray(check(expr))) {
+				error(expr, "an array can't be printed, print its elements");
+			}
+		}
+	}
+	return std::any();
+}
+
+std::any SemanticAnalyzer::visitForStmt(JP::ForStmtContext* ctx) {
+	bool parallel = ctx->PARALLEL() != nullptr;
+
+	// Reductions name variables declared before the loop
+	ParallelLoop loop;
+	loop.scope = scopes.size();
+	if (!parallel && !ctx->reduceClause().empty()) {
+		error(ctx, "reduce needs a parallel for");
+	}
+	for (auto reduce : ctx->reduceClause()) {
+		std::string op = reduce->PLUS() ? "+" : "*";
+		Type type = record(reduce, lookup(reduce->identifier()));
+		bool reducible = type == Type::Unknown || type == Type::Int || type == Type::Float || (op == "+" && type == Type::Str);
+		if (!reducible) {
+			error(reduce, fmt::format("can't reduce {} with '{}'", typeName(type), op));
+		}
+		if (!loop.reductions.emplace(reduce->identifier()->getText(), op).second) {
+			error(reduce, fmt::format("'{}' is reduced twice", reduce->identifier()->getText()));
+		}
+	}
+
+	// The loop variable and the body share one scope, like in C++
+	scopes.emplace_back();
+
+	Type type;
+	if (auto variable_decl = ctx->variableDecl()) {
+		visit(variable_decl);
+		type = lookup(variable_decl->identifier());
+		loop.variable = variable_decl->identifier()->getText();
+	}
+	else {
+		type = std::any_cast<Type>(visit(ctx->variableAssignment()));
+		if (parallel) {
+			error(ctx, "parallel for must declare its loop variable");
+		}
+	}
+	if (type != Type::Unknown && type != Type::Int && type != Type::Float) {
+		error(ctx, fmt::format("for loop variable must be int or float, got {}", typeName(type)));
+	}
+	else if (parallel && type == Type::Float) {
+		error(ctx, "parallel for loop variable must be int, got float");
+	}
+
+	for (auto expr : ctx->expression()) {
+		Type bound = check(expr);
+		if (bound != Type::Unknown && !isNumeric(bound)) {
+			error(expr, fmt::format("for loop limit and step must be numbers, got {}", typeName(bound)));
+		}
+		else if (parallel && expr == ctx->expression(1) && bound == Type::Float) {
+			error(expr, "parallel for step must be an int, got float");
+		}
+		convertNumber(expr, type == Type::Int ? Type::Int : Type::Float);
+	}
+
+	const ParallelLoop* enclosing_loop = parallel_loop;
+	if (parallel) {
+		parallel_loop = &loop;
+	}
+	visit(ctx->stmtList());
+	parallel_loop = enclosing_loop;
+
+	scopes.pop_back();
+	return std::any();
+}
+
+std::any SemanticAnalyzer::visitIfStmt(JP::IfStmtContext* ctx) {
+	checkCondition(ctx->expression());
+
+	for (auto stmt_list : ctx->stmtList()) {
+		scopes.emplace_back();
+		visit(stmt_list);
+		scopes.pop_back();
+	}
+	return std::any();
+}
+
+std::any SemanticAnalyzer::visitDataStmt(JP::DataStmtContext* ctx) {
+	JP::UnaryContext* sign = nullptr;
+	for (const auto& child : ctx->dataList()->children) {
+		if (auto unary = dynamic_cast<JP::UnaryContext*>(child)) {
+			sign = unary;
+		}
+		auto literal = dynamic_cast<JP::LiteralContext*>(child);
+		if (!literal) {
+			continue;
+		}
+		if (literal->NOTHING()) {
+			error(literal, "DATA can't hold Nothing");
+		}
+		else if (literal->STRINGLITERAL() && sign) {
+			error(literal, "a str in DATA can't have a sign");
+		}
+		else if (literal->NUMBER() && literal->getText().find('E') == std::string::npos) {
+			// The tables store a C++ int
+			double limit = sign && sign->getText() == "-" ? 2147483648.0 : 2147483647.0;
+			if (std::stod(literal->getText()) > limit) {
+				error(literal, fmt::format("{} does not fit an int", literal->getText()));
+			}
+		}
+		sign = nullptr;
+	}
+	return std::any();
+}
+
+std::any SemanticAnalyzer::visitReadStmt(JP::ReadStmtContext* ctx) {
+	checkParallelSafe(ctx, "READ");
+	if (isArray(lookup(ctx->identifier()))) {
+		error(ctx, "READ can't read into an array");
+	}
+	return std::any();
+}
+
+std::any SemanticAnalyzer::visitRestoreStmt(JP::RestoreStmtContext* ctx) {
+	checkParallelSafe(ctx, "RESTORE");
+	return std::any();
+}
+
+std::any SemanticAnalyzer::visitInputStmt(JP::InputStmtContext* ctx) {
+	checkParallelSafe(ctx, "INPUT");
+	Type type = lookup(ctx->identifier());
+	if (isArray(type)) {
+		error(ctx, "INPUT can't read into an array");
+		type = Type::Unknown;
+	}
+	if (auto default_expr = ctx->expression()) {
+		checkAssignable(type, default_expr, default_expr);
+	}
+	return std::any();
+}
+
+std::any SemanticAnalyzer::visitFuncDef(JP::FuncDefContext* ctx) {
+	const FunctionSignature* enclosing_function = current_function;
+	size_t enclosing_scope = function_scope;
+	// A function defined in a parallel for is not part of the loop body
+	const ParallelLoop* enclosing_loop = parallel_loop;
+	parallel_loop = nullptr;
+
+	std::string name = ctx->identifier()->getText();
+	current_function = &functions[name];
+	function_scope = scopes.size();
+	scopes.emplace_back();
+
+	// Cached results must be all a call does, and the arguments must be values to key them by
+	if (ctx->MEMO()) {
+		if (current_function->result == Type::Void) {
+			error(ctx->identifier(), fmt::format("memo func '{}' must return a value", name));
+		}
+		if (std::any_of(current_function->args.begin(), current_function->args.end(), isArray)) {
+			error(ctx->identifier(), fmt::format("memo func '{}' can't take arrays", name));
+		}
+		if (unsafe_functions.count(name)) {
+			error(ctx->identifier(), fmt::format("memo func '{}' can't use PRINT, INPUT, READ or RESTORE", name));
+		}
+	}
+
+	if (auto args = ctx->argList()) {
+		for (auto arg : args->argument()) {
+			declare(arg->identifier(), record(arg->variableType(), argumentType(arg)));
+		}
+	}
+	visit(ctx->stmtList());
+
+	scopes.pop_back();
+	parallel_loop = enclosing_loop;
+	function_scope = enclosing_scope;
+	current_function = enclosing_function;
+	return std::any();
+}
+
+std::any SemanticAnalyzer::visitImportStmt(JP::ImportStmtContext* ctx) {
+	// The functions were imported before the program was checked
+	if (current_function || scopes.size() > 1) {
+		error(ctx, "import is only allowed at the top level of a file");
+	}
+	return std::any();
+}
+
+std::any SemanticAnalyzer::visitFuncCallStmt(JP::FuncCallStmtContext* ctx) {
+	visit(ctx->funcCall());
+	return std::any();
+}
+
+std::any SemanticAnalyzer::visitFuncStmt(JP::FuncStmtContext* ctx) {
+	visit(ctx->func());
+	return std::any();
+}
+
+std::any SemanticAnalyzer::visitReturnStmt(JP::ReturnStmtContext* ctx) {
+	if (!current_function) {
+		error(ctx, "return outside a function");
+		return std::any();
+	}
+	checkParallelSafe(ctx, "return");
+
+	auto expr = ctx->expression();
+	if (current_function->result == Type::Void) {
+		if (expr) {
+			error(ctx, "function without a return type can't return a value");
+		}
+	}
+	else if (!expr) {
+		error(ctx, fmt::format("function must return {}", typeName(current_function->result)));
+	}
+	else {
+		checkAssignable(current_function->result, expr, ctx);
+	}
+	return std::any();
+}
+
+// Expressions
+
+std::any SemanticAnalyzer::visitFuncCallExpression(JP::FuncCallExpressionContext* ctx) {
+	Type type = std::any_cast<Type>(visit(ctx->funcCall()));
+	if (type == Type::Void) {
+		error(ctx, fmt::format("function '{}' does not return a value", ctx->funcCall()->identifier()->getText()));
+		type = Type::Unknown;
+	}
+	return record(ctx, type);
+}
+
+std::any SemanticAnalyzer::visitFuncExpression(JP::FuncExpressionContext* ctx) {
+	return record(ctx, std::any_cast<Type>(visit(ctx->func())));
+}
+
+std::any SemanticAnalyzer::visitParenExpression(JP::ParenExpressionContext* ctx) {
+	return record(ctx, check(ctx->expression()));
+}
+
+std::any SemanticAnalyzer::visitExponentExpression(JP::ExponentExpressionContext* ctx) {
+	// int ^ int stays an int (ipow), anything with a float is computed with std::pow
+	return record(ctx, arithmetic(ctx, ctx->expression(0), ctx->expression(1), "^"));
+}
+
+std::any SemanticAnalyzer::visitUnaryExpression(JP::UnaryExpressionContext* ctx) {
+	Type type = check(ctx->expression());
+	if (type == Type::Unknown) {
+		return record(ctx, type);
+	}
+	if (!isNumeric(type)) {
+		error(ctx, fmt::format("operator '{}' needs a number, got {}", ctx->NOT() ? "not" : ctx->unary()->getText(), typeName(type)));
+		return record(ctx, Type::Unknown);
+	}
+
+	convertNumber(ctx->expression(), Type::Float);
+	if (ctx->NOT()) {
+		return record(ctx, Type::Bool);
+	}
+	return record(ctx, type == Type::Bool ? Type::Int : type == Type::Number ? Type::Float : type);
+}
+
+std::any SemanticAnalyzer::visitMultiplyingExpression(JP::MultiplyingExpressionContext* ctx) {
+	return arithmetic(ctx, ctx->expression(0), ctx->expression(1), ctx->TIMES() ? "*" : ctx->DIV() ? "/" : "%");
+}
+
+std::any SemanticAnalyzer::visitAddingExpression(JP::AddingExpressionContext* ctx) {
+	return arithmetic(ctx, ctx->expression(0), ctx->expression(1), ctx->PLUS() ? "+" : "-");
+}
+
+std::any SemanticAnalyzer::visitRelationalExpression(JP::RelationalExpressionContext* ctx) {
+	Type left = check(ctx->expression(0));
+	Type right = check(ctx->expression(1));
+
+	bool comparable = left == Type::Unknown || right == Type::Unknown
+		|| (isNumeric(left) && isNumeric(right)) || (left == Type::Str && right == Type::Str);
+	if (!comparable) {
+		error(ctx, fmt::format("cannot compare {} with {}", typeName(left), typeName(right)));
+	}
+	convertNumber(ctx->expression(0), Type::Float);
+	convertNumber(ctx->expression(1), Type::Float);
+	return record(ctx, Type::Bool);
+}
+
+std::any SemanticAnalyzer::visitLogicalExpression(JP::LogicalExpressionContext* ctx) {
+	checkCondition(ctx->expression(0));
+	checkCondition(ctx->expression(1));
+	return record(ctx, Type::Bool);
+}
+
+std::any SemanticAnalyzer::visitVariableAssignmentExpression(JP::VariableAssignmentExpressionContext* ctx) {
+	return record(ctx, std::any_cast<Type>(visit(ctx->variableAssignment())));
+}
+
+std::any SemanticAnalyzer::visitElementAssignmentExpression(JP::ElementAssignmentExpressionContext* ctx) {
+	return record(ctx, std::any_cast<Type>(visit(ctx->elementAssignment())));
+}
+
+std::any SemanticAnalyzer::visitIndexExpression(JP::IndexExpressionContext* ctx) {
+	Type type = lookupArray(ctx->identifier());
+	checkIndex(ctx->expression());
+	return record(ctx, type);
+}
+
+std::any SemanticAnalyzer::visitIdentifierExpression(JP::IdentifierExpressionContext* ctx) {
+	Type type = lookup(ctx->identifier());
+	if (parallel_loop && ctx != reduction_read) {
+		std::string name = ctx->identifier()->getText();
+		if (parallel_loop->reductions.count(name) && scopeOf(name) < parallel_loop->scope) {
+			error(ctx, fmt::format("reduction variable '{}' can only be read in its update", name));
+		}
+	}
+	return record(ctx, type);
+}
+
+std::any SemanticAnalyzer::visitLiteralExpression(JP::LiteralExpressionContext* ctx) {
+	JP::LiteralContext* literal = ctx->literal();
+	if (literal->STRINGLITERAL()) {
+		return record(ctx, Type::Str);
+	}
+	if (literal->FLOAT()) {
+		return record(ctx, Type::Float);
+	}
+	if (literal->NUMBER()) {
+		// 1E5 is a double in C++
+		return record(ctx, literal->getText().find('E') == std::string::npos ? Type::Int : Type::Float);
+	}
+
+	error(ctx, "Nothing can only initialize a variable");
+	return record(ctx, Type::Unknown);
+}
+
+std::any SemanticAnalyzer::visitVariableAssignment(JP::VariableAssignmentContext* ctx) {
+	Type type = lookup(ctx->identifier());
+	if (isArray(type)) {
+		error(ctx, "an array can't be assigned, assign its elements");
+		check(ctx->expression());
+		return record(ctx, Type::Unknown);
+	}
+	if (parallel_loop) {
+		checkParallelWrite(ctx);
+	}
+	checkAssignable(type, ctx->expression(), ctx);
+	reduction_read = nullptr;
+	return record(ctx, type);
+}
+
+std::any SemanticAnalyzer::visitElementAssignment(JP::ElementAssignmentContext* ctx) {
+	Type type = lookupArray(ctx->identifier());
+	checkIndex(ctx->expression(0));
+	checkAssignable(type, ctx->expression(1), ctx);
+	return record(ctx, type);
+}
+
+std::any SemanticAnalyzer::visitFuncCall(JP::FuncCallContext* ctx) {
+	std::string name = ctx->identifier()->getText();
+	std::vector<JP::ExpressionContext*> params;
+	if (auto param_list = ctx->paramList()) {
+		params = param_list->expression();
+	}
+
+	auto it = functions.find(name);
+	if (it == functions.end()) {
+		error(ctx, fmt::format("function '{}' is not defined", name));
+		for (auto param : params) {
+			check(param);
+		}
+		return record(ctx, Type::Unknown);
+	}
+
+	if (parallel_loop && unsafe_functions.count(name)) {
+		error(ctx, fmt::format("parallel for can't call '{}', it uses PRINT, INPUT, READ or RESTORE", name));
+	}
+
+	const FunctionSignature& signature = it->second;
+	if (params.size() != signature.args.size()) {
+		error(ctx, fmt::format("function '{}' takes {} arguments, got {}", name, signature.args.size(), params.size()));
+	}
+	for (size_t i = 0; i < params.size(); i++) {
+		if (i < signature.args.size()) {
+			checkAssignable(signature.args[i], params[i], params[i]);
+		}
+		else {
+			check(params[i]);
+		}
+	}
+
+	return record(ctx, signature.result);
+}
+
+std::any SemanticAnalyzer::visitValFunc(JP::ValFuncContext* ctx) {
+	Type type = check(ctx->expression());
+	if (type != Type::Unknown && type != Type::Str) {
+		error(ctx, fmt::format("val() needs a str, got {}", typeName(type)));
+	}
+	return record(ctx, Type::Number);
+}
@@ -0,0 +1,189 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "antlr4-runtime.h"
+#include "JagleLexer.h"
+#include "JagleBaseVisitor.h"
+
+using namespace jagle;
+using JP = JagleParser;
+
+// Static type of an expression
+enum class Type {
+	// Not known, the expression had an error already reported. Compatible with everything
+	// so that one mistake is not reported over and over.
+	Unknown,
+	Int,
+	Float,
+	Str,
+	// Result of relational and logical operators, converts to int and float
+	Bool,
+	// Result of val(), int or float decided at run time
+	Number,
+	Nothing,
+	Void,
+	// Arrays of int, float and str
+	IntArray,
+	FloatArray,
+	StrArray,
+};
+
+std::string_view typeName(Type type);
+
+bool isArray(Type type);
+// Type of the elements of an array type
+Type elementType(Type array);
+// Array type of the elements of type element
+Type arrayOf(Type element);
+
+struct SemanticError {
+	size_t line = 0;
+	size_t column = 0;
+	std::string message;
+
+	std::string describe() const;
+};
+
+struct FunctionSignature {
+	Type result = Type::Void;
+	std::vector<Type> args;
+	// Module the function is defined in, empty for the main program
+	std::string module;
+};
+
+// Functions a module makes callable in the files that import it
+struct ModuleInterface {
+	std::unordered_map<std::string, FunctionSignature> functions;
+	// Functions that use PRINT, INPUT, READ or RESTORE, themselves or through a call
+	std::unordered_set<std::string> unsafe_functions;
+};
+
+// Resolves names and infers a static type for every expression before code is generated.
+// Errors are collected, the whole program is checked. Types are recorded per parse tree
+// node, the generator asks for them with typeOf().
+class SemanticAnalyzer : public JagleBaseVisitor {
+private:
+	using Scope = std::unordered_map<std::string, Type>;
+
+	// Innermost scope last. A function body only sees scopes from function_scope on,
+	// generated functions can't reach the variables of main or of an enclosing function.
+	std::vector<Scope> scopes;
+	size_t function_scope = 0;
+	const FunctionSignature* current_function = nullptr;
+
+	// Parallel for whose body is being checked. Its iterations run on many threads, so the
+	// body can't write scalars declared outside the loop, except its reductions, or use the
+	// runtime's global state.
+	struct ParallelLoop {
+		// Scopes from this one on are inside the loop
+		size_t scope = 0;
+		std::string variable;
+		// Reduction variable and its operator, "+" or "*"
+		std::unordered_map<std::string, std::string> reductions;
+	};
+	const ParallelLoop* parallel_loop = nullptr;
+	// The one read of a reduction variable allowed, in its own update
+	const antlr4::tree::ParseTree* reduction_read = nullptr;
+
+	std::unordered_map<std::string, FunctionSignature> functions;
+	// Functions that use PRINT, INPUT, READ or RESTORE, themselves or through a call
+	std::unordered_set<std::string> unsafe_functions;
+	std::unordered_map<const antlr4::tree::ParseTree*, Type> types;
+	std::vector<SemanticError> errors;
+
+	// Module being analyzed, empty for the main program. A module only defines functions
+	// and imports other modules.
+	std::string module;
+	// Interfaces import statements resolve to
+	const std::unordered_map<std::string, ModuleInterface>* modules = nullptr;
+
+	void error(antlr4::ParserRuleContext* ctx, std::string message);
+
+	Type lookup(JP::IdentifierContext* ctx);
+	void declare(JP::IdentifierContext* ctx, Type type);
+	void declareFunctions(antlr4::tree::ParseTree* tree);
+	void importFunctions(JP::ImportStmtContext* ctx);
+	void findUnsafeFunctions(antlr4::tree::ParseTree* tree, const std::string& function,
+		std::unordered_map<std::string, std::vector<std::string>>& calls);
+	// Index of the scope name resolves to, SIZE_MAX when it is not declared
+	size_t scopeOf(const std::string& name) const;
+	// Reports a statement that uses the runtime's global state inside a parallel for
+	void checkParallelSafe(antlr4::ParserRuleContext* ctx, std::string_view statement);
+	void checkParallelWrite(JP::VariableAssignmentContext* ctx);
+
+	Type check(JP::ExpressionContext* ctx);
+	// Checks that an expression can index an array
+	void checkIndex(JP::ExpressionContext* ctx);
+	// Element type of the array named by ctx
+	Type lookupArray(JP::IdentifierContext* ctx);
+	// Checks that a value of expression ctx can be stored into a variable of type to
+	void checkAssignable(Type to, JP::ExpressionContext* ctx, antlr4::ParserRuleContext* where);
+	// Gives a val() call in ctx the concrete type it is used as
+	void convertNumber(JP::ExpressionContext* ctx, Type to);
+	void checkCondition(JP::ExpressionContext* ctx);
+	Type arithmetic(antlr4::ParserRuleContext* ctx, JP::ExpressionContext* lhs, JP::ExpressionContext* rhs,
+		const std::string& op);
+	Type record(antlr4::tree::ParseTree* ctx, Type type);
+
+public:
+	SemanticAnalyzer() = default;
+	// Analyzes the module of that name, or the main program when it is empty. Imports
+	// resolve to the interfaces in modules.
+	SemanticAnalyzer(std::string module, const std::unordered_map<std::string, ModuleInterface>* modules)
+		: module(std::move(module)), modules(modules) {}
+
+	// Returns true when the program is well typed
+	bool analyze(JP::ProgContext* ctx);
+
+	// Functions the analyzed file defines, for the files that import it
+	ModuleInterface exports() const;
+	// Name of a function in the IR: "module.function" for the functions of modules
+	std::string qualifiedName(const std::string& function) const;
+
+	Type typeOf(const antlr4::tree::ParseTree* ctx) const;
+	const std::vector<SemanticError>& getErrors() const;
+
+	// Statements
+	std::any visitStmtList(JP::StmtListContext* ctx) override;
+	std::any visitVariableDecl(JP::VariableDeclContext* ctx) override;
+	std::any visitArrayDecl(JP::ArrayDeclContext* ctx) override;
+	std::any visitVariableAssignmentStmt(JP::VariableAssignmentStmtContext* ctx) override;
+	std::any visitElementAssignmentStmt(JP::ElementAssignmentStmtContext* ctx) override;
+	std::any visitPrintStmt(JP::PrintStmtContext* ctx) override;
+	std::any visitForStmt(JP::ForStmtContext* ctx) override;
+	std::any visitIfStmt(JP::IfStmtContext* ctx) override;
+	std::any visitDataStmt(JP::DataStmtContext* ctx) override;
+	std::any visitReadStmt(JP::ReadStmtContext* ctx) override;
+	std::any visitRestoreStmt(JP::RestoreStmtContext* ctx) override;
+	std::any visitInputStmt(JP::InputStmtContext* ctx) override;
+	std::any visitFuncDef(JP::FuncDefContext* ctx) override;
+	std::any visitFuncCallStmt(JP::FuncCallStmtContext* ctx) override;
+	std::any visitFuncStmt(JP::FuncStmtContext* ctx) override;
+	std::any visitReturnStmt(JP::ReturnStmtContext* ctx) override;
+	std::any visitImportStmt(JP::ImportStmtContext* ctx) override;
+
+	// Expressions, return the Type
+	std::any visitFuncCallExpression(JP::FuncCallExpressionContext* ctx) override;
+	std::any visitFuncExpression(JP::FuncExpressionContext* ctx) override;
+	std::any visitParenExpression(JP::ParenExpressionContext* ctx) override;
+	std::any visitExponentExpression(JP::ExponentExpressionContext* ctx) override;
+	std::any visitUnaryExpression(JP::UnaryExpressionContext* ctx) override;
+	std::any visitMultiplyingExpression(JP::MultiplyingExpressionContext* ctx) override;
+	std::any visitAddingExpression(JP::AddingExpressionContext* ctx) override;
+	std::any visitRelationalExpression(JP::RelationalExpressionContext* ctx) override;
+	std::any visitLogicalExpression(JP::LogicalExpressionContext* ctx) override;
+	std::any visitVariableAssignmentExpression(JP::VariableAssignmentExpressionContext* ctx) override;
+	std::any visitElementAssignmentExpression(JP::ElementAssignmentExpressionContext* ctx) override;
+	std::any visitIndexExpression(JP::IndexExpressionContext* ctx) override;
+	std::any visitIdentifierExpression(JP::IdentifierExpressionContext* ctx) override;
+	std::any visitLiteralExpression(JP::LiteralExpressionContext* ctx) override;
+	std::any visitVariableAssignment(JP::VariableAssignmentContext* ctx) override;
+	std::any visitElementAssignment(JP::ElementAssignmentContext* ctx) override;
+	std::any visitFuncCall(JP::FuncCallContext* ctx) override;
+	std::any visitValFunc(JP::ValFuncContext* ctx) override;
+};
@@ -0,0 +1,71 @@
+#include "source.h"
+
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+SourceFile::~SourceFile() {
+#ifndef _WIN32
+	if (mapping_) {
+		munmap(mapping_, text_.size());
+	}
+#endif
+}
+
+bool SourceFile::open(const std::string& file_name) {
+#ifndef _WIN32
+	int fd = ::open(file_name.c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		return false;
+	}
+	struct stat status;
+	if (fstat(fd, &status) == 0 && S_ISREG(status.st_mode) && status.st_size > 0) {
+		void* mapping = mmap(nullptr, status.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (mapping != MAP_FAILED) {
+			// The lexer goes through the file once from start to end
+			madvise(mapping, status.st_size, MADV_SEQUENTIAL);
+			close(fd);
+			mapping_ = mapping;
+			text_ = std::string_view(static_cast<const char*>(mapping), status.st_size);
+			return true;
+		}
+	}
+	close(fd);
+#endif
+
+	// Empty files, pipes and platforms without mmap
+	std::ifstream file(file_name, std::ios::binary);
+	if (!file.is_open()) {
+		return false;
+	}
+	std::ostringstream contents;
+	contents << file.rdbuf();
+	contents_ = contents.str();
+	text_ = contents_;
+	return true;
+}
+
+bool SourceFile::isAscii() const {
+	// Or of eight bytes at a time, a set top bit anywhere is a non-ASCII byte
+	const char* data = text_.data();
+	size_t size = text_.size();
+	uint64_t bits = 0;
+	size_t i = 0;
+	for (; i + 8 <= size; i += 8) {
+		uint64_t word;
+		std::memcpy(&word, data + i, 8);
+		bits |= word;
+	}
+	for (; i < size; i++) {
+		bits |= static_cast<unsigned char>(data[i]);
+	}
+	return (bits & 0x8080808080808080ull) == 0;
+}
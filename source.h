@@ -0,0 +1,100 @@
+#pragma once
+
+#include <algorithm>
+#include <string>
+#include <string_view>
+
+#include "antlr4-runtime.h"
+
+// Contents of a source file, memory-mapped where the platform supports it and read into
+// memory elsewhere. The text stays valid until the file is destroyed.
+class SourceFile {
+public:
+	SourceFile() = default;
+	SourceFile(const SourceFile&) = delete;
+	SourceFile& operator=(const SourceFile&) = delete;
+	~SourceFile();
+
+	// Returns false when the file can't be opened
+	bool open(const std::string& file_name);
+
+	std::string_view text() const {
+		return text_;
+	}
+
+	// No byte of the text is above 0x7f, each one is a character
+	bool isAscii() const;
+
+private:
+	std::string_view text_;
+	// Contents when the file is read instead of mapped
+	std::string contents_;
+	void* mapping_ = nullptr;
+};
+
+// Character stream the lexer reads ASCII text through in place. ANTLRInputStream decodes
+// its input into a UTF-32 copy, four bytes per character. The text must outlive the stream
+// and every token of it.
+class AsciiCharStream : public antlr4::CharStream {
+public:
+	AsciiCharStream(std::string_view text, std::string name) : text(text), name(std::move(name)) {}
+
+	void consume() override {
+		if (p < text.size()) {
+			p++;
+		}
+	}
+
+	size_t LA(ssize_t i) override {
+		if (i == 0) {
+			return 0;
+		}
+		// LA(-1) is the character before the current one
+		ssize_t position = static_cast<ssize_t>(p) + (i < 0 ? i : i - 1);
+		if (position < 0 || position >= static_cast<ssize_t>(text.size())) {
+			return antlr4::IntStream::EOF;
+		}
+		return static_cast<unsigned char>(text[position]);
+	}
+
+	// Everything stays in memory, marks are not needed
+	ssize_t mark() override {
+		return -1;
+	}
+
+	void release(ssize_t) override {
+	}
+
+	size_t index() override {
+		return p;
+	}
+
+	void seek(size_t index) override {
+		p = std::min(index, text.size());
+	}
+
+	size_t size() override {
+		return text.size();
+	}
+
+	std::string getSourceName() const override {
+		return name;
+	}
+
+	std::string getText(const antlr4::misc::Interval& interval) override {
+		if (interval.a < 0 || interval.b < interval.a || static_cast<size_t>(interval.a) >= text.size()) {
+			return "";
+		}
+		size_t stop = std::min(static_cast<size_t>(interval.b), text.size() - 1);
+		return std::string(text.substr(interval.a, stop - interval.a + 1));
+	}
+
+	std::string toString() const override {
+		return std::string(text);
+	}
+
+private:
+	std::string_view text;
+	std::string name;
+	size_t p = 0;
+};
@@ -1,17 +1,38 @@
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <thread>
 
 #include "antlr4-runtime.h"
 #include "JagleLexer.h"
 #include "JagleParser.h"
 
+#include "bytecode.h"
+#include "driver.h"
+#include "ir_builder.h"
+#include "jagle.hpp"
+#include "process.h"
+#include "semantic.h"
+#include "source.h"
 #include "visitor.h"
+#include "vm.h"
 
+#include <catch2/benchmark/catch_benchmark.hpp>
 #include <catch2/catch_test_macros.hpp>
 
+#ifdef JAGLE_HAS_SPAWN
+#include <sys/wait.h>
+#endif
+
 class VisitorTestsFixture {
 public:
 	VisitorTestsFixture(const std::string& inputStr) : input(inputStr), lexer(&input), tokens(&lexer), parser(&tokens) {
-		// Set the error handler to BailErrorStrategy
-		parser.setErrorHandler(std::make_shared<antlr4::BailErrorStrategy>());
+	}
+
+	// Parse the same way the driver does: SLL first, LL when that fails
+	jagle::JagleParser::ProgContext* prog(PredictionMode mode = PredictionMode::Auto) {
+		return parseProgram(parser, mode);
 	}
 
 	antlr4::ANTLRInputStream input;
@@ -26,7 +47,7 @@ TEST_CASE("variable declaration, assign int", "[statement]") {
 
 	GeneratingVisitor visitor;
 
-	auto result = visitor.visit(fixture.parser.prog());
+	auto result = visitor.visit(fixture.prog());
 	std::string program = visitor.getStatements();
 
 	REQUIRE(program == "int _jagle_a = 1;\n");
@@ -38,7 +59,7 @@ TEST_CASE("variable declaration, assign float", "[statement]") {
 
 	GeneratingVisitor visitor;
 
-	auto result = visitor.visit(fixture.parser.prog());
+	auto result = visitor.visit(fixture.prog());
 	std::string program = visitor.getStatements();
 
 	REQUIRE(program == "float _jagle_b = 1.0;\n");
@@ -50,8 +71,1297 @@ TEST_CASE("variable declaration, assign str", "[statement]") {
 
 	GeneratingVisitor visitor;
 
-	auto result = visitor.visit(fixture.parser.prog());
+	auto result = visitor.visit(fixture.prog());
 	std::string program = visitor.getStatements();
 
 	REQUIRE(program == "std::string _jagle_c = \"xyzzy\";\n");
 }
+
+TEST_CASE("if statement with else", "[statement]") {
+	const std::string inputStr = "if a > 1 then\na = 1\nelse\na = 2\nendif";
+	VisitorTestsFixture fixture(inputStr);
+
+	GeneratingVisitor visitor;
+
+	auto result = visitor.visit(fixture.prog());
+	std::string program = visitor.getStatements();
+
+	REQUIRE(program == "if (_jagle_a > 1) {\n_jagle_a = 1;\n}\nelse {\n_jagle_a = 2;\n}\n");
+}
+
+TEST_CASE("function declaration and body", "[function]") {
+	const std::string inputStr = "func add(a: int, b: int): int\nreturn a + b\nendfunc\nprint add(1, 2)";
+	VisitorTestsFixture fixture(inputStr);
+
+	GeneratingVisitor visitor;
+
+	auto result = visitor.visit(fixture.prog());
+
+	REQUIRE(visitor.getFuncDecls() == "inline int _func_jagle_add(int _jagle_a, int _jagle_b);");
+	REQUIRE(visitor.getFuncBodies() == "inline int _func_jagle_add(int _jagle_a, int _jagle_b) {\nreturn _jagle_a + _jagle_b;\n}\n");
+	REQUIRE(visitor.getStatements() == "_jagle_out << _func_jagle_add(1, 2) << '\\n'; \n");
+}
+
+TEST_CASE("memo funcs cache their results, pure functions are constexpr or inline", "[function]") {
+	VisitorTestsFixture fixture("memo func fib(n: int): int\nif n < 2 then\nreturn n\nendif\nreturn fib(n - 1) + fib(n - 2)\nendfunc\n"
+		"func sq(x: int): int\nreturn x * x\nendfunc\nfunc tag(s: str): str\nreturn s + \"#\"\nendfunc\n"
+		"func show(x: int): int\nprint x\nreturn x\nendfunc\n"
+		"print fib(30); sq(3); tag(\"a\"); show(1)");
+	auto tree = fixture.prog();
+	SemanticAnalyzer semantic;
+	REQUIRE(semantic.analyze(tree));
+	GeneratingVisitor visitor(&semantic, PassOptions::none());
+	visitor.visit(tree);
+
+	REQUIRE(visitor.getFuncDecls() ==
+		"int _func_jagle_fib(int _jagle_n);\n"
+		"constexpr int _func_jagle_sq(int _jagle_x);\n"
+		"inline std::string _func_jagle_tag(std::string _jagle_s);\n"
+		"int _func_jagle_show(int _jagle_x);");
+	REQUIRE(visitor.getFuncBodies().find(
+		"int _func_jagle_fib(int _jagle_n) {\n"
+		"static thread_local MemoCache<int, int> _jagle_memo(1048576);\n"
+		"return _jagle_memo.get([&]() -> int {\n") == 0);
+	REQUIRE(visitor.getFuncBodies().find("}, _jagle_n);\n}\n") != std::string::npos);
+}
+
+TEST_CASE("semantic analysis types expressions for code generation", "[semantic]") {
+	const std::string inputStr = "a: int = 7 % 2\nb: float = a * 2.5 % 2\ns: str = \"x\" + \"y\" + \"z\"\nprint s; a < b; \"a\" == s";
+	VisitorTestsFixture fixture(inputStr);
+	auto tree = fixture.prog();
+
+	SemanticAnalyzer semantic;
+	REQUIRE(semantic.analyze(tree));
+
+	GeneratingVisitor visitor(&semantic);
+	visitor.visit(tree);
+
+	REQUIRE(visitor.getStatements() ==
+		"int _jagle_a = 7 % 2;\n"
+		"float _jagle_b = std::fmod(_jagle_a * 2.5, 2);\n"
+		"std::string _jagle_s = std::string(\"x\") + \"y\" + \"z\";\n"
+		"_jagle_out << _jagle_s << (_jagle_a < _jagle_b) << (std::string(\"a\") == _jagle_s) << '\\n'; \n");
+}
+
+TEST_CASE("val converts straight to the type it is used as", "[semantic]") {
+	const std::string inputStr = "s: str = \"12\"\nv: int = val(s)\nf: float = val(s) * 2\nprint val(s)";
+	VisitorTestsFixture fixture(inputStr);
+	auto tree = fixture.prog();
+
+	SemanticAnalyzer semantic;
+	REQUIRE(semantic.analyze(tree));
+
+	GeneratingVisitor visitor(&semantic);
+	visitor.visit(tree);
+
+	REQUIRE(visitor.getStatements() ==
+		"std::string _jagle_s = \"12\";\n"
+		"int _jagle_v = val_int(_jagle_s);\n"
+		"float _jagle_f = val_float(_jagle_s) * 2;\n"
+		"_jagle_out << val(_jagle_s) << '\\n'; \n");
+}
+
+TEST_CASE("semantic analysis rejects ill-typed programs", "[semantic]") {
+	const std::vector<std::pair<std::string, std::string>> programs = {
+		{ "a: int = 1\nprint b", "error at line 2:6: 'b' is not declared" },
+		{ "a: int = \"one\"", "error at line 1:0: cannot use str as int" },
+		{ "a: int = 1\na: float = 2.0", "error at line 2:0: 'a' is already declared" },
+		{ "s: str = \"a\"\nprint s - 1", "error at line 2:6: operator '-' needs numbers, got str and int" },
+		{ "func f(x: int): int\nreturn x\nendfunc\nprint f(1, 2)", "error at line 4:6: function 'f' takes 1 arguments, got 2" },
+		{ "func g()\nprint 1\nendfunc\na: int = g()", "error at line 4:9: function 'g' does not return a value" },
+		{ "a: int = 1\nfunc h(): int\nreturn a\nendfunc", "error at line 3:7: 'a' is not declared" },
+		{ "if 1 then\nb: int = 1\nendif\nprint b", "error at line 4:6: 'b' is not declared" },
+		{ "for s: str = \"a\" to 10\nprint s\nnext", "error at line 1:0: for loop variable must be int or float, got str" },
+		{ "return 1", "error at line 1:0: return outside a function" },
+		{ "print nope(1)", "error at line 1:6: function 'nope' is not defined" },
+		{ "data 1, Nothing", "error at line 1:8: DATA can't hold Nothing" },
+		{ "data 2147483648", "error at line 1:5: 2147483648 does not fit an int" },
+		{ "a: int[2.5]", "error at line 1:7: array size must be an int, got float" },
+		{ "a: int = 1\nprint a[0]", "error at line 2:6: 'a' is not an array" },
+		{ "a: int[2]\na = 1", "error at line 2:0: an array can't be assigned, assign its elements" },
+		{ "a: int[2]\nprint a", "error at line 2:6: an array can't be printed, print its elements" },
+		{ "a: int[2]\na[\"x\"] = 1", "error at line 2:2: array index must be an int, got str" },
+		{ "a: int[2]\nfunc f(x: float[])\nprint x[0]\nendfunc\nf(a)", "error at line 5:2: cannot use int[] as float[]" },
+		{ "parallel for i: int = 1 to 3\nprint i\nnext", "error at line 2:0: PRINT can't be used in a parallel for" },
+		{ "s: int = 0\nparallel for i: int = 1 to 3\ns = s + i\nnext",
+			"error at line 3:0: parallel for can't assign 's', declared outside the loop: declare it in the loop or reduce it" },
+		{ "s: int = 0\nparallel for i: int = 1 to 3 reduce + s\ns = i - s\nnext",
+			"error at line 3:0: reduction variable 's' must be updated as s = s + ..." },
+		{ "s: str = \"\"\nparallel for i: int = 1 to 3 reduce + s\ns = \"x\" + s\nnext",
+			"error at line 3:0: reduction variable 's' must be updated as s = s + ..." },
+		{ "func f(x: int)\nprint x\nendfunc\nfunc g(x: int)\nf(x)\nendfunc\nparallel for i: int = 1 to 3\ng(i)\nnext",
+			"error at line 8:0: parallel for can't call 'g', it uses PRINT, INPUT, READ or RESTORE" },
+		{ "i: int = 0\nparallel for i = 1 to 3\nprint 1\nnext", "error at line 2:0: parallel for must declare its loop variable" },
+		{ "memo func f(x: int)\nx = 1\nendfunc", "error at line 1:10: memo func 'f' must return a value" },
+		{ "memo func f(x: int[]): int\nreturn x[0]\nendfunc", "error at line 1:10: memo func 'f' can't take arrays" },
+		{ "func p(): int\nprint 1\nreturn 1\nendfunc\nmemo func f(): int\nreturn p()\nendfunc",
+			"error at line 5:10: memo func 'f' can't use PRINT, INPUT, READ or RESTORE" },
+	};
+
+	for (const auto& [inputStr, message] : programs) {
+		INFO(inputStr);
+		VisitorTestsFixture fixture(inputStr);
+		SemanticAnalyzer semantic;
+
+		REQUIRE_FALSE(semantic.analyze(fixture.prog()));
+		REQUIRE(semantic.getErrors().front().describe() == message);
+	}
+}
+
+TEST_CASE("imported functions are called with module-qualified names", "[semantic]") {
+	VisitorTestsFixture module_fixture("func twice(x: int): int\nreturn x * 2\nendfunc\n");
+	SemanticAnalyzer module_semantic("util", nullptr);
+	REQUIRE(module_semantic.analyze(module_fixture.prog()));
+	std::unordered_map<std::string, ModuleInterface> modules = { { "util", module_semantic.exports() } };
+	REQUIRE(modules["util"].functions.count("twice") == 1);
+
+	VisitorTestsFixture fixture("import util\nprint twice(3)\n");
+	auto tree = fixture.prog();
+	SemanticAnalyzer semantic("", &modules);
+	REQUIRE(semantic.analyze(tree));
+	REQUIRE(semantic.qualifiedName("twice") == "util.twice");
+
+	CppEmitter emitter;
+	ir::Program program = IrBuilder(&semantic).build(tree);
+	REQUIRE(program.imports == std::vector<std::string>{ "util" });
+	emitter.emit(program);
+	REQUIRE(emitter.getStatements().find("_jagle_module_util::_func_jagle_twice(3)") != std::string::npos);
+
+	const std::vector<std::pair<std::string, std::string>> programs = {
+		{ "import nope\nprint 1", "error at line 1:0: module 'nope' is not available" },
+		{ "import util\nfunc twice(x: int): int\nreturn x\nendfunc",
+			"error at line 2:5: function 'twice' is already imported from module 'util'" },
+		{ "func f()\nimport util\nendfunc", "error at line 2:0: import is only allowed at the top level of a file" },
+	};
+	for (const auto& [inputStr, message] : programs) {
+		INFO(inputStr);
+		VisitorTestsFixture failing(inputStr);
+		SemanticAnalyzer failing_semantic("", &modules);
+		REQUIRE_FALSE(failing_semantic.analyze(failing.prog()));
+		REQUIRE(failing_semantic.getErrors().front().describe() == message);
+	}
+
+	VisitorTestsFixture statements("print 1\n");
+	SemanticAnalyzer module_with_statements("main", &modules);
+	REQUIRE_FALSE(module_with_statements.analyze(statements.prog()));
+	REQUIRE(module_with_statements.getErrors().front().describe() ==
+		"error at line 1:0: module 'main' can only define functions and import modules");
+}
+
+// Statements of the program after a single optimization pass
+static std::string optimizedStatements(const std::string& inputStr, std::string_view pass) {
+	VisitorTestsFixture fixture(inputStr);
+	auto tree = fixture.prog();
+
+	SemanticAnalyzer semantic;
+	REQUIRE(semantic.analyze(tree));
+
+	PassOptions passes = PassOptions::none();
+	REQUIRE(setPass(passes, pass, true));
+	GeneratingVisitor visitor(&semantic, passes);
+	visitor.visit(tree);
+	return visitor.getStatements();
+}
+
+TEST_CASE("IR nodes live in an arena and names are interned", "[ir]") {
+	ir::Arena arena;
+	ir::Name x = arena.intern("x");
+	REQUIRE(arena.intern(std::string("x")) == x);
+	REQUIRE(std::string_view(arena.intern("x")).data() == std::string_view(x).data());
+	REQUIRE(arena.intern("y") != x);
+	REQUIRE(arena.intern("").empty());
+	REQUIRE(fmt::format("_jagle_{}", x) == "_jagle_x");
+
+	// Nodes are aligned, and their members freed with the arena
+	std::vector<ir::ExprPtr> nodes;
+	for (int i = 0; i < 10000; i++) {
+		nodes.push_back(arena.make<ir::Expr>(ir::ExprKind::Variable, Type::Int, i));
+		REQUIRE(reinterpret_cast<uintptr_t>(nodes.back().get()) % alignof(ir::Expr) == 0);
+		nodes.back()->name = x;
+		nodes.back()->operands.push_back(arena.make<ir::Expr>(ir::ExprKind::Literal, Type::Int, i));
+	}
+	REQUIRE(nodes[9999]->line == 9999);
+	REQUIRE(arena.bytes() >= 20000 * sizeof(ir::Expr));
+	REQUIRE(arena.bytes() < 20000 * sizeof(ir::Expr) * 2);
+
+	// Functions taken over from another program keep that program's arena
+	ir::Program module;
+	ir::Function function;
+	function.body.push_back(module.arena().make<ir::Stmt>(ir::StmtKind::Return, 1));
+	function.body.back()->value = ir::clone(module.arena(), *nodes[0]);
+	ir::Program program;
+	program.functions.push_back(std::move(function));
+	for (auto& moved : module.arenas) {
+		program.arenas.push_back(std::move(moved));
+	}
+	module = ir::Program();
+	REQUIRE(program.functions[0].body[0]->value->name == "x");
+	REQUIRE(program.functions[0].body[0]->value->operands.size() == 1);
+}
+
+TEST_CASE("copies are propagated until written", "[passes]") {
+	REQUIRE(optimizedStatements("a: int = 2\nb: int = a\nprint b * a\na = 3\nprint b", "copy-prop") ==
+		"int _jagle_a = 2;\n"
+		"int _jagle_b = 2;\n"
+		"_jagle_out << 2 * 2 << '\\n'; \n"
+		"_jagle_a = 3;\n"
+		"_jagle_out << 2 << '\\n'; \n");
+
+	// A float variable holds its literal rounded to float
+	REQUIRE(optimizedStatements("y: float = 0.1\nprint y == 0.1", "copy-prop") ==
+		"float _jagle_y = 0.1;\n"
+		"_jagle_out << (_jagle_y == 0.1) << '\\n'; \n");
+}
+
+TEST_CASE("constants are folded and trivial powers removed", "[passes]") {
+	REQUIRE(optimizedStatements("x: int = 2 * 3 + 7 / 2\nf: float = 1.0 / 4\nprint x ^ 3; f ^ 2; x ^ -1; 2 ^ 10; \"a\" + \"b\"; 1 < 2", "const-fold") ==
+		"int _jagle_x = 9;\n"
+		"float _jagle_f = 0.25;\n"
+		"_jagle_out << ipow(_jagle_x, 3) << std::pow(_jagle_f, 2) << ipow(_jagle_x, -1) << 1024 << \"ab\" << 1 << '\\n'; \n");
+
+	// Only x ^ 1 and x ^ 0 are rewritten, x * x would be undefined on overflow where ipow wraps
+	REQUIRE(optimizedStatements("x: int = 5\nprint x ^ 1; x ^ 0", "const-fold") ==
+		"int _jagle_x = 5;\n"
+		"_jagle_out << _jagle_x << 1 << '\\n'; \n");
+
+	// Division by zero and overflow are left to run time
+	REQUIRE(optimizedStatements("print 1 / 0; 2147483647 + 1; 2 ^ 31", "const-fold") ==
+		"_jagle_out << 1 / 0 << 2147483647 + 1 << ipow(2, 31) << '\\n'; \n");
+
+	// The smallest int has no literal of type int in C++
+	REQUIRE(optimizedStatements("print -2147483647 - 1", "const-fold") ==
+		"_jagle_out << (-2147483647 - 1) << '\\n'; \n");
+
+	// A call that gives up deep in its recursion leaves the next one all of its depth
+	REQUIRE(optimizedStatements("func down(n: int, d: int): int\nif n == 0 then\nreturn 10 / d\nendif\nreturn down(n - 1, d)\nendfunc\n"
+		"print down(150, 0); down(150, 2)", "fold-calls") ==
+		"_jagle_out << _func_jagle_down(150, 0) << 5 << '\\n'; \n");
+}
+
+TEST_CASE("repeated expressions are computed once", "[passes]") {
+	REQUIRE(optimizedStatements("a: int = 2\nb: int = 3\nprint (a + b) * (a + b)\nc: int = a + b\nb = 1\nprint a + b", "cse") ==
+		"int _jagle_a = 2;\n"
+		"int _jagle_b = 3;\n"
+		"int __jagle_cse_1 = _jagle_a + _jagle_b; // internal\n"
+		"_jagle_out << __jagle_cse_1 * __jagle_cse_1 << '\\n'; \n"
+		"int _jagle_c = __jagle_cse_1;\n"
+		"_jagle_b = 1;\n"
+		"_jagle_out << _jagle_a + _jagle_b << '\\n'; \n");
+
+	// float * 1.0E20 is a double in C++, so is its temporary
+	REQUIRE(optimizedStatements("y: float = val(\"1e20\")\nprint y * 1.0E20 + y * 1.0E20", "cse") ==
+		"float _jagle_y = val_float(\"1e20\");\n"
+		"auto __jagle_cse_1 = _jagle_y * 1.0E20; // internal\n"
+		"_jagle_out << __jagle_cse_1 + __jagle_cse_1 << '\\n'; \n");
+}
+
+TEST_CASE("calls of pure functions with constant arguments are computed", "[passes]") {
+	const std::string functions = "func fib(n: int): int\nif n < 2 then\nreturn n\nendif\nreturn fib(n - 1) + fib(n - 2)\nendfunc\n"
+		"func tenth(n: int): int\nreturn 10 / n\nendfunc\nfunc show(n: int): int\nprint n\nreturn n\nendfunc\n";
+	// Only calls are computed, the rest is left to const-fold
+	REQUIRE(optimizedStatements(functions + "print fib(30) + 1; tenth(5); show(2)", "fold-calls") ==
+		"_jagle_out << 832040 + 1 << 2 << _func_jagle_show(2) << '\\n'; \n");
+
+	// A declaration in a block shadows the variable of the function until the block ends
+	REQUIRE(optimizedStatements("func inner(n: int): int\nx: int = 1\nif n > 0 then\nx: int = 2\nendif\nreturn x\nendfunc\n"
+		"func loop(n: int): int\ni: int = 100\nfor i: int = 1 to n\nx: int = i\nnext\nreturn i\nendfunc\n"
+		"print inner(1); loop(3)", "fold-calls") ==
+		"_jagle_out << 1 << 100 << '\\n'; \n");
+
+	// Division by zero and overflow are left to run time
+	REQUIRE(optimizedStatements(functions + "print tenth(0); fib(50)", "fold-calls") ==
+		"_jagle_out << _func_jagle_tenth(0) << _func_jagle_fib(50) << '\\n'; \n");
+
+	// A call computed to the smallest int is still an int in C++
+	REQUIRE(optimizedStatements("func low(n: int): int\nreturn -n - 1\nendfunc\nprint low(2147483647)", "fold-calls") ==
+		"_jagle_out << (-2147483647 - 1) << '\\n'; \n");
+
+	// A call that gives up deep in its recursion leaves the next one all of its depth
+	REQUIRE(optimizedStatements("func down(n: int, d: int): int\nif n == 0 then\nreturn 10 / d\nendif\nreturn down(n - 1, d)\nendfunc\n"
+		"print down(150, 0); down(150, 2)", "fold-calls") ==
+		"_jagle_out << _func_jagle_down(150, 0) << 5 << '\\n'; \n");
+}
+
+TEST_CASE("dead stores and dead code are removed", "[passes]") {
+	REQUIRE(optimizedStatements("a: int = 1\na = 2\nprint a\na = 3", "dse") ==
+		"int _jagle_a;\n"
+		"_jagle_a = 2;\n"
+		"_jagle_out << _jagle_a << '\\n'; \n");
+
+	// A declaration in a nested block is another variable, the store before it is read after the block
+	REQUIRE(optimizedStatements("x: int = val(\"1\")\nif x > 0 then\nx = 5\nx: int = 2\nprint x\nendif\nprint x", "dse") ==
+		"int _jagle_x = val_int(\"1\");\n"
+		"if (_jagle_x > 0) {\n"
+		"_jagle_x = 5;\n"
+		"int _jagle_x = 2;\n"
+		"_jagle_out << _jagle_x << '\\n'; \n"
+		"}\n"
+		"_jagle_out << _jagle_x << '\\n'; \n");
+
+	REQUIRE(optimizedStatements("unused: int = 1\nif 0 then\nprint 1\nelse\nprint 2\nendif", "dce") ==
+		"_jagle_out << 2 << '\\n'; \n");
+
+	VisitorTestsFixture fixture("func f(): int\nreturn 1\nprint 2\nendfunc\nprint f()");
+	auto tree = fixture.prog();
+	SemanticAnalyzer semantic;
+	REQUIRE(semantic.analyze(tree));
+	PassOptions passes = PassOptions::none();
+	passes.dead_code = true;
+	GeneratingVisitor visitor(&semantic, passes);
+	visitor.visit(tree);
+
+	REQUIRE(visitor.getFuncBodies() == "constexpr int _func_jagle_f() {\nreturn 1;\n}\n");
+}
+
+TEST_CASE("functions main can't reach are removed", "[passes]") {
+	VisitorTestsFixture fixture("func a(): int\nreturn 1\nendfunc\nfunc b(): int\nreturn a()\nendfunc\nfunc c()\nprint 1\nendfunc\nprint b()");
+	auto tree = fixture.prog();
+	SemanticAnalyzer semantic;
+	REQUIRE(semantic.analyze(tree));
+
+	PassOptions passes = PassOptions::none();
+	passes.unreachable_functions = true;
+	GeneratingVisitor visitor(&semantic, passes);
+	visitor.visit(tree);
+
+	REQUIRE(visitor.getFuncDecls() == "constexpr int _func_jagle_a();\nconstexpr int _func_jagle_b();");
+}
+
+TEST_CASE("DATA is split into typed tables", "[data]") {
+	VisitorTestsFixture fixture("data 1, -2.5, \"a\\tb\", +3\ndata \"c\"");
+	GeneratingVisitor visitor;
+	visitor.visit(fixture.prog());
+
+	REQUIRE(visitor.getData() ==
+		"const unsigned char _jagle_data_tags[] = { 0, 1, 2, 0, 2 };\n"
+		"const int _jagle_data_ints[] = { 1, 3 };\n"
+		"const float _jagle_data_floats[] = { -2.5 };\n"
+		"const uint32_t _jagle_data_str_offsets[] = { 0, 3, 4 };\n"
+		"const char _jagle_data_str_pool[] = \"a\\011bc\";\n"
+		"const DataTable _jagle_data = { _jagle_data_tags, 5, _jagle_data_ints, _jagle_data_floats, "
+		"_jagle_data_str_offsets, _jagle_data_str_pool };\n");
+}
+
+TEST_CASE("large DATA is embedded as a blob", "[data]") {
+	VisitorTestsFixture fixture("data 7, \"x\"");
+	GeneratingVisitor visitor(nullptr, PassOptions::none(), 2);
+	visitor.visit(fixture.prog());
+
+	// Counts, tags, the int, string offsets and bytes, little-endian
+	REQUIRE(visitor.getData() ==
+		"const char _jagle_data_blob[] =\n"
+		"\"\\002\\000\\000\\000\\001\\000\\000\\000\\000\\000\\000\\000\\001\\000\\000\\000\\000\\002\\007\\000\\000\\000"
+		"\\000\\000\\000\\000\\001\\000\\000\\000x\";\n"
+		"const DataTable _jagle_data = data_blob(_jagle_data_blob);\n");
+}
+
+TEST_CASE("arrays are contiguous and passed by reference", "[array]") {
+	const std::string inputStr = "func sum(xs: float[], n: int): float\ns: float = 0\nfor i: int = 0 to n - 1\ns = s + xs[i]\nnext\n"
+		"return s\nendfunc\na: float[4]\na[1] = 2.5\nprint sum(a, 4); a[1]";
+	VisitorTestsFixture fixture(inputStr);
+	auto tree = fixture.prog();
+
+	SemanticAnalyzer semantic;
+	REQUIRE(semantic.analyze(tree));
+
+	GeneratingVisitor checked(&semantic, PassOptions());
+	checked.visit(tree);
+	REQUIRE(checked.getFuncDecls() == "float _func_jagle_sum(Array<float>& _jagle_xs, int _jagle_n);");
+	REQUIRE(checked.getStatements() ==
+		"Array<float> _jagle_a(4);\n"
+		"_jagle_a.at(1) = 2.5;\n"
+		"_jagle_out << _func_jagle_sum(_jagle_a, 4) << _jagle_a.at(1) << '\\n'; \n");
+
+	// Release builds index without the check
+	GeneratingVisitor unchecked(&semantic, PassOptions(), CppEmitter::DefaultDataBlobItems, false);
+	unchecked.visit(tree);
+	REQUIRE(unchecked.getStatements() ==
+		"Array<float> _jagle_a(4);\n"
+		"_jagle_a[1] = 2.5;\n"
+		"_jagle_out << _func_jagle_sum(_jagle_a, 4) << _jagle_a[1] << '\\n'; \n");
+	REQUIRE(unchecked.getFuncBodies().find("_jagle_s = _jagle_s + _jagle_xs[_jagle_i];") != std::string::npos);
+}
+
+TEST_CASE("parallel for runs chunks with their own reduction copies", "[for]") {
+	const std::string inputStr = "a: float[8]\ntotal: float = 0\nparallel for i: int = 0 to 7 reduce + total\ntotal = total + a[i]\nnext";
+	VisitorTestsFixture fixture(inputStr);
+	auto tree = fixture.prog();
+
+	SemanticAnalyzer semantic;
+	REQUIRE(semantic.analyze(tree));
+
+	GeneratingVisitor visitor(&semantic);
+	visitor.visit(tree);
+
+	REQUIRE(visitor.getStatements() ==
+		"Array<float> _jagle_a(8);\n"
+		"float _jagle_total = 0;\n"
+		"ParallelRange __jagle_range_1(0, 7, 1); // internal\n"
+		"std::vector<Partial<float>> __jagle_total_1(__jagle_range_1.chunks()); // internal\n"
+		"__jagle_range_1.run([&](int __jagle_first, int __jagle_last, unsigned __jagle_chunk) {\n"
+		"float _jagle_total = 0;\n"
+		"for (int _jagle_i = __jagle_first; _jagle_i <= __jagle_last; _jagle_i += 1) {\n"
+		"_jagle_total = _jagle_total + _jagle_a.at(_jagle_i);\n"
+		"}\n"
+		"__jagle_total_1[__jagle_chunk].value = _jagle_total;\n"
+		"});\n"
+		"for (const auto& __jagle_partial : __jagle_total_1) {\n"
+		"_jagle_total = _jagle_total + __jagle_partial.value;\n"
+		"}\n");
+}
+
+TEST_CASE("profiled programs count statements and calls", "[profile]") {
+	const std::string inputStr = "func twice(x: int): int\nreturn x * 2\nendfunc\nfor i: int = 1 to 3\n  print twice(i)\nnext";
+	VisitorTestsFixture fixture(inputStr);
+	auto tree = fixture.prog();
+
+	SemanticAnalyzer semantic;
+	REQUIRE(semantic.analyze(tree));
+
+	GeneratingVisitor visitor(&semantic, PassOptions::none(), CppEmitter::DefaultDataBlobItems, true, true);
+	visitor.visit(tree);
+
+	// Each function has its own sites, an edit of one doesn't renumber the others'
+	REQUIRE(visitor.getFuncBodies() ==
+		"static ProfileSite _jagle_profile_sites_func_twice[1] = {\n"
+		"\t{ 2, 0, \"return\" }\n"
+		"};\n"
+		"static ProfileFunction _jagle_profile_func_twice(\"twice\", _jagle_profile_sites_func_twice, 1);\n"
+		"int _func_jagle_twice(int _jagle_x) {\n"
+		"ProfileCall _jagle_profile_call(_jagle_profile_func_twice);\n"
+		"profile_at(_jagle_profile_sites_func_twice[0]);\n"
+		"return _jagle_x * 2;\n"
+		"}\n");
+	REQUIRE(visitor.getStatements() ==
+		"profile_start(argv[0]);\n"
+		"ProfileCall _jagle_profile_call(_jagle_profile_main);\n"
+		"profile_at(_jagle_profile_sites_main[0]);\n"
+		"for (int _jagle_i = 1; _jagle_i <= 3; _jagle_i += 1) {\n"
+		"profile_at(_jagle_profile_sites_main[1]);\n"
+		"_jagle_out << _func_jagle_twice(_jagle_i) << '\\n'; \n"
+		"}\n");
+	REQUIRE(visitor.getOutput().find("\t{ 5, 2, \"print\" }\n") != std::string::npos);
+}
+
+TEST_CASE("str self-append is done in place", "[statement]") {
+	const std::string inputStr = "s: str = \"\"\nx: str = \"x\"\ns = s + x\ns = s + x + \"y\" + (x + x)\ns = s + s\ns = x + s";
+	VisitorTestsFixture fixture(inputStr);
+	auto tree = fixture.prog();
+
+	SemanticAnalyzer semantic;
+	REQUIRE(semantic.analyze(tree));
+
+	GeneratingVisitor visitor(&semantic);
+	visitor.visit(tree);
+
+	// A part that reads s would see it change, that stays a copy
+	REQUIRE(visitor.getStatements() ==
+		"std::string _jagle_s = \"\";\n"
+		"std::string _jagle_x = \"x\";\n"
+		"str_append(_jagle_s, _jagle_x);\n"
+		"str_append(_jagle_s, _jagle_x, \"y\", _jagle_x, _jagle_x);\n"
+		"_jagle_s = _jagle_s + _jagle_s;\n"
+		"_jagle_s = _jagle_x + _jagle_s;\n");
+}
+
+TEST_CASE("for loop with constant step", "[for]") {
+	const std::string inputStr = "for i: int = 10 to 1 step -2\nprint i\nnext";
+	VisitorTestsFixture fixture(inputStr);
+
+	GeneratingVisitor visitor;
+
+	auto result = visitor.visit(fixture.prog());
+	std::string program = visitor.getStatements();
+
+	REQUIRE(program ==
+		"for (int _jagle_i = 10; _jagle_i >= 1; _jagle_i += -(2)) {\n"
+		"_jagle_out << _jagle_i << '\\n'; \n"
+		"}\n");
+}
+
+TEST_CASE("for loop with computed limit and step", "[for]") {
+	const std::string inputStr = "for i = 1 to n * 2 step s\nprint i\nnext";
+	VisitorTestsFixture fixture(inputStr);
+
+	GeneratingVisitor visitor;
+
+	auto result = visitor.visit(fixture.prog());
+	std::string program = visitor.getStatements();
+
+	REQUIRE(program ==
+		"auto __jagle_to_1 = _jagle_n * 2; // internal\n"
+		"auto __jagle_step_1 = _jagle_s; // internal\n"
+		"for (_jagle_i = 1; (__jagle_step_1 >= 0 ? _jagle_i <= __jagle_to_1 : _jagle_i >= __jagle_to_1); _jagle_i += __jagle_step_1) {\n"
+		"_jagle_out << _jagle_i << '\\n'; \n"
+		"}\n");
+
+	// The start value is evaluated before the limit and the step
+	VisitorTestsFixture computed_from("for i = a + 1 to n\nprint i\nnext");
+	GeneratingVisitor from_visitor;
+	from_visitor.visit(computed_from.prog());
+	REQUIRE(from_visitor.getStatements() ==
+		"auto __jagle_from_1 = _jagle_a + 1; // internal\n"
+		"auto __jagle_to_1 = _jagle_n; // internal\n"
+		"for (_jagle_i = __jagle_from_1; _jagle_i <= __jagle_to_1; _jagle_i += 1) {\n"
+		"_jagle_out << _jagle_i << '\\n'; \n"
+		"}\n");
+}
+
+TEST_CASE("nested for loops grow linearly", "[for]") {
+	// Each level adds one loop around the previous program
+	auto nested_size = [](int depth) {
+		std::string inputStr;
+		for (int i = 0; i < depth; i++) {
+			inputStr += fmt::format("for i{}: int = 1 to n step s\n", i);
+		}
+		inputStr += "print n\n";
+		for (int i = 0; i < depth; i++) {
+			inputStr += "next\n";
+		}
+
+		VisitorTestsFixture fixture(inputStr);
+		GeneratingVisitor visitor;
+		visitor.visit(fixture.prog());
+		return visitor.getStatements().size();
+	};
+
+	size_t previous = nested_size(1);
+	size_t first_increment = nested_size(2) - previous;
+	for (int depth = 2; depth <= 10; depth++) {
+		size_t current = nested_size(depth);
+		// Allow a few bytes for the growing internal variable counters
+		REQUIRE(current - previous <= first_increment + 8);
+		previous = current;
+	}
+}
+
+TEST_CASE("SLL and LL prediction build identical trees", "[parser]") {
+	const std::vector<std::string> corpus = {
+		"a: int = 2\nb: int = Nothing\nfor b = 1 to 10\nprint a; \" x \"; b; \" = \"; a * b\nnext",
+		"x: float = -2.5 ^ 2 ^ 3 * 4 / 2 % 3 + 1 - 2",
+		"if not a == 1 and b != 2 or c >= 3 then\nprint a;\nelse\nprint b; c\nendif",
+		"data 1, -2, 3.5, \"four\"\nread a\nrestore\nread b",
+		"input \"Name: \", name = \"nobody\"\ninput age",
+		"func fib(n: int): int\nif n < 2 then\nreturn n\nendif\nreturn fib(n - 1) + fib(n - 2)\nendfunc\nprint fib(10)",
+		"s: str = \"12\"\nv: int = val(s) + (1 + 2) * 3\nval(s)\na = b = 3",
+		"for i: int = 10 to 1 step -1\nfor j = i to 20 step i\nprint i * j\nnext\nnext\nend",
+	};
+
+	for (const auto& inputStr : corpus) {
+		VisitorTestsFixture sll(inputStr);
+		VisitorTestsFixture ll(inputStr);
+
+		std::string sll_tree = sll.prog(PredictionMode::SLL)->toStringTree(&sll.parser);
+		std::string ll_tree = ll.prog(PredictionMode::LL)->toStringTree(&ll.parser);
+
+		REQUIRE(sll_tree == ll_tree);
+	}
+}
+
+TEST_CASE("mapped ASCII sources lex like decoded ones", "[parser]") {
+	auto path = std::filesystem::temp_directory_path() / "jagle_source_test.jagle";
+	const std::string inputStr = "func f(n: int): int\nreturn n * 2\nendfunc\nprint f(21); \"x\"";
+	std::ofstream(path, std::ios::binary) << inputStr;
+
+	SourceFile source;
+	REQUIRE(source.open(path.string()));
+	REQUIRE(source.text() == inputStr);
+	REQUIRE(source.isAscii());
+
+	AsciiCharStream mapped(source.text(), path.string());
+	jagle::JagleLexer mapped_lexer(&mapped);
+	antlr4::CommonTokenStream mapped_tokens(&mapped_lexer);
+	jagle::JagleParser mapped_parser(&mapped_tokens);
+	VisitorTestsFixture decoded(inputStr);
+	REQUIRE(parseProgram(mapped_parser)->toStringTree(&mapped_parser) == decoded.prog()->toStringTree(&decoded.parser));
+	REQUIRE(mapped.getText(antlr4::misc::Interval(0, 3)) == "func");
+	// Intervals past the end stop at the end
+	ssize_t end = static_cast<ssize_t>(inputStr.size());
+	REQUIRE(mapped.getText(antlr4::misc::Interval(end - 3, end + 10)) == "\"x\"");
+
+	std::ofstream(path, std::ios::binary) << "print \"\xc3\xa4\"";
+	SourceFile utf8;
+	REQUIRE(utf8.open(path.string()));
+	REQUIRE_FALSE(utf8.isAscii());
+	REQUIRE_FALSE(SourceFile().open((path.parent_path() / "jagle_no_such_file.jagle").string()));
+
+	std::filesystem::remove(path);
+}
+
+TEST_CASE("batch transpiles files independently", "[driver]") {
+	auto dir = std::filesystem::temp_directory_path() / "jagle_batch_test";
+	std::filesystem::create_directories(dir);
+
+	std::vector<TranspileJob> jobs;
+	for (int i = 0; i < 6; i++) {
+		auto source = dir / fmt::format("prog{}.jagle", i);
+		std::ofstream(source) << (i == 3 ? "print 1 +\n" : fmt::format("a: int = {}\nprint a\n", i));
+		jobs.push_back({ source.string(), defaultTargetName(source.string()) });
+	}
+
+	DriverOptions options;
+	options.compile = false;
+	options.verbose = false;
+	auto results = transpileBatch(jobs, CompilerConfig(), options, 4);
+
+	REQUIRE(results.size() == jobs.size());
+	for (size_t i = 0; i < jobs.size(); i++) {
+		REQUIRE(results[i].ok == (i != 3));
+		REQUIRE(std::filesystem::exists(jobs[i].target_name + ".cpp") == (i != 3));
+	}
+
+	std::filesystem::remove_all(dir);
+}
+
+TEST_CASE("time reports list the phases that ran", "[driver]") {
+	auto dir = std::filesystem::temp_directory_path() / "jagle_time_report_test";
+	std::filesystem::create_directories(dir);
+	std::vector<TranspileJob> jobs = { { (dir / "ok.jagle").string(), (dir / "ok").string() },
+		{ (dir / "bad.jagle").string(), (dir / "bad").string() } };
+	std::ofstream(jobs[0].source_fname) << "a: int = 1\nprint a\n";
+	std::ofstream(jobs[1].source_fname) << "print 1 +\n";
+
+	DriverOptions options;
+	options.compile = false;
+	options.verbose = false;
+	auto results = transpileBatch(jobs, CompilerConfig(), options, 1);
+
+	std::vector<std::string> phases;
+	for (const auto& phase : results[0].report.phases) {
+		phases.push_back(phase.name);
+		REQUIRE(phase.wall >= 0);
+	}
+	REQUIRE(phases == std::vector<std::string>{ "read", "lex", "parse", "analyze", "lower", "optimize", "emit", "write" });
+	REQUIRE(results[0].report.tokens > 0);
+	REQUIRE(results[0].report.parse_tree_nodes > 0);
+	REQUIRE(results[0].report.ir_bytes > 0);
+	REQUIRE(results[0].report.cpp_bytes == std::filesystem::file_size(jobs[0].target_name + ".cpp"));
+	// The syntax error ends the report in the parse phase
+	REQUIRE(results[1].report.phases.size() == 3);
+	REQUIRE(std::string(results[1].report.phases.back().name) == "parse");
+
+	std::string json = formatTimeReport(jobs, results, true);
+	REQUIRE(json.rfind("{\"peak_rss_bytes\":", 0) == 0);
+	REQUIRE(json.find("\"ok\":false,\"cached\":false,\"error\":\"syntax error") != std::string::npos);
+	REQUIRE(json.find("{\"name\":\"parse\",\"wall_ms\":") != std::string::npos);
+
+	std::filesystem::remove_all(dir);
+}
+
+#ifdef JAGLE_HAS_SPAWN
+TEST_CASE("incremental builds compile only changed functions", "[driver]") {
+	auto dir = std::filesystem::temp_directory_path() / "jagle_incremental_test";
+	std::filesystem::remove_all(dir);
+	std::filesystem::create_directories(dir);
+	auto source = dir / "prog.jagle";
+	auto write = [&](const std::string& half) {
+		std::ofstream(source) << "func twice(x: int): int\nreturn x * 2\nendfunc\n"
+			<< "func half(x: int): int\nreturn " << half << "\nendfunc\n"
+			<< "print twice(3); half(8)\n";
+	};
+
+	// Objects are copies of the units and the executable is all of them, no compiler needed
+	CompilerConfig config;
+	config.unit_cmd = "cp {source} {object}";
+	config.link_cmd = "cat {objects} > {target}";
+	config.units_dir = (dir / "units").string();
+	DriverOptions options;
+	options.verbose = false;
+	TranspileJob job{ source.string(), (dir / "prog").string() };
+	IncrementalState state;
+
+	write("x / 2");
+	TranspileResult result = transpileIncremental(job, config, options, state, 2);
+	REQUIRE(result.ok);
+	REQUIRE(result.emitted_functions == 2);
+	REQUIRE(result.units == 3);
+	REQUIRE(result.compiled_units == 3);
+
+	result = transpileIncremental(job, config, options, state, 2);
+	REQUIRE(result.ok);
+	REQUIRE(result.emitted_functions == 0);
+	REQUIRE(result.compiled_units == 0);
+
+	write("x / 4");
+	result = transpileIncremental(job, config, options, state, 2);
+	REQUIRE(result.ok);
+	REQUIRE(result.emitted_functions == 1);
+	REQUIRE(result.compiled_units == 1);
+
+	std::ifstream linked(job.target_name);
+	std::string code((std::istreambuf_iterator<char>(linked)), std::istreambuf_iterator<char>());
+	REQUIRE(code.find("_jagle_x / 4") != std::string::npos);
+	REQUIRE(code.find("_jagle_x / 2") == std::string::npos);
+	size_t objects = 0;
+	for (const auto& entry : std::filesystem::directory_iterator(dir / "units" / "prog")) {
+		objects += entry.path().extension() == ".o";
+	}
+	REQUIRE(objects == 3);
+
+	std::filesystem::remove_all(dir);
+}
+#endif
+
+#ifdef JAGLE_HAS_SPAWN
+TEST_CASE("modules are compiled on their own and again only when they change", "[driver]") {
+	auto dir = std::filesystem::temp_directory_path() / "jagle_module_test";
+	std::filesystem::remove_all(dir);
+	std::filesystem::create_directories(dir);
+	auto write = [&](const std::string& name, const std::string& code) { std::ofstream(dir / name) << code; };
+	write("prog.jagle", "import geometry\nprint area(2)\n");
+	write("geometry.jagle", "import util\nfunc area(r: int): int\nreturn twice(r) * r\nendfunc\n");
+	write("util.jagle", "func twice(x: int): int\nreturn x * 2\nendfunc\n");
+
+	// Objects are copies of the units and the executable is all of them, no compiler needed
+	CompilerConfig config;
+	config.unit_cmd = "cp {source} {object}";
+	config.link_cmd = "cat {objects} > {target}";
+	config.units_dir = (dir / "units").string();
+	DriverOptions options;
+	options.verbose = false;
+	options.jobs = 2;
+	TranspileJob job{ (dir / "prog.jagle").string(), (dir / "prog").string() };
+
+	TranspileResult result = transpileFile(job, config, options);
+	REQUIRE(result.ok);
+	REQUIRE(result.units == 3);
+	REQUIRE(result.compiled_units == 3);
+	REQUIRE(result.sources.size() == 3);
+	REQUIRE(std::filesystem::exists(dir / "units" / "prog" / "module_util.hpp"));
+
+	// A new body keeps the interface, the importing module is not compiled again
+	write("util.jagle", "func twice(x: int): int\nreturn x + x\nendfunc\n");
+	result = transpileFile(job, config, options);
+	REQUIRE(result.ok);
+	REQUIRE(result.compiled_units == 1);
+
+	// A new signature changes the header geometry includes
+	write("util.jagle", "func twice(x: float): int\nreturn x + x\nendfunc\n");
+	result = transpileFile(job, config, options);
+	REQUIRE(result.ok);
+	REQUIRE(result.compiled_units == 2);
+
+	std::ifstream linked(job.target_name);
+	std::string code((std::istreambuf_iterator<char>(linked)), std::istreambuf_iterator<char>());
+	REQUIRE(code.find("int _jagle_module_geometry::_func_jagle_area(int _jagle_r)") != std::string::npos);
+	REQUIRE(code.find("_jagle_module_util::_func_jagle_twice(_jagle_r)") != std::string::npos);
+
+	write("util.jagle", "import geometry\nfunc twice(x: int): int\nreturn x\nendfunc\n");
+	result = transpileFile(job, config, options);
+	REQUIRE_FALSE(result.ok);
+	REQUIRE(result.error == "import cycle: prog -> geometry -> util -> geometry");
+
+	std::filesystem::remove_all(dir);
+}
+#endif
+
+#ifdef JAGLE_HAS_SPAWN
+TEST_CASE("profile-guided builds train once per program and input", "[driver]") {
+	auto dir = std::filesystem::temp_directory_path() / "jagle_pgo_test";
+	std::filesystem::remove_all(dir);
+	std::filesystem::create_directories(dir);
+	auto source = dir / "prog.jagle";
+	std::ofstream(source) << "print 1\n";
+	PgoTraining training{ (dir / "train.in").string(), "" };
+	std::ofstream(training.input) << "5\n";
+	auto log = dir / "log.txt";
+
+	// The compiler logs its flags and writes a program that logs its runs
+	CompilerConfig config;
+	config.cmd = fmt::format("sh -c 'echo \"$*\" >> {0}; printf \"#!/bin/sh\\necho run >> {0}\\n\" > {{target}}; chmod +x {{target}}' cc",
+		log.string());
+	config.pgo_dir = (dir / "pgo").string();
+	DriverOptions options;
+	options.verbose = false;
+	TranspileJob job{ source.string(), (dir / "prog").string() };
+
+	auto logLines = [&]() {
+		std::vector<std::string> lines;
+		std::ifstream file(log);
+		for (std::string line; std::getline(file, line);) {
+			lines.push_back(line);
+		}
+		std::filesystem::remove(log);
+		return lines;
+	};
+
+	TranspileResult result = transpilePgo(job, config, options, training);
+	REQUIRE(result.ok);
+	REQUIRE_FALSE(result.profile_reused);
+	auto lines = logLines();
+	REQUIRE(lines.size() == 3);
+	REQUIRE(lines[0].find("-fprofile-generate=") != std::string::npos);
+	REQUIRE(lines[1] == "run");
+	REQUIRE(lines[2].find("-fprofile-use=") != std::string::npos);
+
+	result = transpilePgo(job, config, options, training);
+	REQUIRE(result.ok);
+	REQUIRE(result.profile_reused);
+	REQUIRE(logLines().size() == 1);
+
+	std::ofstream(training.input) << "6\n";
+	result = transpilePgo(job, config, options, training);
+	REQUIRE(result.ok);
+	REQUIRE_FALSE(result.profile_reused);
+	REQUIRE(logLines().size() == 3);
+
+	config.pgo_use_flags += " -Wno-coverage-mismatch";
+	result = transpilePgo(job, config, options, training);
+	REQUIRE(result.ok);
+	REQUIRE_FALSE(result.profile_reused);
+	logLines();
+
+	// A program with modules is compiled in units, an edited module needs a new profile
+	config.unit_cmd = fmt::format("sh -c 'echo \"$*\" >> {}; touch {{object}}' cc", log.string());
+	config.link_cmd = config.cmd;
+	config.units_dir = (dir / "units").string();
+	std::ofstream(dir / "lib.jagle") << "func one(): int\nreturn 1\nendfunc\n";
+	std::ofstream(source) << "import lib\nprint one()\n";
+	result = transpilePgo(job, config, options, training);
+	REQUIRE(result.ok);
+	REQUIRE_FALSE(result.profile_reused);
+	result = transpilePgo(job, config, options, training);
+	REQUIRE(result.ok);
+	REQUIRE(result.profile_reused);
+
+	std::ofstream(dir / "lib.jagle") << "func one(): int\nreturn 2\nendfunc\n";
+	result = transpilePgo(job, config, options, training);
+	REQUIRE(result.ok);
+	REQUIRE_FALSE(result.profile_reused);
+
+	std::filesystem::remove_all(dir);
+}
+#endif
+
+// Output of the program run in the bytecode VM, after the same passes the driver runs
+static std::string vmOutput(const std::string& inputStr) {
+	VisitorTestsFixture fixture(inputStr);
+	auto tree = fixture.prog();
+
+	SemanticAnalyzer semantic;
+	REQUIRE(semantic.analyze(tree));
+
+	ir::Program ir_program = IrBuilder(&semantic).build(tree);
+	runPasses(ir_program, PassOptions());
+	bc::Program program = bc::compile(ir_program);
+
+	std::FILE* file = std::tmpfile();
+	{
+		PrintBuffer out(file);
+		Vm(program, out).run();
+	}
+	std::string written(1 << 16, '\0');
+	std::rewind(file);
+	written.resize(std::fread(written.data(), 1, written.size(), file));
+	std::fclose(file);
+	return written;
+}
+
+TEST_CASE("bytecode VM prints what the compiled program prints", "[vm]") {
+	// Recursion, array arguments and str results
+	REQUIRE(vmOutput("func fact(n: int): int\nif n <= 1 then\nreturn 1\nendif\nreturn n * fact(n - 1)\nendfunc\n"
+		"func fill(xs: int[], n: int)\nfor i: int = 0 to n - 1\nxs[i] = fact(i)\nnext\nendfunc\n"
+		"func tag(s: str): str\nreturn s + \"#\"\nendfunc\n"
+		"a: int[6]\nfill(a, 6)\nprint a[5]; \" \"; a[3] / 4; \" \"; tag(\"x\"); fact(12)") == "120 1 x#479001600\n\n");
+
+	// Float steps accumulate in float like the C++ loop, computed steps test their sign
+	REQUIRE(vmOutput("for x: float = 0 to 1 step 0.1\nprint x; \" \";\nnext\nprint \"\"\n"
+		"s: int = -1\nfor i: int = 1 to 3\nfor j: int = i to 1 step s\nprint j;\nnext\nnext") ==
+		"0 0.1 0.2 0.3 0.4 0.5 0.6 0.7 0.8 0.9 \n121321\n");
+
+	// Parallel for combines every chunk's reduction copies
+	REQUIRE(vmOutput("total: int = 0\nacc: float = 0\n"
+		"parallel for i: int = 1 to 1000 reduce + total reduce + acc\ntotal = total + i * i\nacc = acc + 1.0 / i\nnext\n"
+		"print total; \" \"; acc") == "333833500 7.48547\n\n");
+
+	// Start value, limit and step of a loop are evaluated in this order
+	REQUIRE(vmOutput("func at(x: int, tag: str): int\nprint tag;\nreturn x\nendfunc\n"
+		"for i: int = at(1, \"from \") to at(2, \"to \") step at(1, \"step\")\nk: int = i\nnext") ==
+		"from to step\n");
+
+	// memo funcs run once per argument, fib(40) is otherwise hundreds of millions of calls
+	REQUIRE(vmOutput("memo func fib(n: int): int\nif n < 2 then\nreturn n\nendif\nreturn fib(n - 1) + fib(n - 2)\nendfunc\n"
+		"memo func twice(s: str): str\nreturn s + s\nendfunc\nn: int = val(\"40\")\nprint fib(n); twice(\"a\"); twice(\"ab\")") ==
+		"102334155aaabab\n\n");
+
+	// DATA with RESTORE
+	REQUIRE(vmOutput("data 3, \"hello\", 2.5\nx: int = 0\ns: str = \"\"\nf: float = 0\n"
+		"read x\nread s\nread f\nrestore\nread x\nprint x; s; f") == "3hello2.5\n\n");
+}
+
+TEST_CASE("bytecode appends to str variables in place", "[vm]") {
+	VisitorTestsFixture fixture("s: str = \"\"\nx: str = \"x\"\ns = s + x\nprint s");
+	auto tree = fixture.prog();
+
+	SemanticAnalyzer semantic;
+	REQUIRE(semantic.analyze(tree));
+
+	bc::Program program = bc::compile(IrBuilder(&semantic).build(tree));
+	std::string listing = bc::disassemble(program);
+	REQUIRE(listing.find(" append ") != std::string::npos);
+	REQUIRE(listing.find(" concat ") == std::string::npos);
+}
+
+#if defined(JAGLE_HAS_SPAWN) && defined(JAGLE_CORPUS_DIR)
+// Every program of corpus/ is compiled with the runtime of this tree and run in the VM, both
+// must print the same and exit with the same status. <name>.in next to a program is its stdin.
+TEST_CASE("bytecode VM and compiled programs agree on the corpus", "[vm][differential]") {
+	if (std::system(JAGLE_TEST_CXX " --version > /dev/null 2>&1") != 0) {
+		SKIP("no C++ compiler to build the corpus with");
+	}
+	auto dir = std::filesystem::temp_directory_path() / "jagle_differential_test";
+	std::filesystem::remove_all(dir);
+	std::filesystem::create_directories(dir);
+
+	std::vector<TranspileJob> jobs;
+	for (const auto& entry : std::filesystem::directory_iterator(JAGLE_CORPUS_DIR)) {
+		if (entry.path().extension() == ".jagle") {
+			jobs.push_back({ entry.path().string(), (dir / entry.path().stem()).string() });
+		}
+	}
+	REQUIRE(jobs.size() >= 10);
+
+	CompilerConfig config;
+	config.cmd = JAGLE_TEST_CXX " -std=c++17 -I{runtime_include} {source} {runtime_library} -o {target} -pthread";
+	config.runtime_header = JAGLE_RUNTIME_INCLUDE "/jagle.hpp";
+	config.runtime_library = JAGLE_RUNTIME_LIBRARY;
+	DriverOptions options;
+	options.verbose = false;
+	auto results = transpileBatch(jobs, config, options, std::max(2u, std::thread::hardware_concurrency()));
+
+	// Exit status and stdout of a command run by the shell
+	auto run = [&](const std::string& command, const std::string& input, const std::string& output) {
+		int status = std::system(fmt::format("{} < '{}' > '{}' 2> /dev/null", command, input, output).c_str());
+		std::ifstream file(output);
+		std::string written((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+		return std::make_pair(WIFEXITED(status) ? WEXITSTATUS(status) : -1, written);
+	};
+	for (size_t i = 0; i < jobs.size(); i++) {
+		INFO(jobs[i].source_fname);
+		REQUIRE(results[i].ok);
+		auto input = std::filesystem::path(jobs[i].source_fname).replace_extension(".in");
+		if (!std::filesystem::exists(input)) {
+			input = "/dev/null";
+		}
+		auto compiled = run(fmt::format("'{}'", jobs[i].target_name), input.string(), jobs[i].target_name + ".out");
+		auto interpreted = run(fmt::format("'{}' run '{}'", JAGLE_EXECUTABLE, jobs[i].source_fname), input.string(),
+			jobs[i].target_name + ".vm.out");
+		REQUIRE(interpreted.second == compiled.second);
+		REQUIRE(interpreted.first == compiled.first);
+	}
+
+	std::filesystem::remove_all(dir);
+}
+#endif
+
+TEST_CASE("build cache hits and evicts least recently used", "[cache]") {
+	auto dir = std::filesystem::temp_directory_path() / "jagle_cache_test";
+	std::filesystem::remove_all(dir);
+
+	CacheConfig config;
+	config.enabled = true;
+	config.dir = (dir / "cache").string();
+	config.max_size = 2500;
+	BuildCache cache(config);
+
+	auto binary = (dir / "binary").string();
+	std::vector<std::string> keys;
+	for (int i = 0; i < 3; i++) {
+		keys.push_back(BuildCache::key(fmt::format("program {}", i), "g++ {source} -o {target}", "runtime"));
+		std::ofstream(binary, std::ios::binary) << std::string(1000, static_cast<char>('a' + i));
+		cache.store(keys.back(), binary);
+	}
+
+	REQUIRE(keys[0] != keys[1]);
+	REQUIRE(BuildCache::key("a", "b", "c") == BuildCache::key("a", "b", "c"));
+	REQUIRE(BuildCache::key("ab", "c", "") != BuildCache::key("a", "bc", ""));
+
+	// Using the oldest entry makes the second one the least recently used
+	std::filesystem::last_write_time(dir / "cache" / (keys[1] + ".bin"), std::filesystem::file_time_type::clock::now() - std::chrono::hours(1));
+	std::filesystem::last_write_time(dir / "cache" / (keys[0] + ".bin"), std::filesystem::file_time_type::clock::now() - std::chrono::hours(2));
+	auto fetched = (dir / "fetched").string();
+	REQUIRE(cache.fetch(keys[0], fetched));
+	REQUIRE(std::filesystem::file_size(fetched) == 1000);
+
+	cache.evict();
+
+	REQUIRE(cache.usage().second == 2);
+	REQUIRE_FALSE(cache.fetch(keys[1], fetched));
+	REQUIRE(cache.fetch(keys[2], fetched));
+	REQUIRE(cache.hits() == 2);
+	REQUIRE(cache.misses() == 1);
+
+	std::filesystem::remove_all(dir);
+}
+
+TEST_CASE("compiler command is split into arguments", "[process]") {
+	auto args = splitCommand("g++  -std=c++17 \"my dir/{source}\" -o '{target}.exe'");
+
+	REQUIRE(args == std::vector<std::string>{ "g++", "-std=c++17", "my dir/{source}", "-o", "{target}.exe" });
+	REQUIRE(splitCommand(" \t").empty());
+	REQUIRE(splitCommand("a \"\" b").size() == 3);
+}
+
+#ifdef JAGLE_HAS_SPAWN
+TEST_CASE("process reads its input from a pipe", "[process]") {
+	std::string error;
+
+	REQUIRE(runProcess({ "sh", "-c", "test \"$(cat)\" = 'int main() {}'" }, "int main() {}", error) == 0);
+	REQUIRE(runProcess({ "sh", "-c", "exit 3" }, std::string(1 << 20, 'x'), error) == 3);
+	REQUIRE(runProcess({ "jagle-no-such-command" }, "", error) != 0);
+}
+#endif
+
+TEST_CASE("ipow matches repeated multiplication", "[runtime]") {
+	for (int base = -5; base <= 5; base++) {
+		int expected = 1;
+		for (int exp = 0; exp <= 9; exp++) {
+			REQUIRE(ipow(base, exp) == expected);
+			expected *= base;
+		}
+	}
+	REQUIRE(ipow(2, -1) == 0);
+	REQUIRE(ipow(-1, -3) == -1);
+	REQUIRE(ipow(-1, -2) == 1);
+}
+
+TEST_CASE("memo cache computes each key once and stays within its bound", "[runtime]") {
+	MemoCache<int, int, std::string> cache(64);
+	int computed = 0;
+	auto sum = [&](int n, const std::string& s) {
+		return cache.get([&]() {
+			computed++;
+			return n + int(s.size());
+		}, n, s);
+	};
+	REQUIRE(sum(1, "ab") == 3);
+	REQUIRE(sum(1, "ab") == 3);
+	REQUIRE(sum(1, "abc") == 4);
+	REQUIRE(computed == 2);
+
+	// Beyond the bound new results replace old ones, which are computed again
+	for (int n = 0; n < 1000; n++) {
+		REQUIRE(sum(n, "x") == n + 1);
+	}
+	computed = 0;
+	for (int n = 0; n < 1000; n++) {
+		REQUIRE(sum(n, "x") == n + 1);
+	}
+	REQUIRE(computed >= 1000 - 64);
+}
+
+TEST_CASE("profile sites count executions and calls restore the caller's site", "[runtime]") {
+	static ProfileSite sites[2] = { { 1, 0, "assign" }, { 2, 0, "call" } };
+	static ProfileFunction function("f", sites, 2);
+
+	profile_at(sites[0]);
+	profile_at(sites[1]);
+	{
+		ProfileCall call(function);
+		profile_at(sites[0]);
+		REQUIRE(_jagle_profile_site == &sites[0]);
+	}
+	REQUIRE(_jagle_profile_site == &sites[1]);
+	REQUIRE(sites[0].count == 2);
+	REQUIRE(sites[1].count == 1);
+	REQUIRE(function.calls == 1);
+	_jagle_profile_site = nullptr;
+}
+
+TEST_CASE("PRINT buffer formats like std::cout", "[runtime]") {
+	std::FILE* file = std::tmpfile();
+	std::ostringstream expected;
+	{
+		PrintBuffer out(file);
+		out << "s " << std::string("str") << ' ' << 42 << ' ' << -7 << ' ' << 2.5f << ' ' << 1.0f / 3 << ' ' << 1e20 << ' '
+			<< (1 < 2) << ' ' << std::variant<int, float>(3) << '\n';
+		expected << "s " << std::string("str") << ' ' << 42 << ' ' << -7 << ' ' << 2.5f << ' ' << 1.0f / 3 << ' ' << 1e20 << ' '
+			<< (1 < 2) << ' ' << 3 << '\n';
+		// More than the buffer holds
+		std::string line(100000, 'x');
+		out << line;
+		expected << line;
+	}
+
+	std::string written(expected.str().size() + 1, '\0');
+	std::rewind(file);
+	written.resize(std::fread(written.data(), 1, written.size(), file));
+	std::fclose(file);
+	REQUIRE(written == expected.str());
+}
+
+TEST_CASE("numbers are parsed like std::cin reads them", "[runtime]") {
+	int i = 0;
+	REQUIRE(parse_number(" +42", i));
+	REQUIRE(i == 42);
+	REQUIRE(parse_number("-7", i));
+	REQUIRE(i == -7);
+	for (const char* invalid : { "", " ", "4 2", "42 ", "1.5", "+-1", "2147483648", "x" }) {
+		INFO(invalid);
+		REQUIRE_FALSE(parse_number(invalid, i));
+	}
+
+	float f = 0;
+	REQUIRE(parse_number("1e3", f));
+	REQUIRE(f == 1000.0f);
+	REQUIRE(parse_number(".25", f));
+	REQUIRE(f == 0.25f);
+	REQUIRE_FALSE(parse_number("1.5x", f));
+}
+
+TEST_CASE("val converts to int exactly, without a float in between", "[runtime]") {
+	REQUIRE(val_int("16777217") == 16777217);
+	REQUIRE(val_int("123456789") == 123456789);
+	REQUIRE(val_int(" +2147483647") == 2147483647);
+	REQUIRE(val_int("-2147483648") == -2147483647 - 1);
+	REQUIRE(val_int("42abc") == 42);
+	REQUIRE(val_int("12.9") == 12);
+	REQUIRE(val_int("-12.9") == -12);
+	REQUIRE(val_int("1e3") == 1000);
+	REQUIRE(val_int(".5") == 0);
+	REQUIRE(std::get<int>(val("123456789")) == 123456789);
+}
+
+// Run with: jagle_tests "[benchmark]"
+TEST_CASE("int exponents: std::pow, ipow and multiplication", "[.][benchmark]") {
+	constexpr int n = 100000;
+
+	BENCHMARK("std::pow, constant exponent") {
+		int64_t sum = 0;
+		for (int i = 0; i < n; i++) {
+			sum += std::pow(i % 1000, 3);
+		}
+		return sum;
+	};
+	BENCHMARK("ipow, constant exponent") {
+		int64_t sum = 0;
+		for (int i = 0; i < n; i++) {
+			sum += ipow(i % 1000, 3);
+		}
+		return sum;
+	};
+	BENCHMARK("multiplication, constant exponent") {
+		int64_t sum = 0;
+		for (int i = 0; i < n; i++) {
+			int j = i % 1000;
+			sum += j * j * j;
+		}
+		return sum;
+	};
+	BENCHMARK("std::pow, variable exponent") {
+		int64_t sum = 0;
+		for (int i = 0; i < n; i++) {
+			sum += std::pow(3, i % 19);
+		}
+		return sum;
+	};
+	BENCHMARK("ipow, variable exponent") {
+		int64_t sum = 0;
+		for (int i = 0; i < n; i++) {
+			sum += ipow(3, i % 19);
+		}
+		return sum;
+	};
+}
+
+TEST_CASE("PRINT of many lines: std::endl and the buffer", "[.][benchmark]") {
+	constexpr int n = 100000;
+	auto path = std::filesystem::temp_directory_path() / "jagle_print_bench.txt";
+
+	BENCHMARK("std::ofstream, std::endl per line") {
+		std::ofstream out(path);
+		for (int i = 0; i < n; i++) {
+			out << "line " << i << " " << i * 0.5f << std::endl;
+		}
+	};
+	BENCHMARK("PrintBuffer") {
+		std::FILE* file = std::fopen(path.string().c_str(), "w");
+		{
+			PrintBuffer out(file);
+			for (int i = 0; i < n; i++) {
+				out << "line " << i << " " << i * 0.5f << '\n';
+			}
+		}
+		std::fclose(file);
+	};
+
+	std::filesystem::remove(path);
+}
+
+TEST_CASE("building a 10 MB string: copies and in-place append", "[.][benchmark]") {
+	const std::string piece = "0123456789";
+
+	// Quadratic, a tenth of a megabyte already takes a while
+	BENCHMARK("s = s + piece, 100 KB") {
+		std::string s;
+		for (int i = 0; i < 10000; i++) {
+			s = s + piece;
+		}
+		return s.size();
+	};
+	BENCHMARK("s += piece, 10 MB") {
+		std::string s;
+		for (int i = 0; i < 1000000; i++) {
+			s += piece;
+		}
+		return s.size();
+	};
+	BENCHMARK("str_append, 10 MB") {
+		std::string s;
+		for (int i = 0; i < 1000000; i++) {
+			str_append(s, piece);
+		}
+		return s.size();
+	};
+	BENCHMARK("str_append of three parts, 10 MB") {
+		std::string s;
+		for (int i = 0; i < 1000000; i++) {
+			str_append(s, "012", "3456", "789");
+		}
+		return s.size();
+	};
+	BENCHMARK("s += three parts, 10 MB") {
+		std::string s;
+		for (int i = 0; i < 1000000; i++) {
+			s += "012";
+			s += "3456";
+			s += "789";
+		}
+		return s.size();
+	};
+}
+
+TEST_CASE("parsing numbers: std::stringstream and from_chars", "[.][benchmark]") {
+	std::vector<std::string> lines;
+	for (int i = 0; i < 100000; i++) {
+		lines.push_back(std::to_string(i * 7919 - 300000));
+	}
+
+	BENCHMARK("std::stringstream per line") {
+		int64_t sum = 0;
+		for (const auto& line : lines) {
+			std::stringstream ss(line);
+			int value;
+			ss >> value;
+			sum += value;
+		}
+		return sum;
+	};
+	BENCHMARK("std::stoi, std::to_string and std::stof, the old val()") {
+		double sum = 0;
+		for (const auto& line : lines) {
+			int value = std::stoi(line);
+			sum += std::to_string(value) == line ? value : std::stof(line);
+		}
+		return sum;
+	};
+	BENCHMARK("parse_number") {
+		int64_t sum = 0;
+		for (const auto& line : lines) {
+			int value;
+			parse_number(line, value);
+			sum += value;
+		}
+		return sum;
+	};
+}
@@ -2,6 +2,7 @@
 
 #include <filesystem>
 #include <iostream>
+#include <string>
 #include <string_view>
 #include <tuple>
 #include <variant>
@@ -13,6 +14,11 @@
 #include "JagleLexer.h"
 #include "JagleBaseVisitor.h"
 
+#include "emitter.h"
+#include "ir_builder.h"
+#include "passes.h"
+#include "semantic.h"
+
 using namespace jagle;
 using JP = JagleParser;
 
@@ -20,10 +26,14 @@ class OutputStream {
 private:
 	std::ofstream of_;
 	std::string file_name_;
+	bool echo_ = false;
 
 public:
 	OutputStream() = default;
 
+	// echo: copy everything written to the file also to std::cout
+	explicit OutputStream(bool echo) : echo_(echo) {}
+
 	~OutputStream() {
 		// Close open file.
 		if (of_.is_open()) {
@@ -42,79 +52,43 @@ public:
 
 	OutputStream& operator<<(std::ostream& (*manip)(std::ostream&)) {
 		of_ << manip;
-		std::cout << manip;
+		if (echo_) {
+			std::cout << manip;
+		}
 		return *this;
 	}
 
 	template <typename T>
 	OutputStream& operator<<(const T& t) {
 		of_ << t;
-		std::cout << t;
+		if (echo_) {
+			std::cout << t;
+		}
 		return *this;
 	}
 };
 
+// Generates the C++ program: lowers the parse tree into the IR, runs the optimization
+// passes on it and emits the result.
 class GeneratingVisitor : public JagleBaseVisitor {
 private:
-	int step_counter = 0;
+	// Static types of the program, picks specialized code when set
+	const SemanticAnalyzer* semantic = nullptr;
+	PassOptions passes = PassOptions::none();
 
-	std::vector<std::string> data;
-	std::vector<std::string> func_decls;
-	std::vector <std::string> func_bodies;
-	std::vector<std::string> statements;
+	CppEmitter emitter;
 
 public:
-	void writeOutput(const std::string& file_name);
+	GeneratingVisitor() = default;
+	explicit GeneratingVisitor(const SemanticAnalyzer* semantic, PassOptions passes = PassOptions::none(),
+		size_t data_blob_items = CppEmitter::DefaultDataBlobItems, bool bounds_checks = true, bool profile = false)
+		: semantic(semantic), passes(passes), emitter(data_blob_items, bounds_checks, profile) {}
+
+	void writeOutput(const std::string& file_name, bool echo = false);
+	// Complete C++ program, the text writeOutput writes
+	std::string getOutput();
 
 	std::any visitProg(JP::ProgContext* ctx) override;
-	std::any visitStmtList(JP::StmtListContext* ctx) override;
-
-	// Statements
-	std::any visitVariableDeclStmt(JP::VariableDeclStmtContext* ctx) override;
-	std::any visitVariableAssignmentStmt(JP::VariableAssignmentStmtContext* ctx) override;
-	std::any visitPrintStmt(JP::PrintStmtContext* ctx) override;
-	std::any visitForStmt(JP::ForStmtContext* ctx) override;
-	std::any visitIfStmt(JP::IfStmtContext* ctx) override;
-	std::any visitDataStmt(JP::DataStmtContext* ctx) override;
-	std::any visitReadStmt(JP::ReadStmtContext* ctx) override;
-	std::any visitRestoreStmt(JP::RestoreStmtContext* ctx) override;
-	std::any visitInputStmt(JP::InputStmtContext* ctx) override;
-
-	// Expressions
-	std::any visitLiteral(JP::LiteralContext* ctx) override;
-	std::any visitVariableDecl(JP::VariableDeclContext* ctx) override;
-	std::any visitVariableAssignment(JP::VariableAssignmentContext* ctx) override;
-	std::any visitIdentifier(JP::IdentifierContext* ctx) override;
-	std::any visitRelationalExpression(JP::RelationalExpressionContext* ctx) override;
-	std::any visitLogicalExpression(JP::LogicalExpressionContext* ctx) override;
-
-	// User defined functions
-	std::any visitFuncDefStmt(JP::FuncDefStmtContext* ctx) override;
-	std::any visitFuncCallStmt(JP::FuncCallStmtContext* ctx) override;
-	std::any visitFuncCall(JP::FuncCallContext* ctx) override;
-	std::any visitArgList(JP::ArgListContext* ctx) override;
-	std::any visitParamList(JP::ParamListContext* ctx) override;
-	std::any visitReturnStmt(JP::ReturnStmtContext* ctx) override;
-
-	// Built-in functions
-	std::any visitValFunc(JP::ValFuncContext* ctx) override;
-
-	// Math
-	std::any visitExponentExpression(JP::ExponentExpressionContext* ctx) override;
-	std::any visitMultiplyingExpression(JP::MultiplyingExpressionContext* ctx) override;
-	std::any visitAddingExpression(JP::AddingExpressionContext* ctx) override;
-	std::any visitUnaryExpression(JP::UnaryExpressionContext* ctx) override;
-
-	// Others
-	std::any visitVariableType(JP::VariableTypeContext* ctx) override;
-
-	// Helpers
-	bool processStatements(std::vector<JP::StmtListContext*> ctx, std::vector<std::string>& statements);
-	bool processStatements(JP::StmtListContext* ctx, std::vector<std::string>& statements);
-	std::string makeIdentifier(const std::string& varName);
-	std::string getIdentifier(JP::VariableAssignmentContext* ctx);
-	std::string getIdentifier(JP::IdentifierContext* ctx);
-	std::string getFuncIdentifier(JP::IdentifierContext* ctx);
 
 	std::string getStatements();
 	std::string getData();
@@ -0,0 +1,541 @@
+#include "vm.h"
+
+#include <cmath>
+#include <cstring>
+
+using bc::Kind;
+using bc::Opcode;
+
+// The runtime reads DATA from here in compiled programs, the VM hands it its own table
+const DataTable _jagle_data = {};
+
+namespace {
+
+size_t index(Kind kind) {
+	return static_cast<size_t>(kind);
+}
+
+// Wraps around on overflow like the compiled code does in practice, without the
+// undefined behavior in the VM itself
+int wrap(int64_t value) {
+	return static_cast<int>(static_cast<uint32_t>(value));
+}
+
+}
+
+Vm::Vm(const bc::Program& program, PrintBuffer& out)
+	: program(program), out(out), memos(program.functions.size(), MemoCache<MemoResult, std::string>(MemoEntries)) {
+	const DataTables& tables = program.data;
+	data.tags = tables.tags.data();
+	data.size = tables.tags.size();
+	data.ints = tables.ints.data();
+	data.floats = tables.floats.data();
+	data.str_offsets = tables.str_offsets.data();
+	data.str_pool = tables.str_pool.data();
+}
+
+void Vm::run() {
+	data_use(data);
+	const bc::Function& main = program.functions[0];
+	Base base = push(main);
+	execute(main, base);
+	pop(base);
+	out.flush();
+	// The table goes with the VM
+	data_use(_jagle_data);
+}
+
+Vm::Base Vm::push(const bc::Function& function) {
+	Base base = { ints.size(), floats.size(), doubles.size(), strs.size(), int_arrays.size(), float_arrays.size(),
+		str_arrays.size(), ranges.size() };
+	const uint32_t* count = function.registers;
+	ints.resize(base[0] + count[index(Kind::Int)]);
+	floats.resize(base[1] + count[index(Kind::Float)]);
+	doubles.resize(base[2] + count[index(Kind::Double)]);
+	strs.resize(base[3] + count[index(Kind::Str)]);
+	int_arrays.resize(base[4] + count[index(Kind::IntArray)]);
+	float_arrays.resize(base[5] + count[index(Kind::FloatArray)]);
+	str_arrays.resize(base[6] + count[index(Kind::StrArray)]);
+	ranges.resize(base[7] + count[index(Kind::Range)]);
+	return base;
+}
+
+void Vm::pop(const Base& base) {
+	ints.resize(base[0]);
+	floats.resize(base[1]);
+	doubles.resize(base[2]);
+	strs.resize(base[3]);
+	int_arrays.resize(base[4]);
+	float_arrays.resize(base[5]);
+	str_arrays.resize(base[6]);
+	ranges.resize(base[7]);
+}
+
+std::string Vm::memoKey(const bc::Function& function, const Base& base) const {
+	std::string key;
+	auto append = [&](const void* bytes, size_t size) { key.append(static_cast<const char*>(bytes), size); };
+	Base next = base;
+	for (Kind kind : function.args) {
+		size_t at = next[index(kind)]++;
+		switch (kind) {
+		case Kind::Int:
+			append(&ints[at], sizeof(int));
+			break;
+		case Kind::Float:
+			append(&floats[at], sizeof(float));
+			break;
+		case Kind::Double:
+			append(&doubles[at], sizeof(double));
+			break;
+		case Kind::Str: {
+			// Length first, "a", "bc" and "ab", "c" are different keys
+			size_t size = strs[at].size();
+			append(&size, sizeof(size));
+			key += strs[at];
+			break;
+		}
+		default:
+			// A memo func takes no arrays
+			break;
+		}
+	}
+	return key;
+}
+
+void Vm::execute(const bc::Function& function, const Base& base) {
+	// Registers of this call. A call can grow the register files, they are looked up again
+	// after every call.
+	int* I;
+	float* F;
+	double* D;
+	std::string* S;
+	std::shared_ptr<Array<int>>* IA;
+	std::shared_ptr<Array<float>>* FA;
+	std::shared_ptr<Array<std::string>>* SA;
+	ParallelRange* R;
+	auto locate = [&]() {
+		I = ints.data() + base[0];
+		F = floats.data() + base[1];
+		D = doubles.data() + base[2];
+		S = strs.data() + base[3];
+		IA = int_arrays.data() + base[4];
+		FA = float_arrays.data() + base[5];
+		SA = str_arrays.data() + base[6];
+		R = ranges.data() + base[7];
+	};
+	locate();
+
+	const bc::Instr* code = function.code.data();
+	const bc::Instr* pc = code;
+	while (true) {
+		const bc::Instr& in = *pc++;
+		switch (in.op) {
+		case Opcode::LoadInt:
+			I[in.a] = in.b;
+			break;
+		case Opcode::LoadFloat:
+			std::memcpy(&F[in.a], &in.b, sizeof(float));
+			break;
+		case Opcode::LoadDouble:
+			D[in.a] = program.doubles[in.b];
+			break;
+		case Opcode::LoadStr:
+			S[in.a] = program.strs[in.b];
+			break;
+		case Opcode::MoveInt:
+			I[in.a] = I[in.b];
+			break;
+		case Opcode::MoveFloat:
+			F[in.a] = F[in.b];
+			break;
+		case Opcode::MoveDouble:
+			D[in.a] = D[in.b];
+			break;
+		case Opcode::MoveStr:
+			S[in.a] = S[in.b];
+			break;
+
+		case Opcode::IntToFloat:
+			F[in.a] = static_cast<float>(I[in.b]);
+			break;
+		case Opcode::IntToDouble:
+			D[in.a] = static_cast<double>(I[in.b]);
+			break;
+		case Opcode::FloatToInt:
+			I[in.a] = static_cast<int>(F[in.b]);
+			break;
+		case Opcode::FloatToDouble:
+			D[in.a] = static_cast<double>(F[in.b]);
+			break;
+		case Opcode::DoubleToInt:
+			I[in.a] = static_cast<int>(D[in.b]);
+			break;
+		case Opcode::DoubleToFloat:
+			F[in.a] = static_cast<float>(D[in.b]);
+			break;
+
+		case Opcode::AddInt:
+			I[in.a] = wrap(int64_t(I[in.b]) + I[in.c]);
+			break;
+		case Opcode::SubInt:
+			I[in.a] = wrap(int64_t(I[in.b]) - I[in.c]);
+			break;
+		case Opcode::MulInt:
+			I[in.a] = wrap(int64_t(I[in.b]) * I[in.c]);
+			break;
+		case Opcode::DivInt:
+			// Division by zero traps, as in the compiled program
+			I[in.a] = I[in.b] / I[in.c];
+			break;
+		case Opcode::ModInt:
+			I[in.a] = I[in.b] % I[in.c];
+			break;
+		case Opcode::PowInt:
+			I[in.a] = ipow(I[in.b], I[in.c]);
+			break;
+		case Opcode::AddFloat:
+			F[in.a] = F[in.b] + F[in.c];
+			break;
+		case Opcode::SubFloat:
+			F[in.a] = F[in.b] - F[in.c];
+			break;
+		case Opcode::MulFloat:
+			F[in.a] = F[in.b] * F[in.c];
+			break;
+		case Opcode::DivFloat:
+			F[in.a] = F[in.b] / F[in.c];
+			break;
+		case Opcode::ModFloat:
+			F[in.a] = std::fmod(F[in.b], F[in.c]);
+			break;
+		case Opcode::PowFloat:
+			F[in.a] = std::pow(F[in.b], F[in.c]);
+			break;
+		case Opcode::AddDouble:
+			D[in.a] = D[in.b] + D[in.c];
+			break;
+		case Opcode::SubDouble:
+			D[in.a] = D[in.b] - D[in.c];
+			break;
+		case Opcode::MulDouble:
+			D[in.a] = D[in.b] * D[in.c];
+			break;
+		case Opcode::DivDouble:
+			D[in.a] = D[in.b] / D[in.c];
+			break;
+		case Opcode::ModDouble:
+			D[in.a] = std::fmod(D[in.b], D[in.c]);
+			break;
+		case Opcode::PowDouble:
+			D[in.a] = std::pow(D[in.b], D[in.c]);
+			break;
+		case Opcode::AddIntConst:
+			I[in.a] = wrap(int64_t(I[in.b]) + in.c);
+			break;
+		case Opcode::NegInt:
+			I[in.a] = wrap(-int64_t(I[in.b]));
+			break;
+		case Opcode::NegFloat:
+			F[in.a] = -F[in.b];
+			break;
+		case Opcode::NegDouble:
+			D[in.a] = -D[in.b];
+			break;
+		case Opcode::TestInt:
+			I[in.a] = I[in.b] != 0;
+			break;
+		case Opcode::TestFloat:
+			I[in.a] = F[in.b] != 0;
+			break;
+		case Opcode::TestDouble:
+			I[in.a] = D[in.b] != 0;
+			break;
+		case Opcode::NotInt:
+			I[in.a] = I[in.b] == 0;
+			break;
+		case Opcode::NotFloat:
+			I[in.a] = F[in.b] == 0;
+			break;
+		case Opcode::NotDouble:
+			I[in.a] = D[in.b] == 0;
+			break;
+
+		case Opcode::EqInt:
+			I[in.a] = I[in.b] == I[in.c];
+			break;
+		case Opcode::NeInt:
+			I[in.a] = I[in.b] != I[in.c];
+			break;
+		case Opcode::LtInt:
+			I[in.a] = I[in.b] < I[in.c];
+			break;
+		case Opcode::LeInt:
+			I[in.a] = I[in.b] <= I[in.c];
+			break;
+		case Opcode::GtInt:
+			I[in.a] = I[in.b] > I[in.c];
+			break;
+		case Opcode::GeInt:
+			I[in.a] = I[in.b] >= I[in.c];
+			break;
+		case Opcode::EqFloat:
+			I[in.a] = F[in.b] == F[in.c];
+			break;
+		case Opcode::NeFloat:
+			I[in.a] = F[in.b] != F[in.c];
+			break;
+		case Opcode::LtFloat:
+			I[in.a] = F[in.b] < F[in.c];
+			break;
+		case Opcode::LeFloat:
+			I[in.a] = F[in.b] <= F[in.c];
+			break;
+		case Opcode::GtFloat:
+			I[in.a] = F[in.b] > F[in.c];
+			break;
+		case Opcode::GeFloat:
+			I[in.a] = F[in.b] >= F[in.c];
+			break;
+		case Opcode::EqDouble:
+			I[in.a] = D[in.b] == D[in.c];
+			break;
+		case Opcode::NeDouble:
+			I[in.a] = D[in.b] != D[in.c];
+			break;
+		case Opcode::LtDouble:
+			I[in.a] = D[in.b] < D[in.c];
+			break;
+		case Opcode::LeDouble:
+			I[in.a] = D[in.b] <= D[in.c];
+			break;
+		case Opcode::GtDouble:
+			I[in.a] = D[in.b] > D[in.c];
+			break;
+		case Opcode::GeDouble:
+			I[in.a] = D[in.b] >= D[in.c];
+			break;
+		case Opcode::EqStr:
+			I[in.a] = S[in.b] == S[in.c];
+			break;
+		case Opcode::NeStr:
+			I[in.a] = S[in.b] != S[in.c];
+			break;
+		case Opcode::LtStr:
+			I[in.a] = S[in.b] < S[in.c];
+			break;
+		case Opcode::LeStr:
+			I[in.a] = S[in.b] <= S[in.c];
+			break;
+		case Opcode::GtStr:
+			I[in.a] = S[in.b] > S[in.c];
+			break;
+		case Opcode::GeStr:
+			I[in.a] = S[in.b] >= S[in.c];
+			break;
+
+		case Opcode::Concat:
+			S[in.a] = S[in.b] + S[in.c];
+			break;
+		case Opcode::Append:
+			str_append(S[in.a], S[in.b]);
+			break;
+
+		case Opcode::Jump:
+			pc = code + in.a;
+			break;
+		case Opcode::JumpIfZero:
+			if (I[in.a] == 0) {
+				pc = code + in.b;
+			}
+			break;
+		case Opcode::JumpIfNotZero:
+			if (I[in.a] != 0) {
+				pc = code + in.b;
+			}
+			break;
+		case Opcode::JumpIfNotLe:
+			if (!(I[in.a] <= I[in.b])) {
+				pc = code + in.c;
+			}
+			break;
+		case Opcode::JumpIfNotGe:
+			if (!(I[in.a] >= I[in.b])) {
+				pc = code + in.c;
+			}
+			break;
+
+		case Opcode::NewIntArray:
+			IA[in.a] = std::make_shared<Array<int>>(I[in.b]);
+			break;
+		case Opcode::NewFloatArray:
+			FA[in.a] = std::make_shared<Array<float>>(I[in.b]);
+			break;
+		case Opcode::NewStrArray:
+			SA[in.a] = std::make_shared<Array<std::string>>(I[in.b]);
+			break;
+		case Opcode::GetInt:
+			I[in.a] = IA[in.b]->at(I[in.c]);
+			break;
+		case Opcode::GetFloat:
+			F[in.a] = FA[in.b]->at(I[in.c]);
+			break;
+		case Opcode::GetStr:
+			S[in.a] = SA[in.b]->at(I[in.c]);
+			break;
+		case Opcode::SetInt:
+			IA[in.a]->at(I[in.b]) = I[in.c];
+			break;
+		case Opcode::SetFloat:
+			FA[in.a]->at(I[in.b]) = F[in.c];
+			break;
+		case Opcode::SetStr:
+			SA[in.a]->at(I[in.b]) = S[in.c];
+			break;
+
+		case Opcode::PrintInt:
+			out << I[in.a];
+			break;
+		case Opcode::PrintFloat:
+			out << F[in.a];
+			break;
+		case Opcode::PrintDouble:
+			out << D[in.a];
+			break;
+		case Opcode::PrintStr:
+			out << S[in.a];
+			break;
+		case Opcode::PrintConst:
+			out << program.strs[in.a];
+			break;
+		case Opcode::PrintNewline:
+			out << '\n';
+			break;
+		case Opcode::PrintVal:
+			out << val(S[in.a]);
+			break;
+
+		case Opcode::ReadInt:
+			data_read(I[in.a]);
+			break;
+		case Opcode::ReadFloat:
+			data_read(F[in.a]);
+			break;
+		case Opcode::ReadStr:
+			data_read(S[in.a]);
+			break;
+		case Opcode::Restore:
+			data_restore();
+			break;
+		case Opcode::InputInt:
+			prompt_input(program.strs[in.b], I[in.a], in.c >= 0, in.c >= 0 ? I[in.c] : 0);
+			break;
+		case Opcode::InputFloat:
+			prompt_input(program.strs[in.b], F[in.a], in.c >= 0, in.c >= 0 ? F[in.c] : 0.0f);
+			break;
+		case Opcode::InputStr:
+			prompt_input(program.strs[in.b], S[in.a], in.c >= 0, in.c >= 0 ? S[in.c] : std::string());
+			break;
+		case Opcode::ValInt:
+			I[in.a] = val_int(S[in.b]);
+			break;
+		case Opcode::ValFloat:
+			F[in.a] = val_float(S[in.b]);
+			break;
+
+		case Opcode::Call: {
+			const bc::Function& callee = program.functions[in.b];
+			Base callee_base = push(callee);
+			locate();
+
+			// Arguments are the callee's first registers of their kind. Arrays are shared.
+			Base next = callee_base;
+			for (size_t i = 0; i < callee.args.size(); i++) {
+				int32_t arg = function.call_args[in.c + i];
+				size_t to = next[index(callee.args[i])]++;
+				switch (callee.args[i]) {
+				case Kind::Int:
+					ints[to] = I[arg];
+					break;
+				case Kind::Float:
+					floats[to] = F[arg];
+					break;
+				case Kind::Double:
+					doubles[to] = D[arg];
+					break;
+				case Kind::Str:
+					strs[to] = S[arg];
+					break;
+				case Kind::IntArray:
+					int_arrays[to] = IA[arg];
+					break;
+				case Kind::FloatArray:
+					float_arrays[to] = FA[arg];
+					break;
+				case Kind::StrArray:
+					str_arrays[to] = SA[arg];
+					break;
+				case Kind::Range:
+					break;
+				}
+			}
+
+			if (callee.memo) {
+				MemoResult memo = memos[in.b].get([&]() {
+					execute(callee, callee_base);
+					return MemoResult{ int_result, float_result, str_result };
+				}, memoKey(callee, callee_base));
+				int_result = memo.i;
+				float_result = memo.f;
+				str_result = std::move(memo.s);
+			}
+			else {
+				execute(callee, callee_base);
+			}
+			pop(callee_base);
+			locate();
+
+			if (callee.returns && in.a >= 0) {
+				switch (callee.result) {
+				case Kind::Float:
+					F[in.a] = float_result;
+					break;
+				case Kind::Str:
+					S[in.a] = std::move(str_result);
+					break;
+				default:
+					I[in.a] = int_result;
+					break;
+				}
+			}
+			break;
+		}
+		case Opcode::Return:
+			return;
+		case Opcode::ReturnInt:
+			int_result = I[in.a];
+			return;
+		case Opcode::ReturnFloat:
+			float_result = F[in.a];
+			return;
+		case Opcode::ReturnStr:
+			str_result = S[in.a];
+			return;
+
+		case Opcode::NewRange:
+			R[in.a] = ParallelRange(I[in.b], D[in.c], I[in.b + 1]);
+			break;
+		case Opcode::RangeChunks:
+			I[in.a] = static_cast<int>(R[in.b].chunks());
+			break;
+		case Opcode::RangeFirst:
+			I[in.a] = R[in.b].first(static_cast<unsigned>(I[in.c]));
+			break;
+		case Opcode::RangeLast:
+			I[in.a] = R[in.b].last(static_cast<unsigned>(I[in.c]));
+			break;
+
+		case Opcode::Halt:
+			return;
+		}
+	}
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <array>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "bytecode.h"
+#include "jagle.hpp"
+
+// Executes bytecode. PRINT, DATA, INPUT, val() and the array checks are those of the
+// runtime library the compiled programs link, so the output is the same byte for byte.
+class Vm {
+private:
+	using Base = std::array<size_t, bc::KindCount>;
+
+	const bc::Program& program;
+	PrintBuffer& out;
+	DataTable data;
+
+	// Registers of every active call, each call has its own range from its base on
+	std::vector<int> ints;
+	std::vector<float> floats;
+	std::vector<double> doubles;
+	std::vector<std::string> strs;
+	std::vector<std::shared_ptr<Array<int>>> int_arrays;
+	std::vector<std::shared_ptr<Array<float>>> float_arrays;
+	std::vector<std::shared_ptr<Array<std::string>>> str_arrays;
+	std::vector<ParallelRange> ranges;
+
+	// Value of the last return with one
+	int int_result = 0;
+	float float_result = 0;
+	std::string str_result;
+
+	struct MemoResult {
+		int i = 0;
+		float f = 0;
+		std::string s;
+	};
+	// Results of each memo func by the bytes of its arguments
+	static constexpr size_t MemoEntries = 1 << 20;
+	std::vector<MemoCache<MemoResult, std::string>> memos;
+
+	Base push(const bc::Function& function);
+	std::string memoKey(const bc::Function& function, const Base& base) const;
+	void pop(const Base& base);
+	void execute(const bc::Function& function, const Base& base);
+
+public:
+	explicit Vm(const bc::Program& program, PrintBuffer& out = _jagle_out);
+
+	// Runs the main program and flushes its output
+	void run();
+};
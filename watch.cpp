@@ -0,0 +1,135 @@
+#include "watch.h"
+
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <set>
+#include <sstream>
+#include <thread>
+
+#include <fmt/core.h>
+
+#include "hash.h"
+
+#ifdef __linux__
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+namespace fs = std::filesystem;
+
+struct WatchedProgram {
+	TranspileJob job;
+	IncrementalState state;
+	// Sources the last build read, the program and its modules, and their hash
+	std::vector<std::string> sources;
+	std::string source_hash;
+};
+
+std::string hashFiles(const std::vector<std::string>& file_names) {
+	ContentHash hash;
+	for (const auto& file_name : file_names) {
+		std::ifstream file(file_name, std::ios::binary);
+		std::ostringstream contents;
+		contents << file.rdbuf();
+		hash.field(contents.str());
+	}
+	return hash.hex();
+}
+
+void build(WatchedProgram& program, const CompilerConfig& config, const DriverOptions& options, unsigned int thread_count,
+	bool rebuild) {
+	auto started = std::chrono::steady_clock::now();
+	TranspileResult result = transpileIncremental(program.job, config, options, program.state, thread_count);
+	// Imports may have changed with the program
+	if (!result.sources.empty() && result.sources != program.sources) {
+		program.sources = result.sources;
+		program.source_hash = hashFiles(program.sources);
+	}
+	double build_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - started).count();
+
+	if (!result.ok) {
+		std::cout << fmt::format("FAIL  {}: {}", program.job.source_fname, result.error) << std::endl;
+		return;
+	}
+
+	std::string line = fmt::format("ok    {} -> {}: {} of {} functions generated, {} of {} units compiled, {:.0f} ms",
+		program.job.source_fname, program.job.target_name, result.emitted_functions, result.units - 1,
+		result.compiled_units, result.units, build_ms);
+	// Edit to binary latency, noticing the change included
+	std::error_code ec;
+	auto written = fs::last_write_time(program.job.source_fname, ec);
+	if (rebuild && !ec) {
+		line += fmt::format(", {:.0f} ms after the save",
+			std::chrono::duration<double, std::milli>(fs::file_time_type::clock::now() - written).count());
+	}
+	std::cout << line << std::endl;
+}
+
+}
+
+void watchFiles(const std::vector<TranspileJob>& jobs, const CompilerConfig& config, const DriverOptions& options,
+	unsigned int thread_count) {
+	std::vector<WatchedProgram> programs;
+	for (const auto& job : jobs) {
+		programs.push_back({ job, IncrementalState(), { job.source_fname }, hashFiles({ job.source_fname }) });
+		build(programs.back(), config, options, thread_count, false);
+	}
+
+#ifdef __linux__
+	// The directories are watched, editors often save by renaming a new file over the old one
+	int fd = inotify_init1(IN_CLOEXEC);
+	std::set<std::string> dirs;
+	for (const auto& job : jobs) {
+		dirs.insert(fs::absolute(job.source_fname).parent_path().string());
+	}
+	for (const auto& dir : dirs) {
+		if (fd >= 0 && inotify_add_watch(fd, dir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE) < 0) {
+			close(fd);
+			fd = -1;
+		}
+	}
+#endif
+
+	std::cout << fmt::format("Watching {} file{}, Ctrl-C to stop", jobs.size(), jobs.size() == 1 ? "" : "s") << std::endl;
+
+	for (;;) {
+#ifdef __linux__
+		if (fd >= 0) {
+			alignas(inotify_event) char events[4096];
+			if (read(fd, events, sizeof(events)) < 0) {
+				continue;
+			}
+			// A save is often several events, wait until they stop
+			pollfd pending = { fd, POLLIN, 0 };
+			while (poll(&pending, 1, 20) > 0) {
+				if (read(fd, events, sizeof(events)) < 0) {
+					break;
+				}
+			}
+		}
+		else {
+			std::this_thread::sleep_for(std::chrono::milliseconds(250));
+		}
+#else
+		std::this_thread::sleep_for(std::chrono::milliseconds(250));
+#endif
+
+		// Events of other files in the directories and saves without changes end here
+		for (auto& program : programs) {
+			std::error_code ec;
+			if (!fs::exists(program.job.source_fname, ec)) {
+				continue;
+			}
+			std::string hash = hashFiles(program.sources);
+			if (hash != program.source_hash) {
+				program.source_hash = hash;
+				build(program, config, options, thread_count, true);
+			}
+		}
+	}
+}
@@ -0,0 +1,11 @@
+#pragma once
+
+#include <vector>
+
+#include "driver.h"
+
+// Builds the programs incrementally, then again whenever one of their sources is saved,
+// until the process is interrupted. Only changed sources are transpiled again. Changes are
+// seen through inotify on Linux and by polling the sources elsewhere.
+void watchFiles(const std::vector<TranspileJob>& jobs, const CompilerConfig& config, const DriverOptions& options,
+	unsigned int thread_count);